@@ -0,0 +1,225 @@
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+#include <string.h>
+#include <stdio.h>
+#include "Cpu.hpp"
+#include "Memory.hpp"
+
+// Runs the same 6502 program on each Cpu engine and reports millions of
+// instructions per second. The final registers, flags and memory of every
+// engine are compared against the table engine, which is the reference.
+// The jit engine runs whole blocks and can stop a few instructions past the
+// target, so it is compared against a table run of the same length.
+//
+// "--state" prints only the final state of every engine, which is how the
+// eager and CPU_LAZY_FLAGS builds are compared (make lazy-flags-check).
+
+#define BENCHMARK_SEED          1234      // default $FE seed, "--seed N" to change
+#define BENCHMARK_INSTRUCTIONS  20000000
+#define BENCHMARK_SLICE         10000     // instructions per Cpu::runInstructions call
+
+// $0600: mixed load/store/arithmetic/branch kernel that loops forever
+static uint8_t benchmarkProgram[] =
+{
+  0xd8,             // 0600 CLD
+  0xa9, 0x00,       // 0601 LDA #$00
+  0x85, 0x10,       // 0603 STA $10
+  0xa9, 0x03,       // 0605 LDA #$03
+  0x85, 0x11,       // 0607 STA $11         ($10) -> $0300
+  0xa2, 0x00,       // 0609 LDX #$00        main:
+  0xbd, 0x00, 0x03, // 060B LDA $0300,X     loop1:
+  0x18,             // 060E CLC
+  0x65, 0x12,       // 060F ADC $12
+  0x9d, 0x00, 0x03, // 0611 STA $0300,X
+  0x85, 0x12,       // 0614 STA $12
+  0xe8,             // 0616 INX
+  0xe0, 0x40,       // 0617 CPX #$40
+  0xd0, 0xf0,       // 0619 BNE loop1
+  0xa0, 0x3f,       // 061B LDY #$3F
+  0xb1, 0x10,       // 061D LDA ($10),Y     loop2:
+  0x49, 0x5a,       // 061F EOR #$5A
+  0x0a,             // 0621 ASL A
+  0x26, 0x13,       // 0622 ROL $13
+  0x48,             // 0624 PHA
+  0x68,             // 0625 PLA
+  0x38,             // 0626 SEC
+  0xe9, 0x03,       // 0627 SBC #$03
+  0x91, 0x10,       // 0629 STA ($10),Y
+  0x88,             // 062B DEY
+  0xc0, 0xff,       // 062C CPY #$FF
+  0xd0, 0xed,       // 062E BNE loop2
+  0x20, 0x3c, 0x06, // 0630 JSR sub
+  0xe6, 0x14,       // 0633 INC $14
+  0xa5, 0x14,       // 0635 LDA $14
+  0x24, 0x13,       // 0637 BIT $13
+  0x4c, 0x09, 0x06, // 0639 JMP main
+  0xaa,             // 063C TAX             sub:
+  0x8a,             // 063D TXA
+  0xc9, 0x80,       // 063E CMP #$80
+  0x90, 0x02,       // 0640 BCC skip
+  0xa9, 0x00,       // 0642 LDA #$00
+  0x60,             // 0644 RTS             skip:
+};
+
+struct BenchmarkResult
+{
+  Cpu::Engine engine;     // the engine that ran, the jit falls back to fused
+  uint64_t instructions;
+  double seconds;
+  uint8_t a;
+  uint8_t x;
+  uint8_t y;
+  uint8_t sp;
+  uint8_t flags;
+  uint16_t pc;
+  uint64_t predecodeHits;
+  uint64_t predecodeMisses;
+};
+
+static uint32_t benchmarkSeed = BENCHMARK_SEED;
+
+static void runEngine(Cpu::Engine engine, Memory &memory, uint64_t instructions, BenchmarkResult &result)
+{
+  typedef std::chrono::high_resolution_clock Time;
+  Cpu cpu;
+
+  memory.set_memory(0x600, benchmarkProgram, sizeof(benchmarkProgram));
+  cpu.setMemory(&memory);
+  memory.set_cpu(&cpu);
+  cpu.setPc(0x0600);
+  cpu.setEngine(engine);
+  cpu.setRandomSeed(benchmarkSeed);
+
+  auto startTime = Time::now();
+  while (cpu.getInstructionCount() < instructions)
+  {
+    uint64_t remaining = instructions - cpu.getInstructionCount();
+    cpu.runInstructions((remaining < BENCHMARK_SLICE) ? remaining : BENCHMARK_SLICE);
+  }
+  auto endTime = Time::now();
+
+  result.engine = cpu.getEngine();
+  result.instructions = cpu.getInstructionCount();
+  result.seconds = std::chrono::duration<double>(endTime - startTime).count();
+  result.a = cpu.getA();
+  result.x = cpu.getX();
+  result.y = cpu.getY();
+  result.sp = cpu.getStackPointer();
+  result.flags = cpu.getFlags();
+  result.pc = cpu.getProgramCounter();
+  result.predecodeHits = cpu.getPredecodeHits();
+  result.predecodeMisses = cpu.getPredecodeMisses();
+}
+
+// FNV-1a over guest memory
+static uint32_t hashMemory(Memory &memory)
+{
+  uint32_t hash = 2166136261u;
+  uint8_t *bytes = memory.get_memory();
+
+  for (uint32_t i = 0; i < 0x10000; i++)
+  {
+    hash = (hash ^ bytes[i]) * 16777619u;
+  }
+
+  return hash;
+}
+
+int main(int argc, char *argv[])
+{
+  bool stateOnly = false;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "--state") == 0)
+    {
+      stateOnly = true;
+    }
+    else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+    {
+      benchmarkSeed = strtoul(argv[++i], nullptr, 0);
+    }
+  }
+
+  const struct
+  {
+    Cpu::Engine engine;
+    const char *name;
+  } engines[] =
+  {
+    { Cpu::EngineTable,     "table"     },
+    { Cpu::EngineSwitch,    "switch"    },
+    { Cpu::EngineFused,     "fused"     },
+    { Cpu::EngineJit,       "jit"       },
+    { Cpu::EnginePredecode, "predecode" },
+  };
+  const size_t engineCount = sizeof(engines) / sizeof(engines[0]);
+
+  Memory *memories[engineCount];
+  BenchmarkResult results[engineCount];
+  bool allMatch = true;
+
+  if (!stateOnly)
+  {
+    printf("%-10s %12s %10s %10s  %s\n", "engine", "instructions", "seconds", "MIPS", "state");
+  }
+
+  for (size_t i = 0; i < engineCount; i++)
+  {
+    memories[i] = new Memory();
+    runEngine(engines[i].engine, *memories[i], BENCHMARK_INSTRUCTIONS, results[i]);
+
+    // reference state for the number of instructions this engine actually ran
+    Memory *referenceMemory = memories[0];
+    BenchmarkResult reference = results[0];
+    if (results[i].instructions != results[0].instructions)
+    {
+      referenceMemory = new Memory();
+      runEngine(Cpu::EngineTable, *referenceMemory, results[i].instructions, reference);
+    }
+
+    bool match = results[i].a == reference.a
+      && results[i].x == reference.x
+      && results[i].y == reference.y
+      && results[i].sp == reference.sp
+      && results[i].flags == reference.flags
+      && results[i].pc == reference.pc
+      && memcmp(memories[i]->get_memory(), referenceMemory->get_memory(), 0x10000) == 0;
+    allMatch = allMatch && match;
+
+    if (referenceMemory != memories[0])
+    {
+      delete referenceMemory;
+    }
+
+    if (stateOnly)
+    {
+      printf("%-10s %12llu a=%02x x=%02x y=%02x sp=%02x p=%02x pc=%04x memory=%08x\n", engines[i].name,
+          (unsigned long long)results[i].instructions, results[i].a, results[i].x, results[i].y, results[i].sp,
+          results[i].flags, results[i].pc, hashMemory(*memories[i]));
+      continue;
+    }
+
+    printf("%-10s %12llu %10.3f %10.2f  %s\n", engines[i].name, (unsigned long long)results[i].instructions, results[i].seconds,
+        results[i].instructions / results[i].seconds / 1000000.0, (i == 0) ? "reference" : (match ? "match" : "MISMATCH"));
+
+    if (results[i].engine != engines[i].engine)
+    {
+      printf("%-10s not available on this host, ran the fused engine\n", "");
+    }
+
+    if (results[i].predecodeHits + results[i].predecodeMisses != 0)
+    {
+      printf("%-10s predecode cache: %llu hits, %llu misses\n", "", (unsigned long long)results[i].predecodeHits,
+          (unsigned long long)results[i].predecodeMisses);
+    }
+  }
+
+  for (size_t i = 0; i < engineCount; i++)
+  {
+    delete memories[i];
+  }
+
+  return allMatch ? 0 : 1;
+}
@@ -1,6 +1,5 @@
 #include "Cpu.hpp"
 #include <string.h>
-#include <cstdlib>
 
 enum OperationEnum
 {
@@ -103,7 +102,7 @@ enum OperationEnum
 #define KIL 0xFF
 
 // high 4 bits for cycles to add if page is crossed, lower 4 bits are always added
-const uint8_t Cpu::TimingLookupTable[] = 
+constexpr uint8_t Cpu::TimingLookupTable[] = 
 {
   //        x0     x1      x2       x3     x4      x5     x6     x7     x8       x9       xA       xB       xC       xD       xE      xF
   /*0x*/    7,     6,      KIL,     8,     3,      3,     5,     5,     3,       2,       2,       2,       4,       4,       6,      6,
@@ -144,7 +143,7 @@ const uint8_t Cpu::SizeLookupTable[] =
   BEQ,  SBC,  SBC,  SBC,  PEA,  SBC,  INC,  SBC,  SED,  SBC,  PLX,  XCE,  JSR,  SBC,  INC,  SBC,
 };
 
-const uint8_t Cpu::OperationCodeLookupTable[] = 
+constexpr uint8_t Cpu::OperationCodeLookupTable[] = 
 {
 // x0    x1    x2    x3    x4    x5    x6    x7    x8    x9    xA    xB    xC    xD    xE    xF
   BRK,  ORA,  COP,  ORA,  TSB,  ORA,  ASL,  ORA,  PHP,  ORA,  ASL,  PHD,  TSB,  ORA,  ASL,  ORA,  // 0x
@@ -165,7 +164,7 @@ const uint8_t Cpu::OperationCodeLookupTable[] =
   BEQ,  SBC,  SBC,  SBC,  PEA,  SBC,  INC,  SBC,  SED,  SBC,  PLX,  XCE,  JSR,  SBC,  INC,  SBC,  // Fx
 };
 
-const Cpu::OpCode_T Cpu::OperationCodeFunctionTable[] = 
+constexpr Cpu::OpCode_T Cpu::OperationCodeFunctionTable[] = 
 {
   &Cpu::iBRK,                          // BReaKpoint
   &Cpu::iORA,                          // bitwise OR Accumulator
@@ -261,26 +260,192 @@ const Cpu::OpCode_T Cpu::OperationCodeFunctionTable[] =
   &Cpu::iXCE,                          // eXchange Carry and Emulation flags
 };
 
+#ifdef CPU_LAZY_FLAGS
+
+inline bool Cpu::getNegativeFlag()
+{
+  return zeroNegativeResult & 0x8000;
+}
+
+inline bool Cpu::getOverflowFlag()
+{
+  return overflowResult & 0x80;
+}
+
+inline bool Cpu::getZeroFlag()
+{
+  return (zeroNegativeResult & 0xFF) == 0;
+}
+
+inline bool Cpu::getCarryFlag()
+{
+  return carryResult & 0x100;
+}
+
+inline void Cpu::setNegative(bool value)
+{
+  zeroNegativeResult = (zeroNegativeResult & 0x00FF) | (value ? 0x8000 : 0);
+}
+
+inline void Cpu::setOverflow(bool value)
+{
+  overflowResult = value ? 0x80 : 0;
+}
+
+inline void Cpu::setZero(bool value)
+{
+  zeroNegativeResult = (zeroNegativeResult & 0xFF00) | (value ? 0 : 1);
+}
+
+inline void Cpu::setCarry(bool value)
+{
+  carryResult = value ? 0x100 : 0;
+}
+
+inline void Cpu::setZeroNegative(uint8_t result)
+{
+  zeroNegativeResult = result * 0x101;
+}
+
+inline void Cpu::setCarryResult(uint16_t result)
+{
+  carryResult = result;
+}
+
+inline void Cpu::setOverflowResult(uint8_t a, uint8_t value, uint8_t result)
+{
+  // sign of the result differs from the sign of both operands
+  overflowResult = (a ^ result) & (value ^ result);
+}
+
+#else
+
+inline bool Cpu::getNegativeFlag()
+{
+  return negativeFlag;
+}
+
+inline bool Cpu::getOverflowFlag()
+{
+  return overflowFlag;
+}
+
+inline bool Cpu::getZeroFlag()
+{
+  return zeroFlag;
+}
+
+inline bool Cpu::getCarryFlag()
+{
+  return carryFlag;
+}
+
+inline void Cpu::setNegative(bool value)
+{
+  negativeFlag = value;
+}
+
+inline void Cpu::setOverflow(bool value)
+{
+  overflowFlag = value;
+}
+
+inline void Cpu::setZero(bool value)
+{
+  zeroFlag = value;
+}
+
+inline void Cpu::setCarry(bool value)
+{
+  carryFlag = value;
+}
+
+inline void Cpu::setZeroNegative(uint8_t result)
+{
+  zeroFlag = (result == 0);
+  negativeFlag = (result >= 0x80);
+}
+
+inline void Cpu::setCarryResult(uint16_t result)
+{
+  carryFlag = (result >= 0x100);
+}
+
+inline void Cpu::setOverflowResult(uint8_t a, uint8_t value, uint8_t result)
+{
+  // adding positives equals negative OR adding negatives equals positive
+  overflowFlag = ((value >= 0x80 && a >= 0x80 && result < 0x80)
+      || (value < 0x80 && a < 0x80 && result >= 0x80));
+}
+
+#endif
+
 Cpu::Cpu()
 :
+#ifdef CPU_LAZY_FLAGS
+  zeroNegativeResult(1),
+  carryResult(0),
+  overflowResult(0),
+#else
   negativeFlag(false),
   overflowFlag(false),
+#endif
   sHigh(true),
   sLow(true),
   decimalFlag(false),
   interruptFlag(false),
+#ifndef CPU_LAZY_FLAGS
   zeroFlag(false),
   carryFlag(false),
+#endif
   breakFlag(false),
+  stopped(false),
+  waiting(false),
+  nmiLine(false),
+  nmiLatched(false),
+  irqLines(0),
+  pendingEvents(0),
+  batchLength(0),
+  batchRemaining(0),
+  batchDeferred(0),
+  interruptCount(0),
   crossedPage(false),
   cycles(0),
+  engine(EngineFused),
+  instructionCount(0),
+  jit(nullptr),
+  predecoded(nullptr),
+  predecodeHits(0),
+  predecodeMisses(0),
+  randomState(RandomDefaultSeed),
+  idleLoopSkip(false),
+  idleLoops(nullptr),
+  idleSkippedCycles(0),
+  idleSnapshot(0),
+  memory(nullptr),
 //  startAddr(memory),
+  readPages(nullptr),
+  writePages(nullptr),
   pc(0),
   sp(0xFF),
   a(0),
   x(0),
   y(0)
 {
+  memset(codePages, 0, sizeof(codePages));
+  memset(fetchPages, 0, sizeof(fetchPages));
+
+  for (uint32_t page = 0; page < 0x100; page++)
+  {
+    aliasPages[page] = page;
+  }
+}
+
+Cpu::~Cpu()
+{
+  delete jit;
+  delete[] predecoded;
+  delete[] idleLoops;
 }
 
 void Cpu::setPc(uint16_t counter)
@@ -288,40 +453,43 @@ void Cpu::setPc(uint16_t counter)
   pc = counter;
 }
 
-// TODO (match NES reset values): Reset untested
+// TODO (match NES reset values): SP and the stack writes of the reset sequence
 void Cpu::reset()
 {
   // memset(memory, 0, sizeof(memory));
 
-  carryFlag = false;
-  zeroFlag = true;
+  setCarry(false);
+  setZero(true);
   interruptFlag = true;
   decimalFlag = false;
-  overflowFlag = false;
-  negativeFlag = false;
+  setOverflow(false);
+  setNegative(false);
 
   // pc = &memory[0x34];
   sp = 0xFF; 
 
-  // On reset, reference address given from reset vector memory[0xFFFD] << 8) | memory[0xFFFC]; 
-  // uint16_t tempAddr = ((memory[0xFFFD] & EIGHT_BIT_MASK) << EIGHT_BIT_SHIFT);
-  // pc |= (memory[0xFFFC] & EIGHT_BIT_MASK);
-  pc = 0;
-
   a = 0;
   x = 0;
   y = 0;
-  pc = 0xe831;
+
+  // On reset, reference address given from reset vector memory[0xFFFD] << 8) | memory[0xFFFC]; 
+  pc = (memory != nullptr) ? loadAddress(ResetVector) : 0;
+
+  breakFlag = false;
+  stopped = false;
+  waiting = false;
+  nmiLatched = false;
+  updatePendingEvents();
 }
 
 void Cpu::printStatus()
 {
-  printf("nf: %x\n", negativeFlag);
-  printf("of: %x\n", overflowFlag);
+  printf("nf: %x\n", getNegativeFlag());
+  printf("of: %x\n", getOverflowFlag());
   printf("df: %x\n", decimalFlag);
   printf("if: %x\n", interruptFlag);
-  printf("zf: %x\n", zeroFlag);
-  printf("cf: %x\n", carryFlag);
+  printf("zf: %x\n", getZeroFlag());
+  printf("cf: %x\n", getCarryFlag());
   printf("A: %x\n", a);
   printf("X: %x\n", x);
   printf("Y: %x\n", y);
@@ -369,25 +537,26 @@ void Cpu::printStack()
 uint8_t Cpu::getFlags()
 {
   uint8_t value = 0;
-  value |= carryFlag ? carryMask : 0;
-  value |= zeroFlag ? zeroMask : 0;
+  value |= getCarryFlag() ? carryMask : 0;
+  value |= getZeroFlag() ? zeroMask : 0;
   value |= interruptFlag ? interruptMask : 0;
   value |= decimalFlag ? decimalMask : 0;
   value |= breakFlag ? breakMask : 0;
-  value |= overflowFlag ? overflowMask : 0;
-  value |= negativeFlag ? negativeMask : 0;
+  value |= getOverflowFlag() ? overflowMask : 0;
+  value |= getNegativeFlag() ? negativeMask : 0;
   return value;
 }
 
 void Cpu::setFlags(uint8_t value)
 {
-  carryFlag = value & carryMask;
-  zeroFlag = value & zeroMask;
+  setCarry(value & carryMask);
+  setZero(value & zeroMask);
   interruptFlag = value & interruptMask;
   decimalFlag = value & decimalMask;
-  breakFlag = value & breakMask;
-  overflowFlag = value & overflowMask;
-  negativeFlag = value & negativeMask;
+  // B only exists in the copies PHP and BRK push, pulling one doesn't halt the CPU
+  setOverflow(value & overflowMask);
+  setNegative(value & negativeMask);
+  updatePendingEvents();
 }
 
 void Cpu::setMemory(Memory *memory_controller)
@@ -395,29 +564,848 @@ void Cpu::setMemory(Memory *memory_controller)
   pc = 0;
   memory = memory_controller;    // memory_callback
   startAddr = memory_controller->get_memory();
+  readPages = memory_controller->get_read_pages();
+  writePages = memory_controller->get_write_pages();
+  remapPages(0, 0x100);
+}
+
+// the Memory bus changed these pages: drop code cached from them
+void Cpu::remapPages(uint8_t firstPage, uint16_t count)
+{
+  // a page is fetched from directly when its instructions can't run into a different next page
+  for (uint32_t page = (firstPage != 0) ? firstPage - 1 : 0; page < (uint32_t)firstPage + count; page++)
+  {
+    uint8_t *next = (page < 0xFF) ? readPages[page + 1] : nullptr;
+    fetchPages[page] = (readPages[page] != nullptr && next == readPages[page] + 0x100) ? readPages[page] : nullptr;
+  }
+
+  linkAliases();
+  invalidateCode(firstPage << 8, count << 8);
+}
+
+// Pages that read the same cpu_mem bytes (the RAM mirrors) are linked in a
+// ring. A store through any of them must find code cached under the others,
+// so the code flags of one page are set on the whole ring.
+void Cpu::linkAliases()
+{
+  int16_t rings[256];
+
+  for (uint32_t page = 0; page < 0x100; page++)
+  {
+    rings[page] = -1;
+  }
+
+  for (uint32_t page = 0; page < 0x100; page++)
+  {
+    uintptr_t offset = (uintptr_t)readPages[page] - (uintptr_t)startAddr;
+    aliasPages[page] = page;
+
+    if (readPages[page] == nullptr || offset >= 0x10000 || (offset & 0xFF) != 0)
+    {
+      continue;
+    }
+
+    int16_t &ring = rings[offset >> 8];
+    if (ring < 0)
+    {
+      ring = page;
+      continue;
+    }
+
+    aliasPages[page] = aliasPages[ring];
+    aliasPages[ring] = page;
+  }
+
+  for (uint32_t page = 0; page < 0x100; page++)
+  {
+    uint8_t flags = 0;
+
+    for (uint8_t alias = aliasPages[page]; alias != page; alias = aliasPages[alias])
+    {
+      flags |= codePages[alias] & (CodePageJit | CodePagePredecoded | CodePageIdleLoop);
+    }
+
+    codePages[page] |= flags;
+  }
+}
+
+// the page now holds cached code, so do its aliases
+void Cpu::markCodePage(uint8_t page, uint8_t flag)
+{
+  uint8_t alias = page;
+
+  do
+  {
+    codePages[alias] |= flag;
+    alias = aliasPages[alias];
+  } while (alias != page);
 }
 
 // TODO (Move controls out of CPU): Handle with new controls class, allow alternate controls
-void Cpu::handlePlayerInput(SDL_Event *event)
+void Cpu::handlePlayerInput(uint8_t key)
+{
+  storeByte(startAddr + 0xFF, key);
+}
+
+void Cpu::setNmi(bool level)
+{
+  if (level && !nmiLine)
+  {
+    nmiLatched = true;
+  }
+
+  nmiLine = level;
+  updatePendingEvents();
+}
+
+void Cpu::setIrq(uint8_t source, bool level)
+{
+  irqLines = level ? (irqLines | source) : (irqLines & ~source);
+  updatePendingEvents();
+}
+
+uint64_t Cpu::getInterruptCount()
+{
+  return interruptCount;
+}
+
+// waited out like the instruction's own cycles
+void Cpu::stall(uint32_t cycleCount)
+{
+  cycles += cycleCount;
+}
+
+uint64_t Cpu::getBatchCycles()
+{
+  return batchLength - batchRemaining - batchDeferred;
+}
+
+Cpu::RunState Cpu::getRunState()
+{
+  if (pendingEvents & PendingHalt)
+  {
+    return RunStateStopped;
+  }
+
+  return (pendingEvents & PendingWait) ? RunStateWaiting : RunStateRunning;
+}
+
+// Halts and interrupts share one word so the run loops test a single value.
+// Raised inside a runCycles batch, the rest of the batch moves to
+// batchDeferred and the loop stops at the next instruction boundary, so
+// nothing is checked per instruction while no event is pending.
+void Cpu::updatePendingEvents()
+{
+  // any interrupt line ends WAI, with I set execution just goes on after it
+  if (waiting && (nmiLatched || irqLines != 0))
+  {
+    waiting = false;
+  }
+
+  pendingEvents = ((breakFlag || stopped) ? PendingHalt : 0)
+                | (waiting ? PendingWait : 0)
+                | (nmiLatched ? PendingNmi : 0)
+                | ((irqLines != 0 && !interruptFlag) ? PendingIrq : 0);
+
+  if (pendingEvents != 0 && batchRemaining != 0)
+  {
+    batchDeferred += batchRemaining;
+    batchRemaining = 0;
+  }
+}
+
+// Takes the place of an instruction: PC and P are pushed with B clear, I is
+// set and PC is loaded from the vector. NMI wins over IRQ. The first of the
+// seven cycles is the tick that starts it, like the opcode fetch of an
+// instruction.
+void Cpu::serviceInterrupt()
+{
+  uint16_t vector = nmiLatched ? NmiVector : IrqVector;
+
+  nmiLatched = false;
+  pushStack(pc >> 8);
+  pushStack(pc & 0xFF);
+  pushStack((getFlags() | unusuedMask) & ~breakMask);
+  interruptFlag = true;
+  pc = loadAddress(vector);
+  cycles += InterruptCycles - 1;
+  interruptCount++;
+
+  // the handler may write what an interrupted polling loop reads
+  idleSnapshot = 0;
+  updatePendingEvents();
+}
+
+void Cpu::setEngine(Engine newEngine)
+{
+  if (newEngine == EngineJit)
+  {
+    if (jit == nullptr)
+    {
+      jit = new Jit();
+      jit->setCodePages(codePages);
+    }
+
+    // callers see the fallback in getEngine
+    if (!jit->isAvailable())
+    {
+      newEngine = EngineFused;
+    }
+  }
+
+  if (newEngine == EnginePredecode && predecoded == nullptr)
+  {
+    predecoded = new Predecoded_T[0x10000]();
+  }
+
+  engine = newEngine;
+}
+
+Cpu::Engine Cpu::getEngine()
+{
+  return engine;
+}
+
+uint64_t Cpu::getInstructionCount()
+{
+  return instructionCount;
+}
+
+uint64_t Cpu::getPredecodeHits()
+{
+  return predecodeHits;
+}
+
+uint64_t Cpu::getPredecodeMisses()
+{
+  return predecodeMisses;
+}
+
+void Cpu::setIdleLoopSkip(bool enable)
+{
+  idleLoopSkip = enable;
+
+  if (enable && idleLoops == nullptr)
+  {
+    idleLoops = new IdleLoop_T[0x10000]();
+  }
+}
+
+uint64_t Cpu::getIdleSkippedCycles()
+{
+  return idleSkippedCycles;
+}
+
+// drop cached code covering bytes written without going through the Cpu,
+// under their own pages and under every page that aliases them
+void Cpu::invalidateCode(uint16_t offset, uint32_t size)
+{
+  uint32_t end = offset + size;
+
+  if (end > 0x10000)
+  {
+    end = 0x10000;
+  }
+
+  dropCode(offset, end);
+
+  for (uint32_t page = offset >> 8; page < ((end + 0xFF) >> 8); page++)
+  {
+    uint32_t first = ((page << 8) > offset) ? page << 8 : offset;
+    uint32_t last = (((page + 1) << 8) < end) ? (page + 1) << 8 : end;
+
+    for (uint8_t alias = aliasPages[page]; alias != page; alias = aliasPages[alias])
+    {
+      dropCode((alias << 8) | (first & 0xFF), (alias << 8) + (last - (page << 8)));
+    }
+  }
+}
+
+// cached code covering bus addresses offset -> end - 1
+void Cpu::dropCode(uint32_t offset, uint32_t end)
+{
+  // translated blocks are dropped a page at a time
+  if (jit != nullptr)
+  {
+    for (uint32_t page = offset >> 8; page < ((end + 0xFF) >> 8); page++)
+    {
+      if (codePages[page] & CodePageJit)
+      {
+        jit->invalidatePage(page);
+      }
+    }
+  }
+
+  // predecoded entries only when they cover a written byte, an entry starts at most 2 bytes earlier.
+  // Pages without entries are skipped whole, a bank switch mostly covers those.
+  if (predecoded != nullptr)
+  {
+    for (uint32_t address = (offset >= 2) ? offset - 2 : 0; address < end; address++)
+    {
+      if (!(codePages[address >> 8] & CodePagePredecoded))
+      {
+        address |= 0xFF;
+        continue;
+      }
+
+      Predecoded_T &entry = predecoded[address];
+
+      if (entry.handler != nullptr && address + entry.size > offset)
+      {
+        entry.handler = nullptr;
+      }
+    }
+  }
+
+  // idle loops that read a written byte start at most IdleLoopWindow bytes earlier
+  if (idleLoops != nullptr)
+  {
+    for (uint32_t address = (offset >= IdleLoopWindow) ? offset - IdleLoopWindow : 0; address < end; address++)
+    {
+      if (!(codePages[address >> 8] & CodePageIdleLoop))
+      {
+        address |= 0xFF;
+        continue;
+      }
+
+      idleLoops[address].kind = IdleLoopUnknown;
+    }
+  }
+}
+
+// 0x00FE only changes when an instruction reads or writes it, instead of after every instruction
+inline void Cpu::updateRandomVar(uint8_t *address)
+{
+  uintptr_t offset = (uintptr_t)address - (uintptr_t)startAddr;
+
+  if ((offset & 0xFF) == RandomAddress && offset < 0x10000 && isRandomAddress(offset))
+  {
+    generateRandomVar();
+  }
+}
+
+// 0x00FE or an address the bus maps onto it, $08FE/$10FE/$18FE once the RAM mirrors are mapped
+inline bool Cpu::isRandomAddress(uint16_t address)
+{
+  return (address & 0xFF) == RandomAddress && readPages[address >> 8] == startAddr;
+}
+
+// Guest addresses are pointers into Memory::cpu_mem and go through the
+// Memory bus page of their address: RAM, ROM, banks and mirrors are a load
+// of the page pointer and one compare, only handler pages (nullptr) call
+// into Memory. Registers (A for accumulator addressing) and immediate
+// operands fetched from another page are outside of cpu_mem.
+
+// write through the Cpu so translated code never runs stale bytes
+inline void Cpu::storeByte(uint8_t *addr, uint8_t value)
+{
+  uintptr_t offset = (uintptr_t)addr - (uintptr_t)startAddr;
+
+  if (offset >= 0x10000)
+  {
+    *addr = value;
+    return;
+  }
+
+  uint8_t *page = writePages[offset >> 8];
+
+  if (page != nullptr && !codePages[offset >> 8])
+  {
+    page[offset & 0xFF] = value;
+    return;
+  }
+
+  storeBusByte(offset, value);
+}
+
+inline uint8_t Cpu::loadByte(uint8_t *addr)
 {
-  // SDL event is upper case, add 0x20 to change to lower case
-  if (event->type == SDL_KEYDOWN)
+  uintptr_t offset = (uintptr_t)addr - (uintptr_t)startAddr;
+
+  if (offset >= 0x10000)
   {
-    *(startAddr + 0xFF) = (*SDL_GetKeyName(event->key.keysym.sym) + 0x20) & 0xFF;
+    return *addr;
   }
+
+  uint8_t *page = readPages[offset >> 8];
+
+  if (page != nullptr)
+  {
+    return page[offset & 0xFF];
+  }
+
+  return memory->bus_read(offset);
+}
+
+// store to a handler page or a page holding cached code
+void Cpu::storeBusByte(uint16_t address, uint8_t value)
+{
+  uint8_t *page = writePages[address >> 8];
+
+  if (page != nullptr)
+  {
+    page[address & 0xFF] = value;
+  }
+  else
+  {
+    memory->bus_write(address, value);
+  }
+
+  if (codePages[address >> 8] & (CodePageJit | CodePagePredecoded | CodePageIdleLoop))
+  {
+    invalidateCode(address, 1);
+  }
+}
+
+inline uint16_t Cpu::loadAddress(uint16_t address)
+{
+  return (memory->bus_read(address + 1) << 8) | memory->bus_read(address);
+}
+
+// instruction bytes straight from the page when the next page follows it
+inline uint8_t *Cpu::fetchInstruction(uint16_t address)
+{
+  uint8_t *page = fetchPages[address >> 8];
+
+  if (page != nullptr)
+  {
+    return page + (address & 0xFF);
+  }
+
+  return fetchInstructionBytes(address);
+}
+
+// Copies the instruction bytes from each of their pages. Pages with handlers
+// aren't read for code, their cpu_mem bytes are used instead.
+uint8_t *Cpu::fetchInstructionBytes(uint16_t address)
+{
+  uint8_t *page = readPages[address >> 8];
+
+  if (page != nullptr && (address & 0xFF) < 0xFE)
+  {
+    return page + (address & 0xFF);
+  }
+
+  for (int i = 0; i < 3; i++)
+  {
+    uint16_t byteAddress = address + i;
+    uint8_t *bytePage = readPages[byteAddress >> 8];
+    fetchBuffer[i] = (bytePage != nullptr) ? bytePage[byteAddress & 0xFF] : startAddr[byteAddress];
+  }
+
+  return fetchBuffer;
 }
 
 void Cpu::doInstruction()
 {
-  // do nothing until break is false or required cycles is 0
-  if (cycles != 0 || breakFlag)
+  // do nothing until required cycles is 0
+  if (cycles != 0)
   {
     cycles --;
     return;
   }
 
+  // stopped or waiting ticks do nothing either
+  if (pendingEvents)
+  {
+    if (!(pendingEvents & PendingIdle))
+    {
+      serviceInterrupt();
+    }
+    return;
+  }
+
+  instructionCount += doEngineInstruction(engine, JitCycleBudget);
+
+  if (cycles == 0xFFFF)
+  {
+    printf("invalid instruction");
+  }
+}
+
+// Each tick of a batch behaves like one doInstruction call, but the ticks an
+// instruction waits out are skipped in one step instead of one call each
+uint64_t Cpu::runCycles(uint64_t cycleCount)
+{
+  const Engine selectedEngine = engine;
+  uint64_t executed = 0;
+  uint16_t lastPc = 0;
+
+  // memory may have changed since the last batch
+  idleSnapshot = 0;
+  batchLength = cycleCount;
+  batchRemaining = cycleCount;
+  batchDeferred = 0;
+
+  do
+  {
+    // at the start of the batch, or an event cut the batch short
+    if (pendingEvents)
+    {
+      batchRemaining += batchDeferred;
+      batchDeferred = 0;
+
+      // stopped or waiting: the rest of the batch passes without instructions
+      if (pendingEvents & PendingIdle)
+      {
+        cycles = (batchRemaining < cycles) ? cycles - (uint32_t)batchRemaining : 0;
+        batchRemaining = 0;
+        break;
+      }
+
+      // interrupts wait for the current instruction
+      uint32_t waitCycles = (batchRemaining < cycles) ? (uint32_t)batchRemaining : cycles;
+      cycles -= waitCycles;
+      batchRemaining -= waitCycles;
+
+      if (batchRemaining != 0)
+      {
+        batchRemaining--;
+        serviceInterrupt();
+      }
+    }
+
+    while (batchRemaining != 0)
+    {
+      if (cycles != 0)
+      {
+        uint32_t waitCycles = (batchRemaining < cycles) ? (uint32_t)batchRemaining : cycles;
+        cycles -= waitCycles;
+        batchRemaining -= waitCycles;
+        continue;
+      }
+
+      // back at the start of a loop
+      if (idleLoopSkip && pc <= lastPc)
+      {
+        uint64_t skippedInstructions = 0;
+        batchRemaining -= skipIdleLoop(lastPc, batchRemaining, UINT64_MAX, skippedInstructions);
+        executed += skippedInstructions;
+
+        if (batchRemaining == 0)
+        {
+          break;
+        }
+      }
+
+      // the tick is spent first, an event raised by the instruction moves what is left
+      uint32_t cycleBudget = (batchRemaining < JitBatchBudget) ? (uint32_t)batchRemaining : JitBatchBudget;
+      lastPc = pc;
+      batchRemaining--;
+      executed += doEngineInstruction(selectedEngine, cycleBudget);
+    }
+  } while (batchDeferred != 0);
+
+  batchLength = 0;
+  instructionCount += executed;
+  return executed;
+}
+
+// The jit engine finishes the block it is in, so it can run a few more
+uint64_t Cpu::runInstructions(uint64_t count)
+{
+  const Engine selectedEngine = engine;
+  uint64_t executed = 0;
+  uint64_t elapsed = 0;
+  uint16_t lastPc = 0;
+
+  // memory may have changed since the last batch
+  idleSnapshot = 0;
+
+  while (executed < count && !(pendingEvents & PendingIdle))
+  {
+    // wait out the previous instruction
+    elapsed += cycles;
+    cycles = 0;
+
+    if (pendingEvents)
+    {
+      elapsed++;
+      serviceInterrupt();
+      continue;
+    }
+
+    // back at the start of a loop
+    if (idleLoopSkip && pc <= lastPc)
+    {
+      uint64_t skippedInstructions = 0;
+      elapsed += skipIdleLoop(lastPc, UINT64_MAX, count - executed, skippedInstructions);
+      executed += skippedInstructions;
+
+      if (executed >= count)
+      {
+        break;
+      }
+    }
+
+    // then run the next one
+    lastPc = pc;
+    elapsed++;
+    executed += doEngineInstruction(selectedEngine, JitBatchBudget);
+  }
+
+  instructionCount += executed;
+  return elapsed;
+}
+
+uint64_t Cpu::runUntil(RunPredicate_T predicate, void *context, uint64_t cycleLimit)
+{
+  const Engine selectedEngine = engine;
+  uint64_t elapsed = 0;
+
+  while (elapsed < cycleLimit && !(pendingEvents & PendingIdle))
+  {
+    if (predicate(*this, context))
+    {
+      break;
+    }
+
+    elapsed += cycles + 1;
+    cycles = 0;
+
+    if (pendingEvents)
+    {
+      serviceInterrupt();
+      continue;
+    }
+
+    instructionCount += doEngineInstruction(selectedEngine, JitCycleBudget);
+  }
+
+  return elapsed;
+}
+
+// Only two shapes of loop are skipped. A counted delay loop is NOPs and a
+// single DEX/DEY/INX/INY closed by a BNE, its final counter and flags follow
+// from the iteration count. A polling loop only reads memory and registers, so
+// once one iteration leaves PC and the registers unchanged every following one
+// does too, until something outside the batch writes memory. Reads of 0x00FE
+// change it, so loops that address it are never skipped. Handler pages are
+// only read when Memory says a read repeats until the next Scheduler event
+// (PPUSTATUS, waiting for vblank or sprite 0): the batch ends there, and the
+// iterations run before the skip have done the first read's side effects.
+void Cpu::analyzeIdleLoop(uint16_t start)
+{
+  IdleLoop_T &loop = idleLoops[start];
+  bool nopsOnly = true;     // no instruction but NOPs and counter steps
+  int counters = 0;         // DEX/DEY/INX/INY in the body
+  uint16_t at = start;
+
+  loop.kind = IdleLoopNone;
+  loop.instructions = 0;
+  loop.cycles = 0;
+
+  // the result depends on these bytes, stores to them reset it
+  markCodePage(start >> 8, CodePageIdleLoop);
+  markCodePage((uint16_t)(start + IdleLoopWindow) >> 8, CodePageIdleLoop);
+
+  for (int i = 0; i < MaxIdleLoopInstructions; i++)
+  {
+    uint8_t *instruction = fetchInstruction(at);
+    uint8_t operationCode = instruction[0];
+    uint8_t addressModeId = Memory::AddressModeLookupTable[operationCode];
+    uint8_t size = Memory::AddressModeSizeTable[addressModeId] + 1;
+    uint16_t address = instruction[1];
+
+    if (size == 3)
+    {
+      address |= instruction[2] << 8;
+    }
+
+    // one tick to start the instruction, then its base cycles
+    loop.instructions++;
+    loop.cycles += TimingLookupTable[operationCode] % 10 + 1;
+
+    switch (operationCode)
+    {
+      case 0xEA: // NOP
+        break;
+
+      case 0xCA: // DEX
+      case 0x88: // DEY
+      case 0xE8: // INX
+      case 0xC8: // INY
+        counters++;
+        loop.counterY = (operationCode == 0x88 || operationCode == 0xC8);
+        loop.step = (operationCode == 0xCA || operationCode == 0x88) ? -1 : 1;
+        break;
+
+      case 0xA5: case 0xAD: // LDA zp, abs
+      case 0xA6: case 0xAE: // LDX zp, abs
+      case 0xA4: case 0xAC: // LDY zp, abs
+      case 0x24: case 0x2C: // BIT zp, abs
+      case 0xC5: case 0xCD: // CMP zp, abs
+      case 0xE4: case 0xEC: // CPX zp, abs
+      case 0xC4: case 0xCC: // CPY zp, abs
+      case 0x25: case 0x2D: // AND zp, abs
+      case 0x05: case 0x0D: // ORA zp, abs
+      case 0x45: case 0x4D: // EOR zp, abs
+        if (isRandomAddress(address) || !memory->is_read_repeatable(address))
+        {
+          return;
+        }
+        nopsOnly = false;
+        break;
+
+      case 0xA9: case 0xA2: case 0xA0: // LDA, LDX, LDY #
+      case 0xC9: case 0xE0: case 0xC0: // CMP, CPX, CPY #
+      case 0x29: case 0x09: case 0x49: // AND, ORA, EOR #
+      case 0xAA: case 0xA8: // TAX, TAY
+      case 0x8A: case 0x98: // TXA, TYA
+      case 0x18: case 0x38: case 0xB8: // CLC, SEC, CLV
+        nopsOnly = false;
+        break;
+
+      case 0x10: case 0x30: // BPL, BMI
+      case 0x50: case 0x70: // BVC, BVS
+      case 0x90: case 0xB0: // BCC, BCS
+      case 0xD0: case 0xF0: // BNE, BEQ
+        if ((uint16_t)(at + (int8_t)address + 2) != start)
+        {
+          return;
+        }
+
+        // taken branch
+        loop.cycles++;
+        loop.branchPc = at;
+
+        // any other instruction next to the counter would need its own fast-forward
+        if (counters == 1 && nopsOnly && operationCode == 0xD0)
+        {
+          loop.kind = IdleLoopCounted;
+        }
+        else if (counters == 0)
+        {
+          loop.kind = IdleLoopPolling;
+        }
+        return;
+
+      default:
+        return;
+    }
+
+    at += size;
+  }
+}
+
+// PC is the start of a loop and lastPc the instruction that jumped back to it,
+// skip whole iterations that fit in both budgets
+uint64_t Cpu::skipIdleLoop(uint16_t lastPc, uint64_t cycleBudget, uint64_t instructionBudget, uint64_t &skippedInstructions)
+{
+  IdleLoop_T &loop = idleLoops[pc];
+
+  if (loop.kind == IdleLoopUnknown)
+  {
+    analyzeIdleLoop(pc);
+  }
+
+  if (loop.kind == IdleLoopNone || loop.branchPc != lastPc)
+  {
+    return 0;
+  }
+
+  uint64_t iterations = cycleBudget / loop.cycles;
+  if (iterations > instructionBudget / loop.instructions)
+  {
+    iterations = instructionBudget / loop.instructions;
+  }
+
+  if (loop.kind == IdleLoopCounted)
+  {
+    uint8_t &counter = loop.counterY ? y : x;
+    uint32_t left = (uint8_t)((loop.step < 0) ? counter : -counter);
+
+    // iterations until the counter reaches 0, the last one runs normally to leave the loop
+    if (left == 0)
+    {
+      left = 0x100;
+    }
+    if (iterations > left - 1)
+    {
+      iterations = left - 1;
+    }
+    if (iterations == 0)
+    {
+      return 0;
+    }
+
+    counter += (uint8_t)(loop.step * (int)iterations);
+
+    // flags of the last counter instruction, DEY only sets Z
+    if (loop.counterY && loop.step < 0)
+    {
+      setZero(counter == 0);
+    }
+    else
+    {
+      setZeroNegative(counter);
+    }
+  }
+  else
+  {
+    // skip from the second time the loop closes with the same state
+    uint64_t snapshot = (1ULL << 56) | ((uint64_t)pc << 40) | ((uint64_t)getFlags() << 24) | (a << 16) | (x << 8) | y;
+
+    if (snapshot != idleSnapshot)
+    {
+      idleSnapshot = snapshot;
+      return 0;
+    }
+    if (iterations == 0)
+    {
+      return 0;
+    }
+  }
+
+  skippedInstructions = iterations * loop.instructions;
+  idleSkippedCycles += iterations * loop.cycles;
+  return iterations * loop.cycles;
+}
+
+// run the instruction at PC with the given engine, returns instructions executed
+inline uint32_t Cpu::doEngineInstruction(Engine selectedEngine, uint32_t cycleBudget)
+{
+  switch (selectedEngine)
+  {
+    case EngineJit:
+      return doJitInstructions(cycleBudget);
+    case EnginePredecode:
+      doPredecodedInstruction();
+      return 1;
+    case EngineFused:
+      doFusedInstruction();
+      return 1;
+    case EngineSwitch:
+      doSwitchInstruction();
+      return 1;
+    default:
+      doTableInstruction();
+      return 1;
+  }
+}
+
+uint32_t Cpu::doJitInstructions(uint32_t cycleBudget)
+{
+  uint32_t executed = jit->execute(*this, cycleBudget);
+
+  // nothing translated at this PC, interpret a single instruction
+  if (executed == 0)
+  {
+    doFusedInstruction();
+    return 1;
+  }
+
+  // the interpreter spends one doInstruction call on each instruction before its cycles
+  cycles += executed - 1;
+
+  return executed;
+}
+
+void Cpu::doTableInstruction()
+{
   // extract the instruction operation code 
-  uint8_t operationCode = 0xFF & startAddr[pc];
+  uint8_t *instruction = fetchInstruction(pc);
+  uint8_t operationCode = 0xFF & instruction[0];
 
   // get address mode ID from instruction operation code
   uint8_t addressModeId = memory->AddressModeLookupTable[operationCode];
@@ -426,7 +1414,7 @@ void Cpu::doInstruction()
   uint8_t operationCodeId = (this->OperationCodeLookupTable[operationCode]);
 
   // get required address by using memory address function table with operation code
-  uint8_t *address = (memory->*Memory::AddressModeFunctionTable[addressModeId])(startAddr + pc + 1);
+  uint8_t *address = (memory->*Memory::AddressModeFunctionTable[addressModeId])(instruction + 1);
 
   uint8_t requiredCycles = (this->TimingLookupTable[operationCode]);
 
@@ -434,7 +1422,7 @@ void Cpu::doInstruction()
   pc += Memory::AddressModeSizeTable[addressModeId] + 1;
   
   // randomize 0xFE
-  generateRandomVar();
+  updateRandomVar(address);
 
   // call required function ID with address
   (this->*OperationCodeFunctionTable[operationCodeId])(address);
@@ -444,13 +1432,471 @@ void Cpu::doInstruction()
  
   // add 1 if crossed boundary and instruction requires extra cycles
   cycles += crossedPage ? (requiredCycles/10) : 0;
+}
 
-  if (cycles == 0xFFFF)
+// read the little endian address stored at memory[index], index is not wrapped to the page
+static inline uint16_t readAddress(uint8_t *memory, uint32_t index)
+{
+  return (memory[index + 1] << 8) | memory[index];
+}
+
+// Effective addresses for the switch engine, each matches the Memory::Address* function
+// of the same mode. operand points at the byte following the opcode.
+#define ADDRESS_NONE                  nullptr
+#define ADDRESS_IMMEDIATE             operand
+#define ADDRESS_ZERO_X                (startAddr + (uint8_t)(operand[0] + x))
+#define ADDRESS_ZERO_Y                (startAddr + (uint8_t)(operand[0] + y))
+#define ADDRESS_ZERO                  (startAddr + operand[0])
+#define ADDRESS_ABSOLUTE_X            (startAddr + (uint16_t)(readAddress(operand, 0) + x))
+#define ADDRESS_ABSOLUTE_Y            (startAddr + (uint16_t)(readAddress(operand, 0) + y))
+#define ADDRESS_ABSOLUTE              (startAddr + readAddress(operand, 0))
+#define ADDRESS_INDIRECT_ZERO_X       (startAddr + readAddress(startAddr, (uint8_t)(operand[0] + x)))
+#define ADDRESS_INDIRECT_ZERO         (startAddr + readAddress(startAddr, operand[0]))
+#define ADDRESS_INDIRECT_ZERO_INDEX_Y (startAddr + (uint16_t)(readAddress(startAddr, operand[0]) + y))
+#define ADDRESS_INDIRECT_ABSOLUTE_X   (startAddr + loadAddress(readAddress(operand, 0) + x))
+#define ADDRESS_INDIRECT_ABSOLUTE     (startAddr + loadAddress(readAddress(operand, 0)))
+#define ADDRESS_RELATIVE              (startAddr + (uint16_t)(pc + (int8_t)operand[0] + 2))
+#define ADDRESS_REGISTER_A            (&a)
+
+// same sequence as doTableInstruction with every lookup resolved by the case label
+#define SWITCH_OPERATION(operation, address, size, timing)  \
+  {                                                         \
+    uint8_t *addr = address;                                \
+    pc += size + 1;                                         \
+    updateRandomVar(addr);                                  \
+    operation(addr);                                        \
+    cycles += (timing) % 10;                                \
+    cycles += crossedPage ? ((timing) / 10) : 0;            \
+  }                                                         \
+  break
+
+void Cpu::doSwitchInstruction()
+{
+  uint8_t *instruction = fetchInstruction(pc);
+  uint8_t *operand = instruction + 1;
+
+  switch (instruction[0])
   {
-    printf("invalid instruction");
+    case 0x00: SWITCH_OPERATION(iBRK, ADDRESS_NONE, 0, 7);                               // BRK (b)
+    case 0x01: SWITCH_OPERATION(iORA, ADDRESS_INDIRECT_ZERO_X, 1, 6);                    // ORA (d, X)
+    case 0x02: SWITCH_OPERATION(iCOP, ADDRESS_NONE, 0, KIL);                             // COP (b)
+    case 0x03: SWITCH_OPERATION(iORA, ADDRESS_NONE, 0, 8);                               // ORA (dS)
+    case 0x04: SWITCH_OPERATION(iTSB, ADDRESS_ZERO, 1, 3);                               // TSB d
+    case 0x05: SWITCH_OPERATION(iORA, ADDRESS_ZERO, 1, 3);                               // ORA d
+    case 0x06: SWITCH_OPERATION(iASL, ADDRESS_ZERO, 1, 5);                               // ASL d
+    case 0x07: SWITCH_OPERATION(iORA, ADDRESS_NONE, 0, 5);                               // ORA (bdb)
+    case 0x08: SWITCH_OPERATION(iPHP, ADDRESS_NONE, 0, 3);                               // PHP 
+    case 0x09: SWITCH_OPERATION(iORA, ADDRESS_IMMEDIATE, 1, 2);                          // ORA #$
+    case 0x0A: SWITCH_OPERATION(iASL, ADDRESS_REGISTER_A, 0, 2);                         // ASL A
+    case 0x0B: SWITCH_OPERATION(iPHD, ADDRESS_NONE, 0, 2);                               // PHD 
+    case 0x0C: SWITCH_OPERATION(iTSB, ADDRESS_ABSOLUTE, 2, 4);                           // TSB a
+    case 0x0D: SWITCH_OPERATION(iORA, ADDRESS_ABSOLUTE, 2, 4);                           // ORA a
+    case 0x0E: SWITCH_OPERATION(iASL, ADDRESS_ABSOLUTE, 2, 6);                           // ASL a
+    case 0x0F: SWITCH_OPERATION(iORA, ADDRESS_NONE, 0, 6);                               // ORA (al)
+    case 0x10: SWITCH_OPERATION(iBPL, ADDRESS_RELATIVE, 1, 12);                          // BPL r
+    case 0x11: SWITCH_OPERATION(iORA, ADDRESS_INDIRECT_ZERO_INDEX_Y, 1, 15);             // ORA (d), Y
+    case 0x12: SWITCH_OPERATION(iORA, ADDRESS_INDIRECT_ZERO, 1, KIL);                    // ORA (d)
+    case 0x13: SWITCH_OPERATION(iORA, ADDRESS_NONE, 0, 8);                               // ORA (pdSpY)
+    case 0x14: SWITCH_OPERATION(iTRB, ADDRESS_ZERO, 1, 4);                               // TRB d
+    case 0x15: SWITCH_OPERATION(iORA, ADDRESS_ZERO_X, 1, 4);                             // ORA d, X
+    case 0x16: SWITCH_OPERATION(iASL, ADDRESS_ZERO_X, 1, 6);                             // ASL d, X
+    case 0x17: SWITCH_OPERATION(iORA, ADDRESS_NONE, 0, 6);                               // ORA (bdby)
+    case 0x18: SWITCH_OPERATION(iCLC, ADDRESS_NONE, 0, 2);                               // CLC 
+    case 0x19: SWITCH_OPERATION(iORA, ADDRESS_ABSOLUTE_Y, 2, 14);                        // ORA a, Y
+    case 0x1A: SWITCH_OPERATION(iINC, ADDRESS_REGISTER_A, 0, 2);                         // INC A
+    case 0x1B: SWITCH_OPERATION(iTCS, ADDRESS_NONE, 0, 7);                               // TCS 
+    case 0x1C: SWITCH_OPERATION(iTRB, ADDRESS_ABSOLUTE, 2, 14);                          // TRB a
+    case 0x1D: SWITCH_OPERATION(iORA, ADDRESS_ABSOLUTE_X, 2, 14);                        // ORA a, X
+    case 0x1E: SWITCH_OPERATION(iASL, ADDRESS_ABSOLUTE_X, 2, 7);                         // ASL a, X
+    case 0x1F: SWITCH_OPERATION(iORA, ADDRESS_NONE, 0, 7);                               // ORA (alX)
+    case 0x20: SWITCH_OPERATION(iJSR, ADDRESS_ABSOLUTE, 2, 6);                           // JSR a
+    case 0x21: SWITCH_OPERATION(iAND, ADDRESS_INDIRECT_ZERO_X, 1, 6);                    // AND (d, X)
+    case 0x22: SWITCH_OPERATION(iJSL, ADDRESS_NONE, 0, KIL);                             // JSL (al)
+    case 0x23: SWITCH_OPERATION(iAND, ADDRESS_NONE, 0, 8);                               // AND (dS)
+    case 0x24: SWITCH_OPERATION(iBIT, ADDRESS_ZERO, 1, 3);                               // BIT d
+    case 0x25: SWITCH_OPERATION(iAND, ADDRESS_ZERO, 1, 3);                               // AND d
+    case 0x26: SWITCH_OPERATION(iROL, ADDRESS_ZERO, 1, 5);                               // ROL d
+    case 0x27: SWITCH_OPERATION(iAND, ADDRESS_NONE, 0, 5);                               // AND (bdb)
+    case 0x28: SWITCH_OPERATION(iPLP, ADDRESS_NONE, 0, 4);                               // PLP 
+    case 0x29: SWITCH_OPERATION(iAND, ADDRESS_IMMEDIATE, 1, 2);                          // AND #$
+    case 0x2A: SWITCH_OPERATION(iROL, ADDRESS_REGISTER_A, 0, 2);                         // ROL A
+    case 0x2B: SWITCH_OPERATION(iPLD, ADDRESS_NONE, 0, 2);                               // PLD 
+    case 0x2C: SWITCH_OPERATION(iBIT, ADDRESS_ABSOLUTE, 2, 4);                           // BIT a
+    case 0x2D: SWITCH_OPERATION(iAND, ADDRESS_ABSOLUTE, 2, 4);                           // AND a
+    case 0x2E: SWITCH_OPERATION(iROL, ADDRESS_ABSOLUTE, 2, 6);                           // ROL a
+    case 0x2F: SWITCH_OPERATION(iAND, ADDRESS_NONE, 0, 6);                               // AND (al)
+    case 0x30: SWITCH_OPERATION(iBMI, ADDRESS_RELATIVE, 1, 12);                          // BMI r
+    case 0x31: SWITCH_OPERATION(iAND, ADDRESS_INDIRECT_ZERO_INDEX_Y, 1, 15);             // AND (d), Y
+    case 0x32: SWITCH_OPERATION(iAND, ADDRESS_INDIRECT_ZERO, 1, KIL);                    // AND (d)
+    case 0x33: SWITCH_OPERATION(iAND, ADDRESS_NONE, 0, 8);                               // AND (pdSpY)
+    case 0x34: SWITCH_OPERATION(iBIT, ADDRESS_ZERO_X, 1, 4);                             // BIT d, X
+    case 0x35: SWITCH_OPERATION(iAND, ADDRESS_ZERO_X, 1, 4);                             // AND d, X
+    case 0x36: SWITCH_OPERATION(iROL, ADDRESS_ZERO_X, 1, 6);                             // ROL d, X
+    case 0x37: SWITCH_OPERATION(iAND, ADDRESS_NONE, 0, 6);                               // AND (bdby)
+    case 0x38: SWITCH_OPERATION(iSEC, ADDRESS_NONE, 0, 2);                               // SEC 
+    case 0x39: SWITCH_OPERATION(iAND, ADDRESS_ABSOLUTE_Y, 2, 14);                        // AND a, Y
+    case 0x3A: SWITCH_OPERATION(iDEC, ADDRESS_REGISTER_A, 0, 2);                         // DEC A
+    case 0x3B: SWITCH_OPERATION(iTSC, ADDRESS_NONE, 0, 7);                               // TSC 
+    case 0x3C: SWITCH_OPERATION(iBIT, ADDRESS_ABSOLUTE_X, 2, 14);                        // BIT a, X
+    case 0x3D: SWITCH_OPERATION(iAND, ADDRESS_ABSOLUTE_X, 2, 14);                        // AND a, X
+    case 0x3E: SWITCH_OPERATION(iROL, ADDRESS_ABSOLUTE_X, 2, 7);                         // ROL a, X
+    case 0x3F: SWITCH_OPERATION(iAND, ADDRESS_NONE, 0, 7);                               // AND (alX)
+    case 0x40: SWITCH_OPERATION(iRTI, ADDRESS_NONE, 0, 6);                               // RTI 
+    case 0x41: SWITCH_OPERATION(iEOR, ADDRESS_INDIRECT_ZERO_X, 1, 6);                    // EOR (d, X)
+    case 0x42: SWITCH_OPERATION(iWDM, ADDRESS_NONE, 0, KIL);                             // WDM 
+    case 0x43: SWITCH_OPERATION(iEOR, ADDRESS_NONE, 0, 8);                               // EOR (dS)
+    case 0x44: SWITCH_OPERATION(iMVP, ADDRESS_NONE, 0, 3);                               // MVP (sd)
+    case 0x45: SWITCH_OPERATION(iEOR, ADDRESS_ZERO, 1, 3);                               // EOR d
+    case 0x46: SWITCH_OPERATION(iLSR, ADDRESS_ZERO, 1, 5);                               // LSR d
+    case 0x47: SWITCH_OPERATION(iEOR, ADDRESS_NONE, 0, 5);                               // EOR (bdb)
+    case 0x48: SWITCH_OPERATION(iPHA, ADDRESS_NONE, 0, 3);                               // PHA 
+    case 0x49: SWITCH_OPERATION(iEOR, ADDRESS_IMMEDIATE, 1, 2);                          // EOR #$
+    case 0x4A: SWITCH_OPERATION(iLSR, ADDRESS_REGISTER_A, 0, 2);                         // LSR A
+    case 0x4B: SWITCH_OPERATION(iPHK, ADDRESS_NONE, 0, 2);                               // PHK 
+    case 0x4C: SWITCH_OPERATION(iJMP, ADDRESS_ABSOLUTE, 2, 3);                           // JMP a
+    case 0x4D: SWITCH_OPERATION(iEOR, ADDRESS_ABSOLUTE, 2, 4);                           // EOR a
+    case 0x4E: SWITCH_OPERATION(iLSR, ADDRESS_ABSOLUTE, 2, 6);                           // LSR a
+    case 0x4F: SWITCH_OPERATION(iEOR, ADDRESS_NONE, 0, 6);                               // EOR (al)
+    case 0x50: SWITCH_OPERATION(iBVC, ADDRESS_RELATIVE, 1, 12);                          // BVC r
+    case 0x51: SWITCH_OPERATION(iEOR, ADDRESS_INDIRECT_ZERO_INDEX_Y, 1, 15);             // EOR (d), Y
+    case 0x52: SWITCH_OPERATION(iEOR, ADDRESS_INDIRECT_ZERO, 1, KIL);                    // EOR (d)
+    case 0x53: SWITCH_OPERATION(iEOR, ADDRESS_NONE, 0, 8);                               // EOR (pdSpY)
+    case 0x54: SWITCH_OPERATION(iMVN, ADDRESS_NONE, 0, 4);                               // MVN (sd)
+    case 0x55: SWITCH_OPERATION(iEOR, ADDRESS_ZERO_X, 1, 4);                             // EOR d, X
+    case 0x56: SWITCH_OPERATION(iLSR, ADDRESS_ZERO_X, 1, 6);                             // LSR d, X
+    case 0x57: SWITCH_OPERATION(iEOR, ADDRESS_NONE, 0, 6);                               // EOR (bdby)
+    case 0x58: SWITCH_OPERATION(iCLI, ADDRESS_NONE, 0, 2);                               // CLI 
+    case 0x59: SWITCH_OPERATION(iEOR, ADDRESS_ABSOLUTE_Y, 2, 14);                        // EOR a, Y
+    case 0x5A: SWITCH_OPERATION(iPHY, ADDRESS_NONE, 0, 2);                               // PHY 
+    case 0x5B: SWITCH_OPERATION(iTCD, ADDRESS_NONE, 0, 7);                               // TCD 
+    case 0x5C: SWITCH_OPERATION(iJMP, ADDRESS_NONE, 0, 14);                              // JMP (al)
+    case 0x5D: SWITCH_OPERATION(iEOR, ADDRESS_ABSOLUTE_X, 2, 14);                        // EOR a, X
+    case 0x5E: SWITCH_OPERATION(iLSR, ADDRESS_ABSOLUTE_X, 2, 7);                         // LSR a, X
+    case 0x5F: SWITCH_OPERATION(iEOR, ADDRESS_NONE, 0, 7);                               // EOR (alX)
+    case 0x60: SWITCH_OPERATION(iRTS, ADDRESS_NONE, 0, 6);                               // RTS 
+    case 0x61: SWITCH_OPERATION(iADC, ADDRESS_INDIRECT_ZERO_X, 1, 6);                    // ADC (d, X)
+    case 0x62: SWITCH_OPERATION(iPER, ADDRESS_NONE, 0, KIL);                             // PER (rl)
+    case 0x63: SWITCH_OPERATION(iADC, ADDRESS_NONE, 0, 8);                               // ADC (dS)
+    case 0x64: SWITCH_OPERATION(iSTZ, ADDRESS_ZERO, 1, 3);                               // STZ d
+    case 0x65: SWITCH_OPERATION(iADC, ADDRESS_ZERO, 1, 3);                               // ADC d
+    case 0x66: SWITCH_OPERATION(iROR, ADDRESS_ZERO, 1, 5);                               // ROR d
+    case 0x67: SWITCH_OPERATION(iADC, ADDRESS_NONE, 0, 5);                               // ADC (bdb)
+    case 0x68: SWITCH_OPERATION(iPLA, ADDRESS_NONE, 0, 4);                               // PLA 
+    case 0x69: SWITCH_OPERATION(iADC, ADDRESS_IMMEDIATE, 1, 2);                          // ADC #$
+    case 0x6A: SWITCH_OPERATION(iROR, ADDRESS_REGISTER_A, 0, 2);                         // ROR A
+    case 0x6B: SWITCH_OPERATION(iRTL, ADDRESS_NONE, 0, 2);                               // RTL 
+    case 0x6C: SWITCH_OPERATION(iJMP, ADDRESS_INDIRECT_ABSOLUTE, 1, 5);                  // JMP (a)
+    case 0x6D: SWITCH_OPERATION(iADC, ADDRESS_ABSOLUTE, 2, 4);                           // ADC a
+    case 0x6E: SWITCH_OPERATION(iROR, ADDRESS_ABSOLUTE, 2, 6);                           // ROR a
+    case 0x6F: SWITCH_OPERATION(iADC, ADDRESS_NONE, 0, 6);                               // ADC (al)
+    case 0x70: SWITCH_OPERATION(iBVS, ADDRESS_RELATIVE, 1, 12);                          // BVS r
+    case 0x71: SWITCH_OPERATION(iADC, ADDRESS_INDIRECT_ZERO_INDEX_Y, 1, 15);             // ADC (d), Y
+    case 0x72: SWITCH_OPERATION(iADC, ADDRESS_INDIRECT_ZERO, 1, KIL);                    // ADC (d)
+    case 0x73: SWITCH_OPERATION(iADC, ADDRESS_NONE, 0, 8);                               // ADC (pdSpY)
+    case 0x74: SWITCH_OPERATION(iSTZ, ADDRESS_ZERO_X, 1, 4);                             // STZ d, X
+    case 0x75: SWITCH_OPERATION(iADC, ADDRESS_ZERO_X, 1, 4);                             // ADC d, X
+    case 0x76: SWITCH_OPERATION(iROR, ADDRESS_ZERO_X, 1, 6);                             // ROR d, X
+    case 0x77: SWITCH_OPERATION(iADC, ADDRESS_NONE, 0, 6);                               // ADC (bdby)
+    case 0x78: SWITCH_OPERATION(iSEI, ADDRESS_NONE, 0, 2);                               // SEI 
+    case 0x79: SWITCH_OPERATION(iADC, ADDRESS_ABSOLUTE_Y, 2, 14);                        // ADC a, Y
+    case 0x7A: SWITCH_OPERATION(iPLY, ADDRESS_NONE, 0, 2);                               // PLY 
+    case 0x7B: SWITCH_OPERATION(iTDC, ADDRESS_NONE, 0, 7);                               // TDC 
+    case 0x7C: SWITCH_OPERATION(iJMP, ADDRESS_INDIRECT_ABSOLUTE_X, 1, 14);               // JMP (a, X)
+    case 0x7D: SWITCH_OPERATION(iADC, ADDRESS_ABSOLUTE_X, 2, 14);                        // ADC a, X
+    case 0x7E: SWITCH_OPERATION(iROR, ADDRESS_ABSOLUTE_X, 2, 7);                         // ROR a, X
+    case 0x7F: SWITCH_OPERATION(iADC, ADDRESS_NONE, 0, 7);                               // ADC (alX)
+    case 0x80: SWITCH_OPERATION(iBRA, ADDRESS_RELATIVE, 1, 2);                           // BRA r
+    case 0x81: SWITCH_OPERATION(iSTA, ADDRESS_INDIRECT_ZERO_X, 1, 6);                    // STA (d, X)
+    case 0x82: SWITCH_OPERATION(iBRL, ADDRESS_NONE, 0, 2);                               // BRL (rl)
+    case 0x83: SWITCH_OPERATION(iSTA, ADDRESS_NONE, 0, 6);                               // STA (dS)
+    case 0x84: SWITCH_OPERATION(iSTY, ADDRESS_ZERO, 1, 3);                               // STY d
+    case 0x85: SWITCH_OPERATION(iSTA, ADDRESS_ZERO, 1, 3);                               // STA d
+    case 0x86: SWITCH_OPERATION(iSTX, ADDRESS_ZERO, 1, 3);                               // STX d
+    case 0x87: SWITCH_OPERATION(iSTA, ADDRESS_NONE, 0, 3);                               // STA (bdb)
+    case 0x88: SWITCH_OPERATION(iDEY, ADDRESS_NONE, 0, 2);                               // DEY 
+    case 0x89: SWITCH_OPERATION(iBIT, ADDRESS_IMMEDIATE, 1, 2);                          // BIT #$
+    case 0x8A: SWITCH_OPERATION(iTXA, ADDRESS_NONE, 0, 2);                               // TXA 
+    case 0x8B: SWITCH_OPERATION(iPHB, ADDRESS_NONE, 0, 2);                               // PHB 
+    case 0x8C: SWITCH_OPERATION(iSTY, ADDRESS_ABSOLUTE, 2, 4);                           // STY a
+    case 0x8D: SWITCH_OPERATION(iSTA, ADDRESS_ABSOLUTE, 2, 4);                           // STA a
+    case 0x8E: SWITCH_OPERATION(iSTX, ADDRESS_ABSOLUTE, 2, 4);                           // STX a
+    case 0x8F: SWITCH_OPERATION(iSTA, ADDRESS_NONE, 0, 4);                               // STA (al)
+    case 0x90: SWITCH_OPERATION(iBCC, ADDRESS_RELATIVE, 1, 12);                          // BCC r
+    case 0x91: SWITCH_OPERATION(iSTA, ADDRESS_INDIRECT_ZERO_INDEX_Y, 1, 6);              // STA (d), Y
+    case 0x92: SWITCH_OPERATION(iSTA, ADDRESS_INDIRECT_ZERO, 1, KIL);                    // STA (d)
+    case 0x93: SWITCH_OPERATION(iSTA, ADDRESS_NONE, 0, 6);                               // STA (pdSpY)
+    case 0x94: SWITCH_OPERATION(iSTY, ADDRESS_ZERO_X, 1, 4);                             // STY d, X
+    case 0x95: SWITCH_OPERATION(iSTA, ADDRESS_ZERO_X, 1, 4);                             // STA d, X
+    case 0x96: SWITCH_OPERATION(iSTX, ADDRESS_ZERO_Y, 1, 4);                             // STX d, Y
+    case 0x97: SWITCH_OPERATION(iSTA, ADDRESS_NONE, 0, 4);                               // STA (bdby)
+    case 0x98: SWITCH_OPERATION(iTYA, ADDRESS_NONE, 0, 2);                               // TYA 
+    case 0x99: SWITCH_OPERATION(iSTA, ADDRESS_ABSOLUTE_Y, 2, 5);                         // STA a, Y
+    case 0x9A: SWITCH_OPERATION(iTXS, ADDRESS_NONE, 0, 2);                               // TXS 
+    case 0x9B: SWITCH_OPERATION(iTXY, ADDRESS_NONE, 0, 5);                               // TXY 
+    case 0x9C: SWITCH_OPERATION(iSTZ, ADDRESS_ABSOLUTE, 2, 5);                           // STZ a
+    case 0x9D: SWITCH_OPERATION(iSTA, ADDRESS_ABSOLUTE_X, 2, 5);                         // STA a, X
+    case 0x9E: SWITCH_OPERATION(iSTZ, ADDRESS_ABSOLUTE_X, 2, 5);                         // STZ a, X
+    case 0x9F: SWITCH_OPERATION(iSTA, ADDRESS_NONE, 0, 5);                               // STA (alX)
+    case 0xA0: SWITCH_OPERATION(iLDY, ADDRESS_IMMEDIATE, 1, 2);                          // LDY #$
+    case 0xA1: SWITCH_OPERATION(iLDA, ADDRESS_INDIRECT_ZERO_X, 1, 6);                    // LDA (d, X)
+    case 0xA2: SWITCH_OPERATION(iLDX, ADDRESS_IMMEDIATE, 1, 2);                          // LDX #$
+    case 0xA3: SWITCH_OPERATION(iLDA, ADDRESS_NONE, 0, 6);                               // LDA (dS)
+    case 0xA4: SWITCH_OPERATION(iLDY, ADDRESS_ZERO, 1, 3);                               // LDY d
+    case 0xA5: SWITCH_OPERATION(iLDA, ADDRESS_ZERO, 1, 3);                               // LDA d
+    case 0xA6: SWITCH_OPERATION(iLDX, ADDRESS_ZERO, 1, 3);                               // LDX d
+    case 0xA7: SWITCH_OPERATION(iLDA, ADDRESS_NONE, 0, 3);                               // LDA (bdb)
+    case 0xA8: SWITCH_OPERATION(iTAY, ADDRESS_NONE, 0, 2);                               // TAY 
+    case 0xA9: SWITCH_OPERATION(iLDA, ADDRESS_IMMEDIATE, 1, 2);                          // LDA #$
+    case 0xAA: SWITCH_OPERATION(iTAX, ADDRESS_NONE, 0, 2);                               // TAX 
+    case 0xAB: SWITCH_OPERATION(iPLB, ADDRESS_NONE, 0, 2);                               // PLB 
+    case 0xAC: SWITCH_OPERATION(iLDY, ADDRESS_ABSOLUTE, 2, 4);                           // LDY a
+    case 0xAD: SWITCH_OPERATION(iLDA, ADDRESS_ABSOLUTE, 2, 4);                           // LDA a
+    case 0xAE: SWITCH_OPERATION(iLDX, ADDRESS_ABSOLUTE, 2, 4);                           // LDX a
+    case 0xAF: SWITCH_OPERATION(iLDA, ADDRESS_NONE, 0, 4);                               // LDA (al)
+    case 0xB0: SWITCH_OPERATION(iBCS, ADDRESS_RELATIVE, 1, 12);                          // BCS r
+    case 0xB1: SWITCH_OPERATION(iLDA, ADDRESS_INDIRECT_ZERO_INDEX_Y, 1, 15);             // LDA (d), Y
+    case 0xB2: SWITCH_OPERATION(iLDA, ADDRESS_INDIRECT_ZERO, 1, KIL);                    // LDA (d)
+    case 0xB3: SWITCH_OPERATION(iLDA, ADDRESS_NONE, 0, 15);                              // LDA (pdSpY)
+    case 0xB4: SWITCH_OPERATION(iLDY, ADDRESS_ZERO_X, 1, 4);                             // LDY d, X
+    case 0xB5: SWITCH_OPERATION(iLDA, ADDRESS_ZERO_X, 1, 4);                             // LDA d, X
+    case 0xB6: SWITCH_OPERATION(iLDX, ADDRESS_ZERO_Y, 1, 4);                             // LDX d, Y
+    case 0xB7: SWITCH_OPERATION(iLDA, ADDRESS_NONE, 0, 4);                               // LDA (bdby)
+    case 0xB8: SWITCH_OPERATION(iCLV, ADDRESS_NONE, 0, 2);                               // CLV 
+    case 0xB9: SWITCH_OPERATION(iLDA, ADDRESS_ABSOLUTE_Y, 2, 14);                        // LDA a, Y
+    case 0xBA: SWITCH_OPERATION(iTSX, ADDRESS_NONE, 0, 2);                               // TSX 
+    case 0xBB: SWITCH_OPERATION(iTYX, ADDRESS_NONE, 0, 14);                              // TYX 
+    case 0xBC: SWITCH_OPERATION(iLDY, ADDRESS_ABSOLUTE_X, 2, 14);                        // LDY a, X
+    case 0xBD: SWITCH_OPERATION(iLDA, ADDRESS_ABSOLUTE_X, 2, 14);                        // LDA a, X
+    case 0xBE: SWITCH_OPERATION(iLDX, ADDRESS_ABSOLUTE_Y, 2, 14);                        // LDX a, Y
+    case 0xBF: SWITCH_OPERATION(iLDA, ADDRESS_NONE, 0, 14);                              // LDA (alX)
+    case 0xC0: SWITCH_OPERATION(iCPY, ADDRESS_IMMEDIATE, 1, 2);                          // CPY #$
+    case 0xC1: SWITCH_OPERATION(iCMP, ADDRESS_INDIRECT_ZERO_X, 1, 6);                    // CMP (d, X)
+    case 0xC2: SWITCH_OPERATION(iREP, ADDRESS_IMMEDIATE, 1, 2);                          // REP #$
+    case 0xC3: SWITCH_OPERATION(iCMP, ADDRESS_NONE, 0, 8);                               // CMP (dS)
+    case 0xC4: SWITCH_OPERATION(iCPY, ADDRESS_ZERO, 1, 3);                               // CPY d
+    case 0xC5: SWITCH_OPERATION(iCMP, ADDRESS_ZERO, 1, 3);                               // CMP d
+    case 0xC6: SWITCH_OPERATION(iDEC, ADDRESS_ZERO, 1, 5);                               // DEC d
+    case 0xC7: SWITCH_OPERATION(iCMP, ADDRESS_NONE, 0, 5);                               // CMP (bdb)
+    case 0xC8: SWITCH_OPERATION(iINY, ADDRESS_NONE, 0, 2);                               // INY 
+    case 0xC9: SWITCH_OPERATION(iCMP, ADDRESS_IMMEDIATE, 1, 2);                          // CMP #$
+    case 0xCA: SWITCH_OPERATION(iDEX, ADDRESS_NONE, 0, 2);                               // DEX 
+    case 0xCB: SWITCH_OPERATION(iWAI, ADDRESS_NONE, 0, 2);                               // WAI 
+    case 0xCC: SWITCH_OPERATION(iCPY, ADDRESS_ABSOLUTE, 2, 4);                           // CPY a
+    case 0xCD: SWITCH_OPERATION(iCMP, ADDRESS_ABSOLUTE, 2, 4);                           // CMP a
+    case 0xCE: SWITCH_OPERATION(iDEC, ADDRESS_ABSOLUTE, 2, 6);                           // DEC a
+    case 0xCF: SWITCH_OPERATION(iCMP, ADDRESS_NONE, 0, 6);                               // CMP (al)
+    case 0xD0: SWITCH_OPERATION(iBNE, ADDRESS_RELATIVE, 1, 12);                          // BNE r
+    case 0xD1: SWITCH_OPERATION(iCMP, ADDRESS_INDIRECT_ZERO_INDEX_Y, 1, 15);             // CMP (d), Y
+    case 0xD2: SWITCH_OPERATION(iCMP, ADDRESS_INDIRECT_ZERO, 1, KIL);                    // CMP (d)
+    case 0xD3: SWITCH_OPERATION(iCMP, ADDRESS_NONE, 0, 8);                               // CMP (pdSpY)
+    case 0xD4: SWITCH_OPERATION(iPEI, ADDRESS_ZERO, 1, 4);                               // PEI d
+    case 0xD5: SWITCH_OPERATION(iCMP, ADDRESS_ZERO_X, 1, 4);                             // CMP d, X
+    case 0xD6: SWITCH_OPERATION(iDEC, ADDRESS_ZERO_X, 1, 6);                             // DEC d, X
+    case 0xD7: SWITCH_OPERATION(iCMP, ADDRESS_NONE, 0, 6);                               // CMP (bdby)
+    case 0xD8: SWITCH_OPERATION(iCLD, ADDRESS_NONE, 0, 2);                               // CLD 
+    case 0xD9: SWITCH_OPERATION(iCMP, ADDRESS_ABSOLUTE_Y, 2, 14);                        // CMP a, Y
+    case 0xDA: SWITCH_OPERATION(iPHX, ADDRESS_NONE, 0, 2);                               // PHX 
+    case 0xDB: SWITCH_OPERATION(iSTP, ADDRESS_NONE, 0, 7);                               // STP 
+    case 0xDC: SWITCH_OPERATION(iJML, ADDRESS_INDIRECT_ABSOLUTE, 1, 14);                 // JML (a)
+    case 0xDD: SWITCH_OPERATION(iCMP, ADDRESS_ABSOLUTE_X, 2, 14);                        // CMP a, X
+    case 0xDE: SWITCH_OPERATION(iDEC, ADDRESS_ABSOLUTE_X, 2, 7);                         // DEC a, X
+    case 0xDF: SWITCH_OPERATION(iCMP, ADDRESS_NONE, 0, 7);                               // CMP (alX)
+    case 0xE0: SWITCH_OPERATION(iCPX, ADDRESS_IMMEDIATE, 1, 2);                          // CPX #$
+    case 0xE1: SWITCH_OPERATION(iSBC, ADDRESS_INDIRECT_ZERO_X, 1, 6);                    // SBC (d, X)
+    case 0xE2: SWITCH_OPERATION(iSEP, ADDRESS_IMMEDIATE, 1, 2);                          // SEP #$
+    case 0xE3: SWITCH_OPERATION(iSBC, ADDRESS_NONE, 0, 8);                               // SBC (dS)
+    case 0xE4: SWITCH_OPERATION(iCPX, ADDRESS_ZERO, 1, 3);                               // CPX d
+    case 0xE5: SWITCH_OPERATION(iSBC, ADDRESS_ZERO, 1, 3);                               // SBC d
+    case 0xE6: SWITCH_OPERATION(iINC, ADDRESS_ZERO, 1, 5);                               // INC d
+    case 0xE7: SWITCH_OPERATION(iSBC, ADDRESS_NONE, 0, 5);                               // SBC (bdb)
+    case 0xE8: SWITCH_OPERATION(iINX, ADDRESS_NONE, 0, 2);                               // INX 
+    case 0xE9: SWITCH_OPERATION(iSBC, ADDRESS_IMMEDIATE, 1, 2);                          // SBC #$
+    case 0xEA: SWITCH_OPERATION(iNOP, ADDRESS_NONE, 0, 2);                               // NOP 
+    case 0xEB: SWITCH_OPERATION(iXBA, ADDRESS_NONE, 0, 2);                               // XBA 
+    case 0xEC: SWITCH_OPERATION(iCPX, ADDRESS_ABSOLUTE, 2, 4);                           // CPX a
+    case 0xED: SWITCH_OPERATION(iSBC, ADDRESS_ABSOLUTE, 2, 4);                           // SBC a
+    case 0xEE: SWITCH_OPERATION(iINC, ADDRESS_ABSOLUTE, 2, 6);                           // INC a
+    case 0xEF: SWITCH_OPERATION(iSBC, ADDRESS_NONE, 0, 6);                               // SBC (al)
+    case 0xF0: SWITCH_OPERATION(iBEQ, ADDRESS_RELATIVE, 1, 12);                          // BEQ r
+    case 0xF1: SWITCH_OPERATION(iSBC, ADDRESS_INDIRECT_ZERO_INDEX_Y, 1, 15);             // SBC (d), Y
+    case 0xF2: SWITCH_OPERATION(iSBC, ADDRESS_INDIRECT_ZERO, 1, KIL);                    // SBC (d)
+    case 0xF3: SWITCH_OPERATION(iSBC, ADDRESS_NONE, 0, 8);                               // SBC (pdSpY)
+    case 0xF4: SWITCH_OPERATION(iPEA, ADDRESS_ABSOLUTE, 2, 4);                           // PEA a
+    case 0xF5: SWITCH_OPERATION(iSBC, ADDRESS_ZERO_X, 1, 4);                             // SBC d, X
+    case 0xF6: SWITCH_OPERATION(iINC, ADDRESS_ZERO_X, 1, 6);                             // INC d, X
+    case 0xF7: SWITCH_OPERATION(iSBC, ADDRESS_NONE, 0, 6);                               // SBC (bdby)
+    case 0xF8: SWITCH_OPERATION(iSED, ADDRESS_NONE, 0, 2);                               // SED 
+    case 0xF9: SWITCH_OPERATION(iSBC, ADDRESS_ABSOLUTE_Y, 2, 14);                        // SBC a, Y
+    case 0xFA: SWITCH_OPERATION(iPLX, ADDRESS_NONE, 0, 2);                               // PLX 
+    case 0xFB: SWITCH_OPERATION(iXCE, ADDRESS_NONE, 0, 7);                               // XCE 
+    case 0xFC: SWITCH_OPERATION(iJSR, ADDRESS_INDIRECT_ABSOLUTE_X, 1, 14);               // JSR (a, X)
+    case 0xFD: SWITCH_OPERATION(iSBC, ADDRESS_ABSOLUTE_X, 2, 14);                        // SBC a, X
+    case 0xFE: SWITCH_OPERATION(iINC, ADDRESS_ABSOLUTE_X, 2, 7);                         // INC a, X
+    case 0xFF: SWITCH_OPERATION(iSBC, ADDRESS_NONE, 0, 7);                               // SBC (alX)
   }
 }
 
+#undef SWITCH_OPERATION
+
+template <uint8_t AddressMode>
+inline uint8_t *Cpu::resolveAddress(uint8_t *operand)
+{
+  // AddressMode is a constant, only one case survives compilation
+  switch (AddressMode)
+  {
+    case Memory::Immediate:           return ADDRESS_IMMEDIATE;
+    case Memory::DirectZeroX:         return ADDRESS_ZERO_X;
+    case Memory::DirectZeroY:         return ADDRESS_ZERO_Y;
+    case Memory::DirectZeroZ:         return ADDRESS_ZERO;
+    case Memory::DirectAbsoluteX:     return ADDRESS_ABSOLUTE_X;
+    case Memory::DirectAbsoluteY:     return ADDRESS_ABSOLUTE_Y;
+    case Memory::DirectAbsoluteZ:     return ADDRESS_ABSOLUTE;
+    case Memory::IndirectZeroX:       return ADDRESS_INDIRECT_ZERO_X;
+    case Memory::IndirectZeroZ:       return ADDRESS_INDIRECT_ZERO;
+    case Memory::IndirectZeroIndexY:  return ADDRESS_INDIRECT_ZERO_INDEX_Y;
+    case Memory::IndirectAbsoluteX:   return ADDRESS_INDIRECT_ABSOLUTE_X;
+    case Memory::IndirectAbsoluteZ:   return ADDRESS_INDIRECT_ABSOLUTE;
+    case Memory::RelativeAddress:     return ADDRESS_RELATIVE;
+    case Memory::RegisterA:           return ADDRESS_REGISTER_A;
+    default:                          return ADDRESS_NONE;
+  }
+}
+
+// Handler for a single opcode: everything doTableInstruction looks up and decodes
+// at runtime is read from the same lookup tables at compile time instead
+template <uint8_t OperationCode>
+void Cpu::doFusedInstruction(uint8_t *operand)
+{
+  constexpr uint8_t addressMode = Memory::AddressModeLookupTable[OperationCode];
+  constexpr uint8_t operationId = OperationCodeLookupTable[OperationCode];
+  constexpr OpCode_T operation = OperationCodeFunctionTable[operationId];
+  constexpr uint8_t size = Memory::AddressModeSizeTable[addressMode] + 1;
+  constexpr uint8_t timing = TimingLookupTable[OperationCode];
+  constexpr uint8_t baseCycles = timing % 10;
+  constexpr uint8_t pageCycles = timing / 10;
+
+  // the generated handler relies on these properties of the tables
+  static_assert(addressMode < Memory::AddressModeCount, "address mode out of range");
+  static_assert(operationId < sizeof(OperationCodeFunctionTable) / sizeof(OperationCodeFunctionTable[0]), "operation out of range");
+  static_assert(size <= 3, "instruction longer than 3 bytes");
+  static_assert(timing == KIL || (baseCycles >= 2 && baseCycles <= 8 && pageCycles <= 1), "timing is not cycles + 10 * page cross cycles");
+
+  uint8_t *address = resolveAddress<addressMode>(operand);
+  pc += size;
+  updateRandomVar(address);
+  (this->*operation)(address);
+  cycles += baseCycles;
+  cycles += crossedPage ? pageCycles : 0;
+}
+
+#define FUSED_ROW(high) \
+  case high | 0x0: doFusedInstruction<high | 0x0>(operand); break; case high | 0x1: doFusedInstruction<high | 0x1>(operand); break; \
+  case high | 0x2: doFusedInstruction<high | 0x2>(operand); break; case high | 0x3: doFusedInstruction<high | 0x3>(operand); break; \
+  case high | 0x4: doFusedInstruction<high | 0x4>(operand); break; case high | 0x5: doFusedInstruction<high | 0x5>(operand); break; \
+  case high | 0x6: doFusedInstruction<high | 0x6>(operand); break; case high | 0x7: doFusedInstruction<high | 0x7>(operand); break; \
+  case high | 0x8: doFusedInstruction<high | 0x8>(operand); break; case high | 0x9: doFusedInstruction<high | 0x9>(operand); break; \
+  case high | 0xA: doFusedInstruction<high | 0xA>(operand); break; case high | 0xB: doFusedInstruction<high | 0xB>(operand); break; \
+  case high | 0xC: doFusedInstruction<high | 0xC>(operand); break; case high | 0xD: doFusedInstruction<high | 0xD>(operand); break; \
+  case high | 0xE: doFusedInstruction<high | 0xE>(operand); break; case high | 0xF: doFusedInstruction<high | 0xF>(operand); break
+
+// The handlers are called directly from the switch so they inline into it,
+// a call through a table of member pointers costs more than the handler saves
+void Cpu::doFusedInstruction()
+{
+  uint8_t *instruction = fetchInstruction(pc);
+  uint8_t *operand = instruction + 1;
+
+  switch (instruction[0])
+  {
+    FUSED_ROW(0x00); FUSED_ROW(0x10); FUSED_ROW(0x20); FUSED_ROW(0x30);
+    FUSED_ROW(0x40); FUSED_ROW(0x50); FUSED_ROW(0x60); FUSED_ROW(0x70);
+    FUSED_ROW(0x80); FUSED_ROW(0x90); FUSED_ROW(0xA0); FUSED_ROW(0xB0);
+    FUSED_ROW(0xC0); FUSED_ROW(0xD0); FUSED_ROW(0xE0); FUSED_ROW(0xF0);
+  }
+}
+
+// Same as doFusedInstruction, but the opcode and operand bytes come from the
+// cache instead of guest memory
+template <uint8_t OperationCode>
+void Cpu::doPredecodedInstruction(const Predecoded_T &entry)
+{
+  constexpr uint8_t addressMode = Memory::AddressModeLookupTable[OperationCode];
+  constexpr uint8_t operationId = OperationCodeLookupTable[OperationCode];
+  constexpr OpCode_T operation = OperationCodeFunctionTable[operationId];
+  constexpr uint8_t pageCycles = TimingLookupTable[OperationCode] / 10;
+
+  // the operation may write over its own bytes and drop the entry
+  uint8_t requiredCycles = entry.cycles;
+  uint8_t *address = resolveAddress<addressMode>((uint8_t *)entry.operand);
+  pc += entry.size;
+  updateRandomVar(address);
+  (this->*operation)(address);
+  cycles += requiredCycles;
+  cycles += crossedPage ? pageCycles : 0;
+}
+
+#define PREDECODED_ROW(high) \
+  &Cpu::doPredecodedInstruction<high | 0x0>, &Cpu::doPredecodedInstruction<high | 0x1>, &Cpu::doPredecodedInstruction<high | 0x2>, &Cpu::doPredecodedInstruction<high | 0x3>, \
+  &Cpu::doPredecodedInstruction<high | 0x4>, &Cpu::doPredecodedInstruction<high | 0x5>, &Cpu::doPredecodedInstruction<high | 0x6>, &Cpu::doPredecodedInstruction<high | 0x7>, \
+  &Cpu::doPredecodedInstruction<high | 0x8>, &Cpu::doPredecodedInstruction<high | 0x9>, &Cpu::doPredecodedInstruction<high | 0xA>, &Cpu::doPredecodedInstruction<high | 0xB>, \
+  &Cpu::doPredecodedInstruction<high | 0xC>, &Cpu::doPredecodedInstruction<high | 0xD>, &Cpu::doPredecodedInstruction<high | 0xE>, &Cpu::doPredecodedInstruction<high | 0xF>
+
+const Cpu::PredecodedInstruction_T Cpu::PredecodedInstructionTable[] =
+{
+  PREDECODED_ROW(0x00), PREDECODED_ROW(0x10), PREDECODED_ROW(0x20), PREDECODED_ROW(0x30),
+  PREDECODED_ROW(0x40), PREDECODED_ROW(0x50), PREDECODED_ROW(0x60), PREDECODED_ROW(0x70),
+  PREDECODED_ROW(0x80), PREDECODED_ROW(0x90), PREDECODED_ROW(0xA0), PREDECODED_ROW(0xB0),
+  PREDECODED_ROW(0xC0), PREDECODED_ROW(0xD0), PREDECODED_ROW(0xE0), PREDECODED_ROW(0xF0),
+};
+
+void Cpu::doPredecodedInstruction()
+{
+  Predecoded_T &entry = predecoded[pc];
+
+  if (entry.handler == nullptr)
+  {
+    uint8_t *instruction = fetchInstruction(pc);
+    uint8_t operationCode = instruction[0];
+    uint8_t size = Memory::AddressModeSizeTable[Memory::AddressModeLookupTable[operationCode]] + 1;
+
+    entry.operand[0] = instruction[1];
+    entry.operand[1] = instruction[2];
+    entry.size = size;
+    entry.cycles = TimingLookupTable[operationCode] % 10;
+    entry.handler = PredecodedInstructionTable[operationCode];
+
+    // stores to either page must find the entry
+    markCodePage(pc >> 8, CodePagePredecoded);
+    markCodePage((uint16_t)(pc + size - 1) >> 8, CodePagePredecoded);
+
+    predecodeMisses++;
+  }
+  else
+  {
+    predecodeHits++;
+  }
+
+  (this->*entry.handler)(entry);
+}
+
+#undef PREDECODED_ROW
+#undef FUSED_ROW
+#undef ADDRESS_NONE
+#undef ADDRESS_IMMEDIATE
+#undef ADDRESS_ZERO_X
+#undef ADDRESS_ZERO_Y
+#undef ADDRESS_ZERO
+#undef ADDRESS_ABSOLUTE_X
+#undef ADDRESS_ABSOLUTE_Y
+#undef ADDRESS_ABSOLUTE
+#undef ADDRESS_INDIRECT_ZERO_X
+#undef ADDRESS_INDIRECT_ZERO
+#undef ADDRESS_INDIRECT_ZERO_INDEX_Y
+#undef ADDRESS_INDIRECT_ABSOLUTE_X
+#undef ADDRESS_INDIRECT_ABSOLUTE
+#undef ADDRESS_RELATIVE
+#undef ADDRESS_REGISTER_A
+
 uint16_t Cpu::getProgramCounter()
 {
   // return memory index pointed to by PC
@@ -559,7 +2005,7 @@ uint8_t Cpu::getTwosComplement(uint8_t value)
 // push 8 bits onto stack and increment stack pointer
 void Cpu::pushStack(uint8_t value)
 {
-  startAddr[0x100 + sp] = value;
+  storeByte(startAddr + 0x100 + sp, value);
   sp--;
 }
 
@@ -574,10 +2020,20 @@ uint8_t Cpu::popStack()
   return value;
 }
 
-// randomize 0xFE
+// randomize 0xFE: xorshift32
 void Cpu::generateRandomVar()
 {
-  *(startAddr + 0xFE) = (std::rand() % 0xFF);
+  randomState ^= randomState << 13;
+  randomState ^= randomState >> 17;
+  randomState ^= randomState << 5;
+
+  *(startAddr + RandomAddress) = (randomState % 0xFF);
+}
+
+void Cpu::setRandomSeed(uint32_t seed)
+{
+  // xorshift never leaves a zero state
+  randomState = (seed != 0) ? seed : RandomDefaultSeed;
 }
 
 void Cpu::incrementProgramCounter(uint16_t addressOffset)
@@ -590,22 +2046,21 @@ void Cpu::iBRK(uint8_t *addr)
 {
   printf("break\n");
   breakFlag = true;
+  updatePendingEvents();
 }
 
 // bitwise OR Accumulator
 // Affects Flags: S Z
 void Cpu::iORA(uint8_t *addr)
 {
-  uint8_t value = *addr;
+  uint8_t value = loadByte(addr);
 
   // accumulator = accumulator | *memoryAddr
   a |= value;
 
   // S flag
-  negativeFlag = (a >= 0x80);
-
   // Z flag
-  zeroFlag = (a == 0);
+  setZeroNegative(a);
 }
 
 // COProcessor
@@ -624,30 +2079,28 @@ void Cpu::iTSB(uint8_t *addr)
 // Affects Flags: S Z C
 void Cpu::iASL(uint8_t *addr)
 {
-  uint8_t temp = *addr;
+  uint8_t temp = loadByte(addr);
 
   // C flag is set to bit 7 before shifting
-  carryFlag = (temp >= 0x80);
+  setCarry(temp >= 0x80);
   
   // shift left once
   temp <<= 1;
 
   // Z flag set if result was 0
-  zeroFlag = (temp == 0);
-
   // S flag set if bit 7 of the result is set
-  negativeFlag = (temp >= 0x80);
+  setZeroNegative(temp);
   
-  *addr = temp;
+  storeByte(addr, temp);
 }
 
 // PusH Processor status register
 // Affects Flags: none
 void Cpu::iPHP(uint8_t *addr)
 {
-  uint8_t value = getFlags();
+  uint8_t value = getFlags() | breakMask | unusuedMask;
 
-  // push 8 bit flags onto stack and increment pointer
+  // push 8 bit flags onto stack and increment pointer, B set to tell it from an interrupt
   pushStack(value);
 }
 
@@ -661,7 +2114,7 @@ void Cpu::iPHD(uint8_t *addr)
 // Affects Flags: none
 void Cpu::iBPL(uint8_t *addr)
 {
-  if (!negativeFlag)
+  if (!getNegativeFlag())
   {
     // add 1 cycle since branch was taken
     cycles += 1;
@@ -686,22 +2139,20 @@ void Cpu::iTRB(uint8_t *addr)
 // Affects Flags: C
 void Cpu::iCLC(uint8_t *addr)
 {
-  carryFlag = false;
+  setCarry(false);
 }
 
 // INCrement
 // Affects flags S, Z
 void Cpu::iINC(uint8_t *addr)
 {
-  uint8_t value = *addr;
+  uint8_t value = loadByte(addr);
   value += 1;
-  *addr = value;
+  storeByte(addr, value);
 
   // Z: value became zero
-  zeroFlag = (value == 0);
-
   // S: value is negative
-  negativeFlag = (value >= 0x80);
+  setZeroNegative(value);
 }
 
 // Transfer C accumulator to Stack pointer
@@ -729,16 +2180,14 @@ void Cpu::iJSR(uint8_t *addr)
 // affects flags S, Z
 void Cpu::iAND(uint8_t *addr)
 {
-  uint8_t value = *addr;
+  uint8_t value = loadByte(addr);
 
   // accumulator = accumulator & *memoryAddr
   a &= value;
 
   // Z: value became zero
-  zeroFlag = (a == 0);
-
   // S: value became negative
-  negativeFlag = (a >= 0x80);
+  setZeroNegative(a);
 }
 
 // Jump to Subroutine Long
@@ -751,27 +2200,27 @@ void Cpu::iJSL(uint8_t *addr)
 // Affects flags N V Z
 void Cpu::iBIT(uint8_t *addr)
 {
-  uint8_t value = *addr;
+  uint8_t value = loadByte(addr);
 
   // Z: set as though the value were ANDed with the accumulator
-  zeroFlag = ((value & a) == 0);
+  setZero((value & a) == 0);
 
   // N: set to match bit 7 in the value stored at the tested address
-  negativeFlag = (value & negativeMask);
+  setNegative(value & negativeMask);
 
   // V: set to match bit 6 in the value stored at the tested address
-  overflowFlag = (value & overflowMask);
+  setOverflow(value & overflowMask);
 }
 
 // ROtate Left
 // Affects Flags: S Z C
 void Cpu::iROL(uint8_t *addr)
 {
-  uint8_t value = *addr;
-  bool prevCarry = carryFlag;
+  uint8_t value = loadByte(addr);
+  bool prevCarry = getCarryFlag();
 
   // C: the original bit 7 is shifted into carryFlag
-  carryFlag = (value & negativeMask);
+  setCarry(value & negativeMask);
 
   // rotate 1 bit
   value <<= 1;
@@ -780,12 +2229,10 @@ void Cpu::iROL(uint8_t *addr)
   value |= (prevCarry) ? 1 : 0;
 
   // Z: resulting value affects zeroFlag
-  zeroFlag = (value == 0);
-
   // S: resulting value affects signFlag
-  negativeFlag = (value >= 0x80);
+  setZeroNegative(value);
 
-  *addr = value;
+  storeByte(addr, value);
 }
 
 // PulL Processor status register
@@ -808,7 +2255,7 @@ void Cpu::iPLD(uint8_t *addr)
 // Affects flags: none
 void Cpu::iBMI(uint8_t *addr)
 {
-  if (negativeFlag)
+  if (getNegativeFlag())
   {
     // add 1 cycle since branch was taken
     cycles += 1;
@@ -827,23 +2274,21 @@ void Cpu::iBMI(uint8_t *addr)
 // Affects flags C
 void Cpu::iSEC(uint8_t *addr)
 {
-  carryFlag = true;
+  setCarry(true);
 }
 
 // DECrement
 // Affects Flags: S Z
 void Cpu::iDEC(uint8_t *addr)
 {
-  uint8_t value = *addr;
+  uint8_t value = loadByte(addr);
   
   value -= 1;
-  *addr = value;
+  storeByte(addr, value);
 
   // Z: value became zero
-  zeroFlag = (value == 0);
-
   // S: value is negative
-  negativeFlag = (value >= 0x80);
+  setZeroNegative(value);
 }
 
 // Transfer Stack pointer to C accumulator
@@ -869,16 +2314,14 @@ void Cpu::iRTI(uint8_t *addr)
 // Affects Flags: S Z
 void Cpu::iEOR(uint8_t *addr)
 {
-  uint8_t value = *addr;
+  uint8_t value = loadByte(addr);
 
   // accumulator = accumulator ^ *memoryAddr
   a ^= value;
 
   // S: a became negative
-  negativeFlag = (a >= 0x80);
-
   // Z: a became zero
-  zeroFlag = (a == 0);
+  setZeroNegative(a);
 }
 
 // William D. Mensch, Jr. (2-byte, 2-cycle NOP)
@@ -897,20 +2340,18 @@ void Cpu::iMVP(uint8_t *addr)
 // Affects Flags: S Z C
 void Cpu::iLSR(uint8_t *addr)
 {
-  uint8_t value = *addr;
+  uint8_t value = loadByte(addr);
 
   // C: original bit 0 is shifted into the Carry
-  carryFlag = (value & 1);
+  setCarry(value & 1);
 
   value >>= 1;
 
   // Z: value became zero
-  zeroFlag = (value == 0);
-
   // S: value became negative (never?)
-  negativeFlag = (value >= 0x80);
+  setZeroNegative(value);
 
-  *addr = value;
+  storeByte(addr, value);
 }
 
 // PusH Accumulator
@@ -938,7 +2379,7 @@ void Cpu::iJMP(uint8_t *addr)
 // Branch if oVerflow Clear
 void Cpu::iBVC(uint8_t *addr)
 {
-  if (!overflowFlag)
+  if (!getOverflowFlag())
   {
     // add 1 cycle since branch was taken
     cycles += 1;
@@ -963,6 +2404,7 @@ void Cpu::iMVN(uint8_t *addr)
 void Cpu::iCLI(uint8_t *addr)
 {
   interruptFlag = false;
+  updatePendingEvents();
 }
 
 // PusH Y register
@@ -1006,36 +2448,26 @@ void Cpu::iRTS(uint8_t *addr)
 // Affects Flags: S V Z C
 void Cpu::iADC(uint8_t *addr)
 {
-  uint8_t value = *addr;
+  uint8_t value = loadByte(addr);
   uint16_t carryTestValue = value + a;
   uint8_t result = value + a;
 
   // add 1 if carry was set
-  result += (carryFlag) ? 1 : 0;
-  carryTestValue += (carryFlag) ? 1 : 0;
+  result += (getCarryFlag()) ? 1 : 0;
+  carryTestValue += (getCarryFlag()) ? 1 : 0;
 
   // V: check if overflow - adding positives equals negative OR adding negatives equals positive
-  if ((value >= 0x80 && a >= 0x80 && result < 0x80)
-      || (value < 0x80 && a < 0x80 && result >= 0x80))
-  {
-    overflowFlag = true;
-  }
-  else
-  {
-    overflowFlag = false;
-  }
+  setOverflowResult(a, value, result);
 
   // do addition
   a = result;
 
   // C: check if carry
-  carryFlag = (carryTestValue >= 0x100);
+  setCarryResult(carryTestValue);
 
   // S: check if negative
-  negativeFlag = (a >= 0x80);
-
   // Z: zero flag
-  zeroFlag = (result == 0);
+  setZeroNegative(a);
 }
 
 // Push Effective Relative address
@@ -1054,28 +2486,26 @@ void Cpu::iSTZ(uint8_t *addr)
 // Affects Flags: S Z C
 void Cpu::iROR(uint8_t *addr)
 {
-  uint8_t value = *addr;
+  uint8_t value = loadByte(addr);
   bool newCarryFlag = (value & 1);
 
   // ROR shifts all bits right one position
   value >>= 1;
 
   // Carry is shifted into bit 7
-  if (carryFlag)
+  if (getCarryFlag())
   {
     value |= 0x80;
   }
 
   // C: original bit 0 is shifted into the Carry
-  carryFlag = newCarryFlag;
+  setCarry(newCarryFlag);
 
   // Z: result was zero
-  zeroFlag = (value == 0);
-
   // S: result was negative
-  negativeFlag = (value >= 0x80);
+  setZeroNegative(value);
 
-  *addr = value;
+  storeByte(addr, value);
 }
 
 // PulL Accumulator
@@ -1085,10 +2515,8 @@ void Cpu::iPLA(uint8_t *addr)
   a = popStack();
 
   // Z: result was zero
-  zeroFlag = (a == 0);
-
   // S: result was negative
-  negativeFlag = (a >= 0x80);
+  setZeroNegative(a);
 }
 
 // ReTurn from subroutine Long
@@ -1100,7 +2528,7 @@ void Cpu::iRTL(uint8_t *addr)
 // Branch if oVerflow Set
 void Cpu::iBVS(uint8_t *addr)
 {
-  if (overflowFlag)
+  if (getOverflowFlag())
   {
     // add 1 cycle since branch was taken
     cycles += 1;
@@ -1119,6 +2547,7 @@ void Cpu::iBVS(uint8_t *addr)
 void Cpu::iSEI(uint8_t *addr)
 {
   interruptFlag = true;
+  updatePendingEvents();
 }
 
 // PulL Y register
@@ -1145,7 +2574,7 @@ void Cpu::iSTA(uint8_t *addr)
 {
   uint8_t value = a;
 
-  *addr = value;
+  storeByte(addr, value);
 }
 
 // BRanch Long
@@ -1160,7 +2589,7 @@ void Cpu::iSTY(uint8_t *addr)
 {
   uint8_t value = y;
 
-  *addr = value;
+  storeByte(addr, value);
 }
 
 // STore X register
@@ -1168,7 +2597,7 @@ void Cpu::iSTX(uint8_t *addr)
 {
   uint8_t value = x;
 
-  *addr = value;
+  storeByte(addr, value);
 }
 
 // DEcrement Y register
@@ -1177,7 +2606,7 @@ void Cpu::iDEY(uint8_t *addr)
 {
   y--;
   
-  zeroFlag = (y == 0);
+  setZero(y == 0);
 }
 
 // Transfer X register to Accumulator
@@ -1187,10 +2616,8 @@ void Cpu::iTXA(uint8_t *addr)
   a = x;
 
   // Z: 
-  zeroFlag = (a == 0);
-
   // S: 
-  negativeFlag = (a >= 0x80);
+  setZeroNegative(a);
 }
 
 // PusH data Bank register
@@ -1202,7 +2629,7 @@ void Cpu::iPHB(uint8_t *addr)
 // Branch if Carry Clear
 void Cpu::iBCC(uint8_t *addr)
 {
-  if (!carryFlag)
+  if (!getCarryFlag())
   {
     // add 1 cycle since branch was taken
     cycles += 1;
@@ -1224,23 +2651,19 @@ void Cpu::iTYA(uint8_t *addr)
   a = y;
 
   // Z: 
-  zeroFlag = (a == 0);
-
   // S: 
-  negativeFlag = (a >= 0x80);
+  setZeroNegative(a);
 }
 
 // Transfer X register to Stack pointer
 // Affect Flags: S Z
 void Cpu::iTXS(uint8_t *addr)
 {
-  *(startAddr + 0x100 + sp) = x;
+  storeByte(startAddr + 0x100 + sp, x);
 
   // Z: 
-  zeroFlag = (x == 0);
-
   // S: 
-  negativeFlag = (x >= 0x80);
+  setZeroNegative(x);
 }
 
 // Transfer X register to Y register
@@ -1253,46 +2676,40 @@ void Cpu::iTXY(uint8_t *addr)
 // Affects Flags: S Z
 void Cpu::iLDY(uint8_t *addr)
 {
-  uint8_t value = *addr;
+  uint8_t value = loadByte(addr);
 
   y = value;
 
   // loaded zero
-  zeroFlag = (y == 0);
-
   // loaded negative value
-  negativeFlag = (y >= 0x80);
+  setZeroNegative(y);
 }
 
 // LoaD Accumulator
 // Affects Flags: S Z
 void Cpu::iLDA(uint8_t *addr)
 {
-  uint8_t value = *addr;
+  uint8_t value = loadByte(addr);
 
   // a = value at *memoryAddr
   a = value;
 
   // Z: loaded zero
-  zeroFlag = (a == 0);
-
   // S: loaded negative
-  negativeFlag = (a >= 0x80);
+  setZeroNegative(a);
 }
 
 // LoaD X register
 // Affects Flags: S Z
 void Cpu::iLDX(uint8_t *addr)
 {
-  uint8_t value = *addr;
+  uint8_t value = loadByte(addr);
 
   x = value;
 
   // Z: loaded zero
-  zeroFlag = (x == 0);
-
   // S: loaded negative
-  negativeFlag = (x >= 0x80);
+  setZeroNegative(x);
 }
 
 // Transfer Accumulator to Y register
@@ -1304,10 +2721,8 @@ void Cpu::iTAY(uint8_t *addr)
   y = value;
 
   // Z: transfer zero
-  zeroFlag = (y == 0);
-
   // S: transfer negative
-  negativeFlag = (y >= 0x80);
+  setZeroNegative(y);
 }
 
 // Transfer Accumulator to X register
@@ -1319,10 +2734,8 @@ void Cpu::iTAX(uint8_t *addr)
   x = value;
 
   // Z: transfer zero
-  zeroFlag = (x == 0);
-
   // S: transfer negative
-  negativeFlag = (x >= 0x80);
+  setZeroNegative(x);
 }
 
 // PulL data Bank register
@@ -1334,7 +2747,7 @@ void Cpu::iPLB(uint8_t *addr)
 // Branch if Carry Set
 void Cpu::iBCS(uint8_t *addr)
 {
-  if (carryFlag)
+  if (getCarryFlag())
   {
     // add 1 cycle since branch was taken
     cycles += 1;
@@ -1352,7 +2765,7 @@ void Cpu::iBCS(uint8_t *addr)
 // CLear oVerflow
 void Cpu::iCLV(uint8_t *addr)
 {
-  overflowFlag = false;
+  setOverflow(false);
 }
 
 // Transfer Stack pointer to X register
@@ -1362,10 +2775,8 @@ void Cpu::iTSX(uint8_t *addr)
   x = *(startAddr + 0x100 + sp);
 
   // Z: 
-  zeroFlag = (x == 0);
-
   // S: 
-  negativeFlag = (x >= 0x80);
+  setZeroNegative(x);
 }
 
 // Transfer Y register to X register
@@ -1379,21 +2790,18 @@ void Cpu::iTYX(uint8_t *addr)
 void Cpu::iCPY(uint8_t *addr)
 {
   uint8_t result;
-  uint8_t value = *addr;
+  uint8_t value = loadByte(addr);
   uint16_t carryTest = y;
   
-  // Z:
-  zeroFlag = (y == value);
-
   value = getTwosComplement(value);
   carryTest += value;
   result = value + y;
 
   // C:
-  carryFlag = (carryTest >= 0x100);
+  setCarryResult(carryTest);
 
-  // N:
-  negativeFlag = (result >= 0x80);
+  // Z, N: result is zero only when the register equals the value
+  setZeroNegative(result);
 }
 
 // CoMPare (to accumulator)
@@ -1401,21 +2809,18 @@ void Cpu::iCPY(uint8_t *addr)
 void Cpu::iCMP(uint8_t *addr)
 {
   uint8_t result;
-  uint8_t value = *addr;
+  uint8_t value = loadByte(addr);
   uint16_t carryTest = a;
   
-  // Z:
-  zeroFlag = (a == value);
-
   value = getTwosComplement(value);
   carryTest += value;
   result = value + a;
 
   // C:
-  carryFlag = (carryTest >= 0x100);
+  setCarryResult(carryTest);
 
-  // N:
-  negativeFlag = (result >= 0x80);
+  // Z, N: result is zero only when the register equals the value
+  setZeroNegative(result);
 }
 
 // REset Processor status bits
@@ -1431,10 +2836,8 @@ void Cpu::iINY(uint8_t *addr)
   y += 1;
   
   // S: increment to negative
-  negativeFlag = (y >= 0x80);
-
   // Z: increment to zero
-  zeroFlag = (y == 0);
+  setZeroNegative(y);
 }
 
 // DEcrement X register
@@ -1444,22 +2847,21 @@ void Cpu::iDEX(uint8_t *addr)
   x -= 1;
   
   // S: increment to negative
-  negativeFlag = (x >= 0x80);
-
   // Z: increment to zero
-  zeroFlag = (x == 0);
+  setZeroNegative(x);
 }
 
 // WAit for Interrupt
 void Cpu::iWAI(uint8_t *addr)
 {
-  // unused
+  waiting = true;
+  updatePendingEvents();
 }
 
 // Branch if Not Equal
 void Cpu::iBNE(uint8_t *addr)
 {
-  if (!zeroFlag)
+  if (!getZeroFlag())
   {
     // add 1 cycle since branch was taken
     cycles += 1;
@@ -1495,7 +2897,8 @@ void Cpu::iPHX(uint8_t *addr)
 // SToP the clock
 void Cpu::iSTP(uint8_t *addr)
 {
-  // unused
+  stopped = true;
+  updatePendingEvents();
 }
 
 // JuMP Long
@@ -1509,21 +2912,18 @@ void Cpu::iJML(uint8_t *addr)
 void Cpu::iCPX(uint8_t *addr)
 {
   uint8_t result;
-  uint8_t value = *addr;
+  uint8_t value = loadByte(addr);
   uint16_t carryTest = x;
   
-  // Z:
-  zeroFlag = (x == value);
-
   value = getTwosComplement(value);
   carryTest += value;
   result = value + x;
 
   // C:
-  carryFlag = (carryTest >= 0x100);
+  setCarryResult(carryTest);
 
-  // N:
-  negativeFlag = (result >= 0x80);
+  // Z, N: result is zero only when the register equals the value
+  setZeroNegative(result);
 }
 
 // SBC, starting with C set:
@@ -1542,7 +2942,7 @@ void Cpu::iCPX(uint8_t *addr)
 // Affects Flags: S V Z C
 void Cpu::iSBC(uint8_t *addr)
 {
-  uint8_t value = *addr;
+  uint8_t value = loadByte(addr);
 
   // get the 1's complement of the value being subtracted and add
   value = getOnesComplement(value);
@@ -1563,10 +2963,8 @@ void Cpu::iINX(uint8_t *addr)
   x++;
 
   // Z: increment to zero
-  zeroFlag = (x == 0);
-
   // S: increment to negative
-  negativeFlag = (x >= 0x80);
+  setZeroNegative(x);
 }
 
 // No OPeration
@@ -1584,7 +2982,7 @@ void Cpu::iXBA(uint8_t *addr)
 // Branch if EQual
 void Cpu::iBEQ(uint8_t *addr)
 {
-  if (zeroFlag)
+  if (getZeroFlag())
   {
     // add 1 cycle since branch was taken
     cycles += 1;
@@ -2,12 +2,13 @@
 #define CPU_HPP
 #include <iostream>
 #include "Memory.hpp"
-#include "SDL2/SDL.h" 
+#include "Jit.hpp"
 
 class Cpu
 {
   public:
     Cpu();
+    ~Cpu();
     uint8_t getFlags();
     void setFlags(uint8_t value);
 
@@ -35,8 +36,23 @@ class Cpu
       negativeOffset  = 7
     };
 
+    enum Engine
+    {
+      EngineTable,      // address mode and operation function tables (reference)
+      EngineSwitch,     // single switch on the opcode, address modes inlined
+      EngineFused,      // one handler per opcode generated at compile time (default)
+      EngineJit,        // translated x86-64 basic blocks, falls back to EngineFused per instruction
+      EnginePredecode,  // fused handlers run from a cache of decoded instructions indexed by PC
+    };
+
+    // return true to stop Cpu::runUntil before the next instruction
+    typedef bool (*RunPredicate_T)(Cpu &cpu, void *context);
+
     void doInstruction(uint8_t *instrAddr);
-    void doInstruction();
+    void doInstruction();                                 // one cycle: start the instruction at PC or wait out the current one
+    uint64_t runCycles(uint64_t cycleCount);              // same as cycleCount doInstruction calls, returns instructions executed
+    uint64_t runInstructions(uint64_t count);             // run at least count instructions, returns cycles elapsed
+    uint64_t runUntil(RunPredicate_T predicate, void *context, uint64_t cycleLimit);  // returns cycles elapsed
     uint16_t getProgramCounter();
     uint8_t getStackPointer();
     uint8_t getA();
@@ -49,7 +65,57 @@ class Cpu
     void printStatus();
     void printStack();
     void printZeroPage();
-    void handlePlayerInput(SDL_Event *event);
+    void handlePlayerInput(uint8_t key);                  // lower case ASCII of a key press, read by the program at $FF
+
+    // Interrupt lines, serviced between instructions. NMI latches on a
+    // rising edge, IRQ is the OR of every source holding it and is taken
+    // while I is clear. Either one raised during runCycles ends the batch
+    // early so it is seen at the next instruction.
+    enum IrqSource
+    {
+      IrqMapper     = 1,      // board scanline counter
+    };
+
+    // Stopped after BRK or STP until reset, Waiting after WAI until an
+    // interrupt line is asserted. Neither runs instructions, the run loops
+    // only let the ticks pass.
+    enum RunState
+    {
+      RunStateRunning,
+      RunStateWaiting,
+      RunStateStopped,
+    };
+
+    RunState getRunState();
+    void setNmi(bool level);                              // NMI line, true asserted
+    void setIrq(uint8_t source, bool level);              // one IrqSource bit of the IRQ line
+    uint64_t getInterruptCount();                         // NMIs and IRQs serviced
+    void stall(uint32_t cycleCount);                      // DMA holds the bus, the current instruction ends cycleCount later
+    uint64_t getBatchCycles();                            // ticks of the current runCycles batch that have passed, 0 outside one
+
+    static const uint16_t NmiVector = 0xFFFA;
+    static const uint16_t ResetVector = 0xFFFC;
+    static const uint16_t IrqVector = 0xFFFE;
+    void setEngine(Engine newEngine);                     // EngineJit runs EngineFused where the jit isn't available
+    void setRandomSeed(uint32_t seed);                    // $FE values repeat for the same seed
+    Engine getEngine();
+    uint64_t getInstructionCount();
+    uint64_t getPredecodeHits();
+    uint64_t getPredecodeMisses();
+    void setIdleLoopSkip(bool enable);                    // fast-forward side effect free loops in runCycles / runInstructions
+    uint64_t getIdleSkippedCycles();
+
+    static const uint16_t RandomAddress = 0xFE;           // reads give a new random value
+    static const uint32_t RandomDefaultSeed = 0x6502;     // seed used until setRandomSeed
+    void invalidateCode(uint16_t offset, uint32_t size);  // memory was written outside of the Cpu
+    void remapPages(uint8_t firstPage, uint16_t count);   // Memory bus pages now point somewhere else
+
+    enum CodePageFlags
+    {
+      CodePageJit         = 1,      // page holds bytes of a translated block
+      CodePagePredecoded  = 2,      // page holds bytes of a predecoded instruction
+      CodePageIdleLoop    = 4,      // page holds bytes read by analyzeIdleLoop
+    };
 
   private:
     typedef void (Cpu::*OpCode_T)(uint8_t *memoryAddr);
@@ -60,34 +126,154 @@ class Cpu
     static const uint8_t SizeLookupTable[];
     static const uint8_t TimingLookupTable[];
 
+    friend class Jit;
+
+    struct Predecoded_T;
+    typedef void (Cpu::*PredecodedInstruction_T)(const Predecoded_T &entry);
+    static const PredecodedInstruction_T PredecodedInstructionTable[];  // Cpu::doPredecodedInstruction<opcode> for every opcode
+
+    // decoded instruction at one PC
+    struct Predecoded_T
+    {
+      PredecodedInstruction_T handler;  // nullptr until the PC is decoded, or after a write to its bytes
+      uint8_t operand[2];               // operand bytes following the opcode
+      uint8_t size;                     // instruction size in bytes
+      uint8_t cycles;                   // base cycles
+    };
+
     // Bits 7 -> 0:
     // Flags NVss DIZC (AKA SVss DBZC)
     //
+    // With CPU_LAZY_FLAGS defined N, V, Z and C are kept as the last results
+    // that set them and are only worked out when something reads the flag
+#ifdef CPU_LAZY_FLAGS
+    uint16_t zeroNegativeResult;  // Z : 1 if the low byte is 0, N : bit 15
+    uint16_t carryResult;         // C : bit 8
+    uint8_t overflowResult;       // V : bit 7
+#else
     bool negativeFlag;  // N : Set to bit 7 of last operation
     bool overflowFlag;  // V : 1 if last ADC or SBC resulted in signed overflow, or D6 from last BIT
+#endif
     bool sHigh;         // sx: No effect, used by stack copy
     bool sLow;          // xs: No effect, used by stack copy
     bool decimalFlag;   // D : 1 to enable decimal mode
     bool interruptFlag; // I : 1 to disable maskable interrupts
+#ifndef CPU_LAZY_FLAGS
     bool zeroFlag;      // Z : 1 if last operation resulted in a 0 value
     bool carryFlag;     // C : 1 if last addition or shift resulted in a carry, or if last subtraction resulted in no borrow
+#endif
 
     bool breakFlag;     // use internally to signal BREAK
+    bool stopped;       // STP ran, cleared by reset
+    bool waiting;       // WAI ran, cleared by an interrupt line
+    bool nmiLine;       // level of the NMI line
+    bool nmiLatched;    // rising edge of NMI not serviced yet
+    uint8_t irqLines;   // IrqSource bits holding IRQ
+    uint8_t pendingEvents;  // PendingEvents, the only thing the run loops check for halts and interrupts
+    uint64_t batchLength;     // ticks the runCycles batch was started with
+    uint64_t batchRemaining;  // ticks left in the runCycles batch
+    uint64_t batchDeferred;   // ticks taken out of batchRemaining when an event was raised mid-batch
+    uint64_t interruptCount;  // NMIs and IRQs serviced
     bool crossedPage;   // signal 255-byte page boundary was crossed
-    uint8_t cycles;     // number of cycles to wait before executing next instruction
+    uint32_t cycles;    // number of cycles to wait before executing next instruction
+    Engine engine;      // execution engine used by doInstruction
+    uint64_t instructionCount; // instructions executed since construction
+    Jit *jit;           // created by setEngine(EngineJit)
+    Predecoded_T *predecoded;       // created by setEngine(EnginePredecode), one entry per PC
+    uint64_t predecodeHits;         // instructions run from an existing entry
+    uint64_t predecodeMisses;       // instructions decoded into the cache first
+    uint32_t randomState;           // xorshift32 state for 0x00FE
+
+    uint8_t codePages[256];   // CodePageFlags for each page, stores to flagged pages take the slow path
+    uint8_t aliasPages[256];  // next page reading the same cpu_mem bytes (RAM mirrors), the page itself without one
+    uint8_t *fetchPages[256]; // Memory bus page to fetch instructions from, nullptr when they may run into a different page
+
+    static const uint32_t JitCycleBudget = 256;   // cycles run by translated code per doInstruction
+    static const uint32_t JitBatchBudget = 4096;  // cycles run by translated code per step of a batch
+    static const uint32_t InterruptCycles = 7;    // pushing PC and P and reading the vector
+
+    enum PendingEvents
+    {
+      PendingHalt         = 1,      // BRK or STP stopped the CPU
+      PendingNmi          = 2,      // NMI latched
+      PendingIrq          = 4,      // IRQ held with I clear
+      PendingWait         = 8,      // WAI, no interrupt line asserted yet
+      PendingIdle         = PendingHalt | PendingWait,
+    };
+
+    enum IdleLoopKind
+    {
+      IdleLoopUnknown = 0,      // not analyzed yet, or its bytes were written
+      IdleLoopNone,             // not a loop that can be skipped
+      IdleLoopCounted,          // NOPs and one DEX/DEY/INX/INY closed by BNE
+      IdleLoopPolling,          // reads memory and registers only, state repeats every iteration
+    };
+
+    // loop starting at one PC and closed by a branch back to it
+    struct IdleLoop_T
+    {
+      uint8_t kind;             // IdleLoopKind
+      int8_t step;              // IdleLoopCounted: -1 or +1 added to the counter
+      bool counterY;            // IdleLoopCounted: counter is Y, otherwise X
+      uint8_t instructions;     // instructions per iteration
+      uint16_t branchPc;        // PC of the closing branch
+      uint16_t cycles;          // ticks of one iteration with the branch taken
+    };
+
+    static const int MaxIdleLoopInstructions = 8;
+    static const uint32_t IdleLoopWindow = MaxIdleLoopInstructions * 3;  // bytes analyzeIdleLoop may read
+
+    bool idleLoopSkip;              // set by setIdleLoopSkip
+    IdleLoop_T *idleLoops;          // created by setIdleLoopSkip(true), one entry per loop start PC
+    uint64_t idleSkippedCycles;     // ticks fast-forwarded by skipIdleLoop
+    uint64_t idleSnapshot;          // PC and registers the last time a polling loop was closed
 
     Memory  *memory;    // memory_callback
     uint8_t *startAddr; // Program Counter: 16 bits, reference &memory[(0x0 -> 0xFFFF)]
+    uint8_t *const *readPages;    // Memory bus pages, nullptr for pages read through a handler
+    uint8_t *const *writePages;   // Memory bus pages, nullptr for pages written through a handler
+    uint8_t fetchBuffer[3];       // instruction bytes that don't sit in one direct page
     uint16_t pc;        // Program Counter: 16 bits, reference &memory[(0x0 -> 0xFFFF)]
-                        // On reset, reference address given from &memory[(memory[0xFFFD] << 4) | (memory[0xFFFC])]; 
+                        // On reset, read from the vector at ResetVector
     uint8_t sp;         // Stack Pointer: references &memory[(0x100 -> 0x1FF)]
                         // SP increments high to low: 0x1FF -> 0x100 
     uint8_t a;          // Accumulator register
     uint8_t x;          // X register
     uint8_t y;          // Y register
 
+    // execution engines
+    void doTableInstruction();                            // dispatch through the address mode / operation tables
+    void doSwitchInstruction();                           // dispatch with a single switch on the opcode
+    void doFusedInstruction();                            // switch on the opcode into the doFusedInstruction<opcode> handlers
+    template <uint8_t OperationCode>
+    void doFusedInstruction(uint8_t *operand);            // address mode, operation and timing of one opcode
+    template <uint8_t AddressMode>
+    uint8_t *resolveAddress(uint8_t *operand);            // effective address of a compile-time address mode
+    uint32_t doEngineInstruction(Engine selectedEngine, uint32_t cycleBudget);  // returns instructions executed
+    uint32_t doJitInstructions(uint32_t cycleBudget);     // run translated blocks, returns instructions executed
+    void doPredecodedInstruction();                       // run the cached entry for PC, decoding it on a miss
+    template <uint8_t OperationCode>
+    void doPredecodedInstruction(const Predecoded_T &entry);  // doFusedInstruction with operand, size and cycles from the entry
+    void analyzeIdleLoop(uint16_t start);                 // fill idleLoops[start]
+    uint64_t skipIdleLoop(uint16_t lastPc, uint64_t cycleBudget, uint64_t instructionBudget, uint64_t &skippedInstructions);  // returns ticks skipped
+
+    // status flags, eager or lazy depending on CPU_LAZY_FLAGS
+    bool getNegativeFlag();
+    bool getOverflowFlag();
+    bool getZeroFlag();
+    bool getCarryFlag();
+    void setNegative(bool value);
+    void setOverflow(bool value);
+    void setZero(bool value);
+    void setCarry(bool value);
+    void setZeroNegative(uint8_t result);                 // Z and N from a result
+    void setCarryResult(uint16_t result);                 // C from bit 8 of a result
+    void setOverflowResult(uint8_t a, uint8_t value, uint8_t result);  // V from the operands and result of an addition
+
     // utility functions
     void generateRandomVar();                             // generate random value at 0x00FE
+    void updateRandomVar(uint8_t *address);               // generateRandomVar if an instruction addresses 0x00FE
+    bool isRandomAddress(uint16_t address);               // 0x00FE or one of its RAM mirrors
     bool testPageBoundary(uint8_t addressOffset);         // test if incrementing by offset will pass page boundary
     void incrementProgramCounter(uint16_t addressOffset); // increment by addressOffset
     void setProgramCounter(uint16_t addr);                // set PC to memory[addr]
@@ -98,6 +284,17 @@ class Cpu
     int getSignedRepresentation(uint16_t value);          // convert uint16_t to int
     void pushStack(uint8_t value);                        // push 8 bits onto stack and increment stack pointer
     uint8_t popStack();                                   // pop 8 bits from stack and decrement stack pointer
+    void storeByte(uint8_t *addr, uint8_t value);         // write guest memory or a register, checks for translated code
+    uint8_t loadByte(uint8_t *addr);                      // read guest memory or a register
+    uint16_t loadAddress(uint16_t address);               // little endian pointer at address, read from the bus
+    uint8_t *fetchInstruction(uint16_t address);          // opcode and operand bytes of the instruction at address
+    uint8_t *fetchInstructionBytes(uint16_t address);     // fetchInstruction for instructions that don't sit in one direct page
+    void storeBusByte(uint16_t address, uint8_t value);   // storeByte to a page flagged in codePages
+    void dropCode(uint32_t offset, uint32_t end);         // invalidateCode for one range of bus addresses
+    void linkAliases();                                   // rebuild aliasPages from the Memory bus pages
+    void markCodePage(uint8_t page, uint8_t flag);        // set a cached code flag on the page and its aliases
+    void updatePendingEvents();                           // after breakFlag, I or an interrupt line changed
+    void serviceInterrupt();                              // NMI or IRQ sequence in place of an instruction
 
     // Operation code instructions
     void iBRK(uint8_t *addr);                           // BReaKpoint
@@ -0,0 +1,88 @@
+#include <string.h>
+#include <stdio.h>
+#include "Cpu.hpp"
+#include "Memory.hpp"
+
+// Checks the Memory dirty tracking of internal RAM through every RAM mirror,
+// with the region tracked before and after the mirrors are mapped. Each byte
+// of the region is written with a new value at its address and at each of
+// its mirrors and has to show up in the bitmap, writing the same value again
+// and writing next to the region must not.
+//
+// Prints the mismatches and exits with 1 if there are any.
+
+#define DIRTY_CHECK_FIRST_PAGE  0x02
+#define DIRTY_CHECK_PAGES       0x04
+
+static const uint16_t RegionStart = DIRTY_CHECK_FIRST_PAGE << 8;
+static const uint16_t RegionSize = DIRTY_CHECK_PAGES << 8;
+
+// the bitmap after the write has only the bit of offset set, or nothing if offset is -1
+static uint32_t checkWrite(Memory &memory, const char *order, uint16_t address, uint8_t value, int32_t offset)
+{
+  uint64_t bitmap[Memory::DirtyWords];
+  uint64_t expected[Memory::DirtyWords];
+
+  memory.bus_write(address, value);
+  memset(expected, 0, sizeof(expected));
+  if (offset >= 0)
+  {
+    expected[offset >> 6] = (uint64_t)1 << (offset & 63);
+  }
+
+  memset(bitmap, 0, sizeof(bitmap));
+  bool dirty = memory.take_dirty(bitmap);
+  if (dirty != (offset >= 0) || memcmp(bitmap, expected, sizeof(bitmap)) != 0 || memory.get_memory(address & 0x7FF)[0] != value)
+  {
+    static uint32_t reported = 0;
+    if (reported++ < 5)
+    {
+      printf("%s: write %02x to %04x, dirty %d, expected offset %d\n", order, value, address, dirty, offset);
+    }
+    return 1;
+  }
+
+  return 0;
+}
+
+static uint32_t checkRegion(Memory &memory, const char *order)
+{
+  uint64_t bitmap[Memory::DirtyWords];
+  uint32_t mismatches = 0;
+
+  // everything starts dirty
+  memory.take_dirty(bitmap);
+
+  for (uint16_t mirror = 0x0000; mirror < 0x2000; mirror += 0x0800)
+  {
+    for (uint16_t offset = 0; offset < RegionSize; offset++)
+    {
+      uint8_t value = memory.get_memory(RegionStart + offset)[0] ^ (0x11 + (mirror >> 8));
+      mismatches += checkWrite(memory, order, mirror + RegionStart + offset, value, offset);
+      mismatches += checkWrite(memory, order, mirror + RegionStart + offset, value, -1);
+    }
+
+    mismatches += checkWrite(memory, order, mirror + RegionStart - 1, 0x5A, -1);
+    mismatches += checkWrite(memory, order, mirror + RegionStart + RegionSize, 0xA5, -1);
+  }
+
+  return mismatches;
+}
+
+int main(int argc, char *argv[])
+{
+  uint32_t mismatches = 0;
+
+  Memory trackedFirst;
+  trackedFirst.track_dirty(DIRTY_CHECK_FIRST_PAGE, DIRTY_CHECK_PAGES);
+  trackedFirst.map_ram_mirrors();
+  mismatches += checkRegion(trackedFirst, "tracked before the mirrors");
+
+  Memory mirrorsFirst;
+  mirrorsFirst.map_ram_mirrors();
+  mirrorsFirst.track_dirty(DIRTY_CHECK_FIRST_PAGE, DIRTY_CHECK_PAGES);
+  mismatches += checkRegion(mirrorsFirst, "tracked after the mirrors");
+
+  printf("%u writes through 4 aliases, %u mismatches\n", 2 * 4 * (2 * RegionSize + 2), mismatches);
+  return mismatches ? 1 : 0;
+}
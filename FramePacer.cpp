@@ -0,0 +1,155 @@
+#include "FramePacer.hpp"
+#include <time.h>
+#include <errno.h>
+#ifndef __linux__
+#include <chrono>
+#include <thread>
+#endif
+
+#define NTSC_FRAME_RATE                 60.0988     // 2C02: 341 x 262 dots less the skipped one on odd frames
+#define PAL_FRAME_RATE                  50.0
+
+FramePacer::FramePacer(RomInfo::Region region)
+: mode(ModeRealTime),
+  multiplier(1),
+  rate(NTSC_FRAME_RATE),
+  periodNs(0),
+  startNs(0),
+  frame(0),
+  skipRun(0),
+  renderNext(true)
+{
+  stats = Stats();
+  setRegion(region);
+}
+
+void FramePacer::setRegion(RomInfo::Region region)
+{
+  rate = (region == RomInfo::RegionPal || region == RomInfo::RegionDendy) ? PAL_FRAME_RATE : NTSC_FRAME_RATE;
+  updatePeriod();
+  restart();
+}
+
+void FramePacer::setMode(Mode newMode, uint32_t newMultiplier)
+{
+  mode = newMode;
+  multiplier = (newMultiplier != 0) ? newMultiplier : 1;
+  updatePeriod();
+  restart();
+}
+
+FramePacer::Mode FramePacer::getMode()
+{
+  return mode;
+}
+
+double FramePacer::getFrameRate()
+{
+  return (mode == ModeUnthrottled) ? 0.0 : 1000000000.0 / periodNs;
+}
+
+void FramePacer::updatePeriod()
+{
+  periodNs = 1000000000.0 / (rate * ((mode == ModeFastForward) ? multiplier : 1));
+}
+
+void FramePacer::restart()
+{
+  startNs = now();
+  frame = 0;
+  skipRun = 0;
+  renderNext = true;
+}
+
+bool FramePacer::shouldRender()
+{
+  return renderNext;
+}
+
+void FramePacer::waitFrame()
+{
+  stats.frames++;
+  frame++;
+
+  if (mode == ModeUnthrottled)
+  {
+    return;
+  }
+
+  // from the start of the schedule, not the last wake up, so errors don't add up
+  uint64_t deadline = startNs + (uint64_t)(frame * periodNs);
+  uint64_t current = now();
+
+  if (current > deadline)
+  {
+    uint64_t lateness = current - deadline;
+
+    stats.late++;
+    stats.lateMax = (lateness > stats.lateMax) ? lateness : stats.lateMax;
+
+    // a stall (a debugger, a suspended host) isn't worth catching up
+    if (lateness > MaxLagFrames * periodNs)
+    {
+      stats.resyncs++;
+      restart();
+      return;
+    }
+
+    // the next frame runs straight away, without its output when that's allowed
+    renderNext = mode != ModeRealTime || skipRun == MaxSkippedFrames;
+    skipRun = renderNext ? 0 : skipRun + 1;
+    stats.skipped += renderNext ? 0 : 1;
+    return;
+  }
+
+  renderNext = true;
+  skipRun = 0;
+  sleepUntil(deadline);
+
+  current = now();
+  uint64_t error = (current > deadline) ? current - deadline : 0;
+  stats.slept++;
+  stats.wakeErrorTotal += error;
+  stats.wakeErrorMax = (error > stats.wakeErrorMax) ? error : stats.wakeErrorMax;
+}
+
+const FramePacer::Stats &FramePacer::getStats()
+{
+  return stats;
+}
+
+#ifdef __linux__
+
+uint64_t FramePacer::now()
+{
+  timespec time;
+
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (uint64_t)time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+// absolute, a wake up by a signal goes back to sleep for what is left
+void FramePacer::sleepUntil(uint64_t deadline)
+{
+  timespec time;
+
+  time.tv_sec = deadline / 1000000000;
+  time.tv_nsec = deadline % 1000000000;
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &time, nullptr) == EINTR)
+  {
+  }
+}
+
+#else
+
+uint64_t FramePacer::now()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void FramePacer::sleepUntil(uint64_t deadline)
+{
+  std::this_thread::sleep_until(std::chrono::steady_clock::time_point(std::chrono::nanoseconds(deadline)));
+}
+
+#endif
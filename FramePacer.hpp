@@ -0,0 +1,68 @@
+#ifndef FRAME_PACER_HPP
+#define FRAME_PACER_HPP
+#include <stdint.h>
+#include "RomImage.hpp"
+
+// Host side frame pacing
+//
+// Real-time mode holds emulated frames to the console's rate: frame n is due
+// at start + n periods, an absolute deadline, so oversleeping one frame never
+// pushes the later ones back. A frame that finishes after its deadline has
+// the following ones skip rendering (up to MaxSkippedFrames in a row) while
+// the emulation catches up, and one more than MaxLagFrames behind starts the
+// schedule over from now instead of racing. Fast-forward is the same
+// schedule at multiplier times the rate without skipping, unthrottled never
+// waits. Nothing here changes what the emulated machine does, only when.
+class FramePacer
+{
+  public:
+    enum Mode
+    {
+      ModeRealTime,         // region rate, skips rendering when behind (default)
+      ModeFastForward,      // multiplier times the region rate
+      ModeUnthrottled,      // as fast as the host runs
+    };
+
+    static const uint32_t MaxSkippedFrames = 4;   // rendered at least every 5th frame
+    static const uint32_t MaxLagFrames = 15;      // behind by more restarts the schedule
+
+    struct Stats
+    {
+      uint64_t frames;          // waitFrame calls
+      uint64_t skipped;         // frames shouldRender said not to render
+      uint64_t late;            // frames that finished after their deadline
+      uint64_t resyncs;         // schedule restarted, too far behind
+      uint64_t wakeErrorTotal;  // ns woken after the deadline, summed over frames that slept
+      uint64_t wakeErrorMax;
+      uint64_t slept;           // frames that slept
+      uint64_t lateMax;         // ns the latest frame finished after its deadline
+    };
+
+    FramePacer(RomInfo::Region region = RomInfo::RegionNtsc);
+
+    void setRegion(RomInfo::Region region);       // NTSC 60.0988 Hz, PAL and Dendy 50 Hz
+    void setMode(Mode mode, uint32_t multiplier = 1);
+    Mode getMode();
+    double getFrameRate();                        // frames per second the current mode aims for, 0 unthrottled
+
+    void restart();                               // the next frame is due one period from now
+    bool shouldRender();                          // false while catching up, the frame may skip its output
+    void waitFrame();                             // a frame is done: sleep until it is due
+    const Stats &getStats();
+
+  private:
+    Mode mode;
+    uint32_t multiplier;
+    double rate;                                  // region frames per second
+    double periodNs;                              // of the current mode
+    uint64_t startNs;                             // frame 0 of the schedule was due here
+    uint64_t frame;                               // frames done since startNs
+    uint32_t skipRun;                             // frames skipped in a row
+    bool renderNext;
+    Stats stats;
+
+    static uint64_t now();                        // monotonic ns
+    static void sleepUntil(uint64_t deadline);
+    void updatePeriod();
+};
+#endif
@@ -0,0 +1,386 @@
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <vector>
+#include "Cpu.hpp"
+#include "Memory.hpp"
+#include "Mapper.hpp"
+#include "RomDatabase.hpp"
+#include "Ppu2C02.hpp"
+#include "Scheduler.hpp"
+#include "FramePacer.hpp"
+
+// Runs a ROM or a raw 6502 program for a number of frames or cycles as fast
+// as the host allows and prints where it ended up. Nothing here touches SDL,
+// it links only the emulation core.
+//
+//   Headless.exe --rom game.nes [--frames N | --cycles N]
+//   Headless.exe --rom game.nes --database roms.db [--hash-cache roms.cache]
+//   Headless.exe --program snake.bin [--address 0x600] [--frames N | --cycles N]
+//   Headless.exe --program checks/mirrors.hex --address 0x8000 --mirrors
+//
+// Both run on the master clock Scheduler. A ROM runs through the 2C02 a
+// frame at a time from its reset vector, so --cycles stops at the end of the
+// frame that reaches it. A raw program is loaded at --address (default
+// $0600) and started there, a frame is the same stretch of master clock
+// without a PPU, and all of memory is plain RAM unless --mirrors maps the
+// $0800-$1FFF RAM mirrors and $2000-$3FFF register bytes. A file ending in
+// .hex, for either, is a listing: hex bytes, ';' comments and "@offset" to
+// skip ahead (the gap is zero). --database corrects the ROM header with the
+// RomDatabase entry of the ROM, --hash-cache keeps the ROM hashes between
+// runs and is written back on exit. Idle loops are skipped unless
+// --no-idle-skip is given. --realtime paces frames at the ROM's region rate
+// (NTSC for a raw program) and --fast-forward N at N times it, both add the
+// pacer's statistics. The results are "name value" lines: counts,
+// registers, and FNV-1a hashes of internal RAM and, for a ROM, the last
+// frame, so runs can be compared with diff.
+
+#define HEADLESS_FRAMES           60
+#define HEADLESS_PROGRAM_ADDRESS  0x0600
+#define HEADLESS_RAM_SIZE         0x0800
+
+static const uint64_t FrameTicks = (uint64_t)Ppu2C02::DotsPerScanline * Ppu2C02::ScanlinesPerFrame * Scheduler::PpuDivider;
+
+// FNV-1a
+static uint32_t hashBytes(const uint8_t *bytes, size_t size)
+{
+  uint32_t hash = 2166136261u;
+
+  for (size_t i = 0; i < size; i++)
+  {
+    hash = (hash ^ bytes[i]) * 16777619u;
+  }
+
+  return hash;
+}
+
+static bool isListing(const char *fileName)
+{
+  size_t length = strlen(fileName);
+  return length > 4 && strcmp(fileName + length - 4, ".hex") == 0;
+}
+
+// the checks keep their programs and ROMs as listings so they can be read and diffed
+static bool readListing(const char *fileName, std::vector<uint8_t> &image)
+{
+  FILE *infile = fopen(fileName, "r");
+  char token[64];
+
+  if (!infile)
+  {
+    return false;
+  }
+
+  image.clear();
+  while (fscanf(infile, " %63s", token) == 1)
+  {
+    char *end;
+    if (token[0] == ';')
+    {
+      fscanf(infile, "%*[^\n]");
+    }
+    else if (token[0] == '@')
+    {
+      size_t offset = strtoul(token + 1, &end, 16);
+      if (*end != '\0' || offset < image.size())
+      {
+        break;
+      }
+      image.resize(offset, 0);
+    }
+    else
+    {
+      unsigned long value = strtoul(token, &end, 16);
+      if (*end != '\0' || value > 0xFF)
+      {
+        break;
+      }
+      image.push_back((uint8_t)value);
+    }
+  }
+
+  bool complete = feof(infile) != 0;
+  fclose(infile);
+  return complete && !image.empty();
+}
+
+static bool loadProgram(Memory &memory, const char *fileName, uint16_t address)
+{
+  std::vector<uint8_t> program;
+  size_t room = 0x10000 - address;
+
+  if (isListing(fileName))
+  {
+    if (!readListing(fileName, program))
+    {
+      return false;
+    }
+  }
+  else
+  {
+    FILE *infile = fopen(fileName, "rb");
+    if (!infile)
+    {
+      return false;
+    }
+
+    program.resize(room);
+    program.resize(fread(program.data(), 1, room, infile));
+    fclose(infile);
+  }
+
+  size_t size = (program.size() < room) ? program.size() : room;
+  if (size > 0xFFFF)
+  {
+    size = 0xFFFF;
+  }
+
+  memory.set_memory(address, program.data(), (uint16_t)size);
+  return size != 0;
+}
+
+// RomImage maps files, a listing goes through a temporary one that is gone once it's open
+static RomImage::Error loadRom(Memory &memory, const char *fileName, RomDatabase *database)
+{
+  if (!isListing(fileName))
+  {
+    return memory.loadRom(fileName, database);
+  }
+
+  std::vector<uint8_t> rom;
+  char tempName[] = "/tmp/headless-rom-XXXXXX";
+  int fd = readListing(fileName, rom) ? mkstemp(tempName) : -1;
+
+  if (fd < 0)
+  {
+    return RomImage::ErrorOpen;
+  }
+
+  bool written = write(fd, rom.data(), rom.size()) == (ssize_t)rom.size();
+  close(fd);
+
+  RomImage::Error error = written ? memory.loadRom(tempName, database) : RomImage::ErrorOpen;
+  unlink(tempName);
+  return error;
+}
+
+static bool parseEngine(const char *name, Cpu::Engine &engine)
+{
+  static const struct
+  {
+    const char *name;
+    Cpu::Engine engine;
+  } engines[] =
+  {
+    { "table",      Cpu::EngineTable     },
+    { "switch",     Cpu::EngineSwitch    },
+    { "fused",      Cpu::EngineFused     },
+    { "jit",        Cpu::EngineJit       },
+    { "predecode",  Cpu::EnginePredecode },
+  };
+
+  for (size_t i = 0; i < sizeof(engines) / sizeof(engines[0]); i++)
+  {
+    if (strcmp(name, engines[i].name) == 0)
+    {
+      engine = engines[i].engine;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+static int usage(const char *name)
+{
+  printf("usage: %s (--rom FILE [--database FILE] [--hash-cache FILE] | --program FILE [--address N] [--mirrors])\n"
+         "       [--frames N | --cycles N]\n"
+         "       [--engine table|switch|fused|jit|predecode] [--seed N] [--no-idle-skip]\n"
+         "       [--realtime | --fast-forward N]\n", name);
+  return 2;
+}
+
+int main(int argc, char *argv[])
+{
+  typedef std::chrono::high_resolution_clock Time;
+  const char *romFileName = nullptr;
+  const char *programFileName = nullptr;
+  const char *databaseFileName = nullptr;
+  const char *hashCacheFileName = nullptr;
+  uint16_t address = HEADLESS_PROGRAM_ADDRESS;
+  uint64_t frames = HEADLESS_FRAMES;
+  uint64_t cycles = 0;
+  uint32_t seed = Cpu::RandomDefaultSeed;
+  Cpu::Engine engine = Cpu::EngineFused;
+  bool idleSkip = true;
+  bool mirrors = false;
+  FramePacer::Mode pace = FramePacer::ModeUnthrottled;
+  uint32_t multiplier = 1;
+
+  for (int i = 1; i < argc; i++)
+  {
+    bool hasValue = i + 1 < argc;
+
+    if (strcmp(argv[i], "--rom") == 0 && hasValue)
+      romFileName = argv[++i];
+    else if (strcmp(argv[i], "--database") == 0 && hasValue)
+      databaseFileName = argv[++i];
+    else if (strcmp(argv[i], "--hash-cache") == 0 && hasValue)
+      hashCacheFileName = argv[++i];
+    else if (strcmp(argv[i], "--program") == 0 && hasValue)
+      programFileName = argv[++i];
+    else if (strcmp(argv[i], "--address") == 0 && hasValue)
+      address = (uint16_t)strtoul(argv[++i], nullptr, 0);
+    else if (strcmp(argv[i], "--frames") == 0 && hasValue)
+      frames = strtoull(argv[++i], nullptr, 0);
+    else if (strcmp(argv[i], "--cycles") == 0 && hasValue)
+      cycles = strtoull(argv[++i], nullptr, 0);
+    else if (strcmp(argv[i], "--seed") == 0 && hasValue)
+      seed = strtoul(argv[++i], nullptr, 0);
+    else if (strcmp(argv[i], "--engine") == 0 && hasValue && parseEngine(argv[i + 1], engine))
+      i++;
+    else if (strcmp(argv[i], "--mirrors") == 0)
+      mirrors = true;
+    else if (strcmp(argv[i], "--no-idle-skip") == 0)
+      idleSkip = false;
+    else if (strcmp(argv[i], "--realtime") == 0)
+      pace = FramePacer::ModeRealTime;
+    else if (strcmp(argv[i], "--fast-forward") == 0 && hasValue)
+    {
+      pace = FramePacer::ModeFastForward;
+      multiplier = strtoul(argv[++i], nullptr, 0);
+    }
+    else
+      return usage(argv[0]);
+  }
+
+  if ((romFileName == nullptr) == (programFileName == nullptr)
+      || (romFileName == nullptr && (databaseFileName || hashCacheFileName)))
+  {
+    return usage(argv[0]);
+  }
+
+  // --cycles wins over --frames
+  uint64_t endTime = frames * FrameTicks;
+  if (cycles != 0)
+  {
+    endTime = cycles * Scheduler::CpuDivider;
+    frames = (endTime + FrameTicks - 1) / FrameTicks;
+  }
+
+  RomDatabase database;
+  if (databaseFileName && !database.load(databaseFileName))
+  {
+    printf("%s: can't read database\n", databaseFileName);
+    return 1;
+  }
+
+  // a missing cache is created on exit
+  if (hashCacheFileName)
+  {
+    database.loadHashCache(hashCacheFileName);
+  }
+
+  Memory memory;
+  Cpu cpu;
+  Scheduler scheduler(&cpu);
+  Ppu2C02 *ppu = nullptr;
+  cpu.setMemory(&memory);
+  memory.set_cpu(&cpu);
+  cpu.setEngine(engine);
+  if (cpu.getEngine() != engine)
+  {
+    fprintf(stderr, "jit not available on this host, using the fused engine\n");
+  }
+  cpu.setRandomSeed(seed);
+  cpu.setIdleLoopSkip(idleSkip);
+
+  if (romFileName)
+  {
+    ppu = new Ppu2C02(&memory);
+    ppu->attach(&scheduler);
+    RomImage::Error error = loadRom(memory, romFileName, databaseFileName ? &database : nullptr);
+    if (error != RomImage::ErrorNone)
+    {
+      printf("%s: %s\n", romFileName, RomImage::getErrorString(error));
+      delete ppu;
+      return 1;
+    }
+    cpu.reset();
+  }
+  else if (!loadProgram(memory, programFileName, address))
+  {
+    printf("%s: can't read program\n", programFileName);
+    return 1;
+  }
+  else
+  {
+    if (mirrors)
+    {
+      memory.map_ram_mirrors();
+      memory.map_ppu_registers(nullptr, nullptr, nullptr);
+    }
+    cpu.setPc(address);
+  }
+
+  FramePacer pacer(ppu ? memory.get_rom_info().region : RomInfo::RegionNtsc);
+  pacer.setMode(pace, multiplier);
+  auto startTime = Time::now();
+
+  for (uint64_t frame = 0; frame < frames; frame++)
+  {
+    if (ppu)
+    {
+      ppu->runFrame();
+    }
+    else
+    {
+      uint64_t frameEnd = (frame + 1) * FrameTicks;
+      scheduler.run((frameEnd < endTime) ? frameEnd : endTime);
+    }
+    pacer.waitFrame();
+  }
+
+  double seconds = std::chrono::duration<double>(Time::now() - startTime).count();
+
+  printf("frames %llu\n", (unsigned long long)frames);
+  uint64_t cyclesRun = scheduler.getCpuCycles();
+  printf("cycles %llu\n", (unsigned long long)cyclesRun);
+  printf("instructions %llu\n", (unsigned long long)cpu.getInstructionCount());
+  printf("idle-skipped %llu\n", (unsigned long long)cpu.getIdleSkippedCycles());
+  printf("interrupts %llu\n", (unsigned long long)cpu.getInterruptCount());
+  printf("pc %04x\n", cpu.getProgramCounter());
+  printf("a %02x\n", cpu.getA());
+  printf("x %02x\n", cpu.getX());
+  printf("y %02x\n", cpu.getY());
+  printf("sp %02x\n", cpu.getStackPointer());
+  printf("p %02x\n", cpu.getFlags());
+  printf("ram %08x\n", hashBytes(memory.get_memory(0), HEADLESS_RAM_SIZE));
+  if (ppu)
+  {
+    printf("frame %08x\n", hashBytes(ppu->getFrame(), Ppu2C02::Width * Ppu2C02::Height));
+  }
+  printf("seconds %.3f\n", seconds);
+  printf("mhz %.2f\n", (seconds > 0) ? cyclesRun / seconds / 1000000.0 : 0.0);
+  if (pace != FramePacer::ModeUnthrottled)
+  {
+    const FramePacer::Stats &pacing = pacer.getStats();
+    printf("frame-rate %.4f\n", pacer.getFrameRate());
+    printf("late-frames %llu\n", (unsigned long long)pacing.late);
+    printf("resyncs %llu\n", (unsigned long long)pacing.resyncs);
+    printf("wake-error-mean-us %.1f\n", pacing.slept ? pacing.wakeErrorTotal / 1000.0 / pacing.slept : 0.0);
+    printf("wake-error-max-us %.1f\n", pacing.wakeErrorMax / 1000.0);
+  }
+
+  // the hash of a listing is cached under its temporary file, which is gone
+  if (hashCacheFileName && !isListing(romFileName) && !database.saveHashCache(hashCacheFileName))
+  {
+    printf("%s: can't write hash cache\n", hashCacheFileName);
+  }
+
+  delete ppu;
+  return 0;
+}
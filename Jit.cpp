@@ -0,0 +1,1151 @@
+#include "Jit.hpp"
+#include "Cpu.hpp"
+#include "Memory.hpp"
+#include <string.h>
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__))
+#define JIT_X86_64
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#ifdef JIT_X86_64
+
+// Host registers while a block runs
+//   rbx: JitContext *
+//   r12: guest memory base
+//   r13d, r14d, r15d: guest A, X, Y (always zero extended 0x00 -> 0xFF)
+//   ebp: guest status register NVss DIZC
+// All of them are callee-saved, so helper calls leave them alone.
+enum HostRegister
+{
+  EAX = 0, ECX = 1, EDX = 2, EBX = 3, ESP = 4, EBP = 5, ESI = 6, EDI = 7,
+  R12 = 12, R13 = 13, R14 = 14, R15 = 15,
+};
+
+#define GUEST_A R13
+#define GUEST_X R14
+#define GUEST_Y R15
+
+// 0x81 /ext group
+enum AluExtension
+{
+  AluAdd = 0, AluOr = 1, AluAnd = 4, AluSub = 5, AluXor = 6, AluCmp = 7,
+};
+
+// condition codes for jcc
+enum Condition
+{
+  ConditionAboveEqual = 0x3, ConditionZero = 0x4, ConditionNotZero = 0x5, ConditionLessEqual = 0xE,
+};
+
+#define CONTEXT_OFFSET(field) ((uint8_t)offsetof(JitContext, field))
+static_assert(sizeof(JitContext) <= 0x80, "JitContext fields are addressed with 8 bit displacements");
+
+class Emitter
+{
+  public:
+    Emitter(uint8_t *start) : code(start) {}
+
+    uint8_t *code;
+
+    void byte(uint8_t value)
+    {
+      *code++ = value;
+    }
+
+    void dword(uint32_t value)
+    {
+      memcpy(code, &value, sizeof(value));
+      code += sizeof(value);
+    }
+
+    void qword(uint64_t value)
+    {
+      memcpy(code, &value, sizeof(value));
+      code += sizeof(value);
+    }
+
+    void rex(bool wide, int reg, int rm)
+    {
+      uint8_t prefix = 0x40 | (wide << 3) | ((reg >= 8) << 2) | (rm >= 8);
+      if (prefix != 0x40)
+      {
+        byte(prefix);
+      }
+    }
+
+    void modrm(uint8_t mod, int reg, int rm)
+    {
+      byte((mod << 6) | ((reg & 7) << 3) | (rm & 7));
+    }
+
+    // op dst32, src32 for add/or/and/xor/cmp/mov/test (0x01, 0x09, 0x21, 0x31, 0x39, 0x89, 0x85)
+    void aluRegReg(uint8_t opcode, int dst, int src)
+    {
+      rex(false, src, dst);
+      byte(opcode);
+      modrm(3, src, dst);
+    }
+
+    void movRegReg(int dst, int src)
+    {
+      aluRegReg(0x89, dst, src);
+    }
+
+    void testRegReg(int dst, int src)
+    {
+      aluRegReg(0x85, dst, src);
+    }
+
+    void aluRegImm(AluExtension extension, int dst, uint32_t value)
+    {
+      rex(false, 0, dst);
+      byte(0x81);
+      modrm(3, extension, dst);
+      dword(value);
+    }
+
+    void movRegImm(int dst, uint32_t value)
+    {
+      rex(false, 0, dst);
+      byte(0xB8 | (dst & 7));
+      dword(value);
+    }
+
+    // shl/shr dst32, count (0xC1 /4, /5)
+    void shiftRegImm(bool right, int dst, uint8_t count)
+    {
+      rex(false, 0, dst);
+      byte(0xC1);
+      modrm(3, right ? 5 : 4, dst);
+      byte(count);
+    }
+
+    // movzx eax, al / movzx eax, ax
+    void zeroExtendEax(bool word)
+    {
+      byte(0x0F);
+      byte(word ? 0xB7 : 0xB6);
+      modrm(3, EAX, EAX);
+    }
+
+    // movzx dst32, byte [r12 + rax + displacement]
+    void loadGuestByte(int dst, uint8_t displacement)
+    {
+      rex(false, dst, R12);
+      byte(0x0F);
+      byte(0xB6);
+      modrm(displacement ? 1 : 0, dst, 4);
+      byte(0x04);
+      if (displacement)
+      {
+        byte(displacement);
+      }
+    }
+
+    // mov [rbx + offset], src32 / mov dst32, [rbx + offset]
+    void storeContext(uint8_t offset, int src)
+    {
+      rex(false, src, EBX);
+      byte(0x89);
+      modrm(1, src, EBX);
+      byte(offset);
+    }
+
+    void loadContext(int dst, uint8_t offset, bool wide)
+    {
+      rex(wide, dst, EBX);
+      byte(0x8B);
+      modrm(1, dst, EBX);
+      byte(offset);
+    }
+
+    // jcc rel32 / jmp rel32, returns the location to patch
+    uint8_t *jumpIf(Condition condition)
+    {
+      byte(0x0F);
+      byte(0x80 | condition);
+      dword(0);
+      return code - 4;
+    }
+
+    uint8_t *jump()
+    {
+      byte(0xE9);
+      dword(0);
+      return code - 4;
+    }
+
+    void patch(uint8_t *location, uint8_t *target)
+    {
+      int32_t relative = (int32_t)(target - (location + 4));
+      memcpy(location, &relative, sizeof(relative));
+    }
+};
+
+// Supported operations, anything else ends the block
+enum JitOperation
+{
+  JitUnsupported,
+  JitLoad, JitStore, JitAdc, JitSbc, JitAnd, JitOra, JitEor, JitCompare, JitBit,
+  JitIncrementMemory, JitDecrementMemory, JitShiftLeft, JitShiftRight, JitRotateLeft, JitRotateRight,
+  JitTransfer, JitIncrementRegister, JitDecrementRegister, JitSetFlag, JitClearFlag, JitNop,
+  JitPush, JitPull, JitBranch, JitJump,
+};
+
+struct JitInstruction
+{
+  JitOperation operation;
+  int reg;              // register loaded, stored, compared or changed
+  int source;           // source register for transfers
+  uint32_t mask;        // status bit for flag operations and branches
+  bool branchIfSet;     // branch when the status bit is set
+};
+
+static JitInstruction classify(uint8_t opcode)
+{
+  JitInstruction instruction = { JitUnsupported, 0, 0, 0, false };
+
+  switch (opcode)
+  {
+    case 0xA9: case 0xA5: case 0xB5: case 0xAD: case 0xBD: case 0xB9: case 0xA1: case 0xB1:
+      instruction.operation = JitLoad; instruction.reg = GUEST_A; break;
+    case 0xA2: case 0xA6: case 0xB6: case 0xAE: case 0xBE:
+      instruction.operation = JitLoad; instruction.reg = GUEST_X; break;
+    case 0xA0: case 0xA4: case 0xB4: case 0xAC: case 0xBC:
+      instruction.operation = JitLoad; instruction.reg = GUEST_Y; break;
+    case 0x85: case 0x95: case 0x8D: case 0x9D: case 0x99: case 0x81: case 0x91:
+      instruction.operation = JitStore; instruction.reg = GUEST_A; break;
+    case 0x86: case 0x96: case 0x8E:
+      instruction.operation = JitStore; instruction.reg = GUEST_X; break;
+    case 0x84: case 0x94: case 0x8C:
+      instruction.operation = JitStore; instruction.reg = GUEST_Y; break;
+    case 0x69: case 0x65: case 0x75: case 0x6D: case 0x7D: case 0x79: case 0x61: case 0x71:
+      instruction.operation = JitAdc; break;
+    case 0xE9: case 0xE5: case 0xF5: case 0xED: case 0xFD: case 0xF9: case 0xE1: case 0xF1:
+      instruction.operation = JitSbc; break;
+    case 0x29: case 0x25: case 0x35: case 0x2D: case 0x3D: case 0x39: case 0x21: case 0x31:
+      instruction.operation = JitAnd; break;
+    case 0x09: case 0x05: case 0x15: case 0x0D: case 0x1D: case 0x19: case 0x01: case 0x11:
+      instruction.operation = JitOra; break;
+    case 0x49: case 0x45: case 0x55: case 0x4D: case 0x5D: case 0x59: case 0x41: case 0x51:
+      instruction.operation = JitEor; break;
+    case 0xC9: case 0xC5: case 0xD5: case 0xCD: case 0xDD: case 0xD9: case 0xC1: case 0xD1:
+      instruction.operation = JitCompare; instruction.reg = GUEST_A; break;
+    case 0xE0: case 0xE4: case 0xEC:
+      instruction.operation = JitCompare; instruction.reg = GUEST_X; break;
+    case 0xC0: case 0xC4: case 0xCC:
+      instruction.operation = JitCompare; instruction.reg = GUEST_Y; break;
+    case 0x24: case 0x2C:
+      instruction.operation = JitBit; break;
+    case 0xE6: case 0xF6: case 0xEE: case 0xFE:
+      instruction.operation = JitIncrementMemory; break;
+    case 0xC6: case 0xD6: case 0xCE: case 0xDE:
+      instruction.operation = JitDecrementMemory; break;
+    case 0x0A: instruction.operation = JitShiftLeft; break;
+    case 0x4A: instruction.operation = JitShiftRight; break;
+    case 0x2A: instruction.operation = JitRotateLeft; break;
+    case 0x6A: instruction.operation = JitRotateRight; break;
+    case 0xAA: instruction.operation = JitTransfer; instruction.reg = GUEST_X; instruction.source = GUEST_A; break;
+    case 0xA8: instruction.operation = JitTransfer; instruction.reg = GUEST_Y; instruction.source = GUEST_A; break;
+    case 0x8A: instruction.operation = JitTransfer; instruction.reg = GUEST_A; instruction.source = GUEST_X; break;
+    case 0x98: instruction.operation = JitTransfer; instruction.reg = GUEST_A; instruction.source = GUEST_Y; break;
+    case 0xE8: instruction.operation = JitIncrementRegister; instruction.reg = GUEST_X; break;
+    case 0xC8: instruction.operation = JitIncrementRegister; instruction.reg = GUEST_Y; break;
+    case 0xCA: instruction.operation = JitDecrementRegister; instruction.reg = GUEST_X; break;
+    case 0x88: instruction.operation = JitDecrementRegister; instruction.reg = GUEST_Y; break;
+    case 0x18: instruction.operation = JitClearFlag; instruction.mask = Cpu::carryMask; break;
+    case 0x38: instruction.operation = JitSetFlag; instruction.mask = Cpu::carryMask; break;
+    case 0xB8: instruction.operation = JitClearFlag; instruction.mask = Cpu::overflowMask; break;
+    case 0xD8: instruction.operation = JitClearFlag; instruction.mask = Cpu::decimalMask; break;
+    case 0xF8: instruction.operation = JitSetFlag; instruction.mask = Cpu::decimalMask; break;
+    case 0x58: instruction.operation = JitClearFlag; instruction.mask = Cpu::interruptMask; break;
+    case 0x78: instruction.operation = JitSetFlag; instruction.mask = Cpu::interruptMask; break;
+    case 0xEA: instruction.operation = JitNop; break;
+    case 0x48: instruction.operation = JitPush; break;
+    case 0x68: instruction.operation = JitPull; break;
+    case 0x10: instruction.operation = JitBranch; instruction.mask = Cpu::negativeMask; break;
+    case 0x30: instruction.operation = JitBranch; instruction.mask = Cpu::negativeMask; instruction.branchIfSet = true; break;
+    case 0x50: instruction.operation = JitBranch; instruction.mask = Cpu::overflowMask; break;
+    case 0x70: instruction.operation = JitBranch; instruction.mask = Cpu::overflowMask; instruction.branchIfSet = true; break;
+    case 0x90: instruction.operation = JitBranch; instruction.mask = Cpu::carryMask; break;
+    case 0xB0: instruction.operation = JitBranch; instruction.mask = Cpu::carryMask; instruction.branchIfSet = true; break;
+    case 0xD0: instruction.operation = JitBranch; instruction.mask = Cpu::zeroMask; break;
+    case 0xF0: instruction.operation = JitBranch; instruction.mask = Cpu::zeroMask; instruction.branchIfSet = true; break;
+    case 0x4C: instruction.operation = JitJump; break;
+  }
+
+  return instruction;
+}
+
+// Block exit in front of an instruction that needs the Cpu, which runs it
+// instead: a store into cached code or an access to a handler page
+struct SideExit
+{
+  uint8_t *location;
+  uint16_t pc;
+  uint32_t cycles;
+  uint32_t instructions;
+};
+
+class BlockEmitter : public Emitter
+{
+  public:
+    BlockEmitter(uint8_t *start, uint8_t *exit, void (*random)(JitContext *)) : Emitter(start), exitCode(exit), randomCode(random) {}
+
+    uint8_t *exitCode;
+    void (*randomCode)(JitContext *context);
+    SideExit instructionExit;                 // side exit of the instruction being translated
+    std::vector<SideExit> sideExits;
+
+    // new random value at $FE, keeps the address in eax
+    void random()
+    {
+      // push rax twice (keeps the call aligned); mov rdi, rbx; mov rax, randomCode; call rax; pop rax twice
+      byte(0x50);
+      byte(0x50);
+      rex(true, EBX, EDI);
+      byte(0x89);
+      modrm(3, EBX, EDI);
+      byte(0x48);
+      byte(0xB8);
+      qword((uint64_t)(uintptr_t)randomCode);
+      byte(0xFF);
+      modrm(3, 2, EAX);
+      byte(0x58);
+      byte(0x58);
+    }
+
+    // same as Cpu::updateRandomVar for the address in eax: $xxFE on a page the
+    // bus maps onto page 0 (page 0 itself or a RAM mirror)
+    void randomHook()
+    {
+      byte(0x3C);   // cmp al, 0xFE
+      byte(Cpu::RandomAddress);
+      uint8_t *notRandom = jumpIf(ConditionNotZero);
+
+      // mov edx, eax; shr edx, 8; mov rsi, [rbx + readPages]; cmp r12, [rsi + rdx * 8]
+      movRegReg(EDX, EAX);
+      shiftRegImm(true, EDX, 8);
+      loadContext(ESI, CONTEXT_OFFSET(readPages), true);
+      rex(true, R12, 0);
+      byte(0x3B);
+      modrm(0, R12, 4);
+      byte(0xD6);
+      uint8_t *otherPage = jumpIf(ConditionNotZero);
+
+      random();
+      patch(notRandom, code);
+      patch(otherPage, code);
+    }
+
+    // guest N and Z from a zero extended byte in reg, clobbers ecx
+    void setNegativeZero(int reg, bool negative)
+    {
+      aluRegImm(AluAnd, EBP, negative ? 0x7D : 0xFD);
+      testRegReg(reg, reg);
+      byte(0x75);   // jnz over the or
+      byte(0x06);
+      aluRegImm(AluOr, EBP, Cpu::zeroMask);
+
+      if (negative)
+      {
+        movRegReg(ECX, reg);
+        aluRegImm(AluAnd, ECX, Cpu::negativeMask);
+        aluRegReg(0x09, EBP, ECX);
+      }
+    }
+
+    // guest C from bit 8 of eax, clobbers edx
+    void setCarryFromBit8()
+    {
+      aluRegImm(AluAnd, EBP, 0xFF & ~Cpu::carryMask);
+      movRegReg(EDX, EAX);
+      shiftRegImm(true, EDX, 8);
+      aluRegImm(AluAnd, EDX, 1);
+      aluRegReg(0x09, EBP, EDX);
+    }
+
+    // effective address of the operand in eax, mirrors Memory::Address*
+    bool address(uint8_t mode, const uint8_t *operand)
+    {
+      if (!effectiveAddress(mode, operand))
+      {
+        return false;
+      }
+
+      // constant addresses only need the hook when they are $FE or a $xxFE that may be its mirror
+      if (mode == Memory::DirectZeroZ || mode == Memory::DirectAbsoluteZ)
+      {
+        uint16_t constant = (mode == Memory::DirectZeroZ) ? operand[0] : (operand[0] | (operand[1] << 8));
+        if (constant == Cpu::RandomAddress)
+        {
+          random();
+        }
+        else if ((constant & 0xFF) == Cpu::RandomAddress)
+        {
+          randomHook();
+        }
+      }
+      else
+      {
+        randomHook();
+      }
+
+      return true;
+    }
+
+    bool effectiveAddress(uint8_t mode, const uint8_t *operand)
+    {
+      switch (mode)
+      {
+        case Memory::DirectZeroZ:
+          movRegImm(EAX, operand[0]);
+          return true;
+        case Memory::DirectAbsoluteZ:
+          movRegImm(EAX, operand[0] | (operand[1] << 8));
+          return true;
+        case Memory::DirectZeroX:
+        case Memory::DirectZeroY:
+          movRegReg(EAX, (mode == Memory::DirectZeroX) ? GUEST_X : GUEST_Y);
+          aluRegImm(AluAdd, EAX, operand[0]);
+          zeroExtendEax(false);
+          return true;
+        case Memory::DirectAbsoluteX:
+        case Memory::DirectAbsoluteY:
+          movRegReg(EAX, (mode == Memory::DirectAbsoluteX) ? GUEST_X : GUEST_Y);
+          aluRegImm(AluAdd, EAX, operand[0] | (operand[1] << 8));
+          zeroExtendEax(true);
+          return true;
+        case Memory::IndirectZeroX:
+          movRegReg(EAX, GUEST_X);
+          aluRegImm(AluAdd, EAX, operand[0]);
+          zeroExtendEax(false);
+          pointer();
+          return true;
+        case Memory::IndirectZeroIndexY:
+          movRegImm(EAX, operand[0]);
+          pointer();
+          aluRegReg(0x01, EAX, GUEST_Y);
+          zeroExtendEax(true);
+          return true;
+        default:
+          return false;
+      }
+    }
+
+    // eax = memory[eax] | memory[eax + 1] << 8, the second index is not wrapped to the page
+    void pointer()
+    {
+      loadGuestByte(ECX, 1);
+      shiftRegImm(false, ECX, 8);
+      loadGuestByte(EAX, 0);
+      aluRegReg(0x09, EAX, ECX);
+    }
+
+    // operand value in ecx
+    bool operandValue(uint8_t mode, const uint8_t *operand)
+    {
+      if (mode == Memory::Immediate)
+      {
+        movRegImm(ECX, operand[0]);
+        return true;
+      }
+
+      if (!address(mode, operand))
+      {
+        return false;
+      }
+
+      load(ECX, mode, operand);
+      return true;
+    }
+
+    // rsi = Memory bus page of the address in eax and edx = offset in it,
+    // leaves in front of the instruction on a handler page (nullptr)
+    void busPage(uint8_t pagesOffset)
+    {
+      // mov rsi, [rbx + readPages / writePages]; mov rsi, [rsi + rdx * 8]; test rsi, rsi
+      loadContext(ESI, pagesOffset, true);
+      byte(0x48);
+      byte(0x8B);
+      modrm(0, ESI, 4);
+      byte(0xD6);
+      byte(0x48);
+      byte(0x85);
+      modrm(3, ESI, ESI);
+      sideExit(ConditionZero);
+
+      byte(0x0F);   // movzx edx, al
+      byte(0xB6);
+      modrm(3, EDX, EAX);
+    }
+
+    // memory[eax] in reg, pages 0 and 1 are never remapped
+    void load(int reg, uint8_t mode, const uint8_t *operand)
+    {
+      bool fixedPage = mode == Memory::DirectZeroZ || mode == Memory::DirectZeroX || mode == Memory::DirectZeroY
+        || (mode == Memory::DirectAbsoluteZ && operand[1] <= 0x01);
+      if (fixedPage)
+      {
+        loadGuestByte(reg, 0);
+        return;
+      }
+
+      movRegReg(EDX, EAX);
+      shiftRegImm(true, EDX, 8);
+      busPage(CONTEXT_OFFSET(readPages));
+      rex(false, reg, 0);   // movzx reg, byte [rsi + rdx]
+      byte(0x0F);
+      byte(0xB6);
+      modrm(0, reg, 4);
+      byte(0x16);
+    }
+
+    // ecx to memory[eax] through the Memory bus page, a store into cached
+    // code leaves in front of the instruction so the Cpu drops the code
+    void store()
+    {
+      movRegReg(EDX, EAX);
+      shiftRegImm(true, EDX, 8);
+      loadContext(ESI, CONTEXT_OFFSET(codePages), true);
+      byte(0xF6);   // test byte [rsi + rdx], cached code flags
+      modrm(0, 0, 4);
+      byte(0x16);
+      byte(Cpu::CodePageJit | Cpu::CodePagePredecoded | Cpu::CodePageIdleLoop);
+      sideExit(ConditionNotZero);
+
+      busPage(CONTEXT_OFFSET(writePages));
+      byte(0x88);   // mov byte [rsi + rdx], cl
+      modrm(0, ECX, 4);
+      byte(0x16);
+    }
+
+    // jcc to the side exit of the instruction being translated
+    void sideExit(Condition condition)
+    {
+      SideExit exit = instructionExit;
+      exit.location = jumpIf(condition);
+      sideExits.push_back(exit);
+    }
+
+    // runCycles only starts an instruction whose first tick is inside the batch,
+    // leave in front of the first one that isn't so the Cpu stops where the
+    // interpreters do (start is the tick the instruction starts at in the block)
+    void startCheck(uint32_t start)
+    {
+      byte(0x81);   // cmp dword [rbx + ticksLeft], start
+      modrm(1, AluCmp, EBX);
+      byte(CONTEXT_OFFSET(ticksLeft));
+      dword(start);
+      if (start == 0)
+      {
+        patch(jumpIf(ConditionLessEqual), exitCode);
+      }
+      else
+      {
+        sideExit(ConditionLessEqual);
+      }
+    }
+
+    // leave in front of the instruction so the Cpu runs it
+    void sideExitTails()
+    {
+      for (size_t i = 0; i < sideExits.size(); i++)
+      {
+        patch(sideExits[i].location, code);
+        exit(sideExits[i].pc, sideExits[i].cycles, sideExits[i].instructions, false);
+      }
+    }
+
+    // A + value + C in eax (9 bits), value in ecx
+    void addWithCarry()
+    {
+      movRegReg(EAX, GUEST_A);
+      aluRegReg(0x01, EAX, ECX);
+      movRegReg(EDX, EBP);
+      aluRegImm(AluAnd, EDX, Cpu::carryMask);
+      aluRegReg(0x01, EAX, EDX);
+
+      // V: (A ^ result) & (value ^ result) & 0x80
+      movRegReg(EDX, GUEST_A);
+      aluRegReg(0x31, EDX, EAX);
+      aluRegReg(0x31, ECX, EAX);
+      aluRegReg(0x21, EDX, ECX);
+      aluRegImm(AluAnd, EDX, 0x80);
+      shiftRegImm(true, EDX, 1);
+      aluRegImm(AluAnd, EBP, 0xFF & ~Cpu::overflowMask);
+      aluRegReg(0x09, EBP, EDX);
+
+      setCarryFromBit8();
+      zeroExtendEax(false);
+      movRegReg(GUEST_A, EAX);
+      setNegativeZero(GUEST_A, true);
+    }
+
+    // account for the block so far and continue at pc, chaining into its block if one exists
+    void exit(uint16_t pc, uint32_t cycles, uint32_t instructions, bool chain)
+    {
+      rex(false, 0, EBX);
+      byte(0x81);
+      modrm(1, AluAdd, EBX);
+      byte(CONTEXT_OFFSET(cycles));
+      dword(cycles);
+
+      byte(0x81);
+      modrm(1, AluAdd, EBX);
+      byte(CONTEXT_OFFSET(instructions));
+      dword(instructions);
+
+      byte(0xC7);   // mov dword [rbx + pc], imm32
+      modrm(1, 0, EBX);
+      byte(CONTEXT_OFFSET(pc));
+      dword(pc);
+
+      if (chain)
+      {
+        // mov rax, [rbx + entries]; mov rax, [rax + pc * 8]
+        loadContext(EAX, CONTEXT_OFFSET(entries), true);
+        byte(0x48);
+        byte(0x8B);
+        modrm(2, EAX, EAX);
+        dword(pc * sizeof(uint8_t *));
+        rex(true, EAX, EAX);
+        byte(0x85);
+        modrm(3, EAX, EAX);
+        patch(jumpIf(ConditionZero), exitCode);
+
+        byte(0xFF);   // jmp rax
+        modrm(3, 4, EAX);
+      }
+      else
+      {
+        patch(jump(), exitCode);
+      }
+    }
+};
+
+// The code buffer is never writable and executable at once. It is mapped
+// read/write, the pages code is about to be emitted into are made writable
+// and the emitted ones read only and executable again before any of it runs.
+static bool protectCode(uint8_t *start, uint8_t *end, bool writable)
+{
+  static const uintptr_t pageSize = sysconf(_SC_PAGESIZE);
+  uintptr_t first = (uintptr_t)start & ~(pageSize - 1);
+  uintptr_t last = ((uintptr_t)end + pageSize - 1) & ~(pageSize - 1);
+
+  if (first == last)
+  {
+    return true;
+  }
+
+  return mprotect((void *)first, last - first, writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC) == 0;
+}
+
+Jit::Jit()
+: codeBuffer(nullptr),
+  codeEnd(nullptr),
+  exitCode(nullptr),
+  entryCode(nullptr),
+  codePages(nullptr)
+{
+  memset(entries, 0, sizeof(entries));
+  memset(untranslatable, 0, sizeof(untranslatable));
+
+  void *buffer = mmap(nullptr, CodeBufferSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (buffer == MAP_FAILED)
+  {
+    return;
+  }
+
+  codeBuffer = (uint8_t *)buffer;
+  if (!emitEntryAndExit())
+  {
+    disable();
+  }
+}
+
+Jit::~Jit()
+{
+  if (codeBuffer)
+  {
+    munmap(codeBuffer, CodeBufferSize);
+  }
+}
+
+// false if the host doesn't let the code run
+bool Jit::emitEntryAndExit()
+{
+  if (!protectCode(codeBuffer, codeBuffer + 1, true))
+  {
+    return false;
+  }
+
+  Emitter e(codeBuffer);
+
+  // entry(context, block): save callee-saved registers, load guest state, jump to block
+  entryCode = (Entry_T)e.code;
+  e.byte(0x53);                       // push rbx
+  e.byte(0x55);                       // push rbp
+  e.byte(0x41); e.byte(0x54);         // push r12
+  e.byte(0x41); e.byte(0x55);         // push r13
+  e.byte(0x41); e.byte(0x56);         // push r14
+  e.byte(0x41); e.byte(0x57);         // push r15
+  e.byte(0x48); e.byte(0x83); e.byte(0xEC); e.byte(0x08);   // sub rsp, 8 (16 byte aligned calls)
+  e.rex(true, EDI, EBX);              // mov rbx, rdi
+  e.byte(0x89);
+  e.modrm(3, EDI, EBX);
+  e.loadContext(R12, CONTEXT_OFFSET(memory), true);
+  e.loadContext(GUEST_A, CONTEXT_OFFSET(a), false);
+  e.loadContext(GUEST_X, CONTEXT_OFFSET(x), false);
+  e.loadContext(GUEST_Y, CONTEXT_OFFSET(y), false);
+  e.loadContext(EBP, CONTEXT_OFFSET(flags), false);
+  e.byte(0xFF);                       // jmp rsi
+  e.modrm(3, 4, ESI);
+
+  // exit: store guest state and return to Jit::execute
+  exitCode = e.code;
+  e.storeContext(CONTEXT_OFFSET(a), GUEST_A);
+  e.storeContext(CONTEXT_OFFSET(x), GUEST_X);
+  e.storeContext(CONTEXT_OFFSET(y), GUEST_Y);
+  e.storeContext(CONTEXT_OFFSET(flags), EBP);
+  e.byte(0x48); e.byte(0x83); e.byte(0xC4); e.byte(0x08);   // add rsp, 8
+  e.byte(0x41); e.byte(0x5F);         // pop r15
+  e.byte(0x41); e.byte(0x5E);         // pop r14
+  e.byte(0x41); e.byte(0x5D);         // pop r13
+  e.byte(0x41); e.byte(0x5C);         // pop r12
+  e.byte(0x5D);                       // pop rbp
+  e.byte(0x5B);                       // pop rbx
+  e.byte(0xC3);                       // ret
+
+  codeEnd = e.code;
+  return protectCode(codeBuffer, codeEnd, false);
+}
+
+// the host refused to change the code buffer protection, the Cpu interprets from now on
+void Jit::disable()
+{
+  munmap(codeBuffer, CodeBufferSize);
+  codeBuffer = nullptr;
+  memset(entries, 0, sizeof(entries));
+}
+
+bool Jit::isAvailable()
+{
+  return codeBuffer != nullptr;
+}
+
+uint8_t *Jit::translate(Cpu &cpu, uint16_t startPc)
+{
+  if (codeEnd + MaxBlockSize > codeBuffer + CodeBufferSize)
+  {
+    invalidateAll();
+    if (!codeBuffer)
+    {
+      return nullptr;
+    }
+  }
+
+  // the last page of the previous block is writable (not executable) until the block is done
+  if (!protectCode(codeEnd, codeEnd + MaxBlockSize, true))
+  {
+    disable();
+    return nullptr;
+  }
+
+  BlockEmitter e(codeEnd, exitCode, &Jit::generateRandom);
+  uint16_t pc = startPc;
+  uint32_t cycles = 0;
+  uint32_t instructions = 0;
+  bool blockEnded = false;
+
+  // ticks left when the block is entered: cycleBudget - cycles - instructions
+  e.loadContext(EAX, CONTEXT_OFFSET(cycleBudget), false);
+  e.byte(0x2B);   // sub eax, [rbx + cycles]
+  e.modrm(1, EAX, EBX);
+  e.byte(CONTEXT_OFFSET(cycles));
+  e.byte(0x2B);   // sub eax, [rbx + instructions]
+  e.modrm(1, EAX, EBX);
+  e.byte(CONTEXT_OFFSET(instructions));
+  e.storeContext(CONTEXT_OFFSET(ticksLeft), EAX);
+
+  while (!blockEnded && instructions < MaxBlockInstructions)
+  {
+    const uint8_t *bytes = cpu.fetchInstructionBytes(pc);
+    uint8_t opcode = bytes[0];
+    JitInstruction instruction = classify(opcode);
+    uint8_t mode = Memory::AddressModeLookupTable[opcode];
+    const uint8_t *operand = bytes + 1;
+    uint16_t nextPc = pc + Memory::AddressModeSizeTable[mode] + 1;
+    uint8_t baseCycles = Cpu::TimingLookupTable[opcode] % 10;
+
+    if (instruction.operation == JitUnsupported)
+    {
+      break;
+    }
+
+    e.instructionExit = { nullptr, pc, cycles, instructions };
+    e.startCheck(cycles + instructions);
+    cycles += baseCycles;
+    instructions++;
+
+    switch (instruction.operation)
+    {
+      case JitLoad:
+        e.operandValue(mode, operand);
+        e.movRegReg(instruction.reg, ECX);
+        e.setNegativeZero(instruction.reg, true);
+        break;
+
+      case JitStore:
+        e.address(mode, operand);
+        e.movRegReg(ECX, instruction.reg);
+        e.store();
+        break;
+
+      case JitAdc:
+        e.operandValue(mode, operand);
+        e.addWithCarry();
+        break;
+
+      case JitSbc:
+        e.operandValue(mode, operand);
+        e.aluRegImm(AluXor, ECX, 0xFF);
+        e.addWithCarry();
+        break;
+
+      case JitAnd:
+      case JitOra:
+      case JitEor:
+        e.operandValue(mode, operand);
+        e.aluRegReg((instruction.operation == JitAnd) ? 0x21 : (instruction.operation == JitOra) ? 0x09 : 0x31, GUEST_A, ECX);
+        e.setNegativeZero(GUEST_A, true);
+        break;
+
+      case JitCompare:
+        // carry test uses the two's complement of the value, as Cpu::iCMP
+        e.operandValue(mode, operand);
+        e.movRegReg(EAX, instruction.reg);
+        e.byte(0xF7);   // neg ecx
+        e.modrm(3, 3, ECX);
+        e.aluRegImm(AluAnd, ECX, 0xFF);
+        e.aluRegReg(0x01, EAX, ECX);
+        e.setCarryFromBit8();
+        e.zeroExtendEax(false);
+        e.setNegativeZero(EAX, true);
+        break;
+
+      case JitBit:
+        e.operandValue(mode, operand);
+        e.aluRegImm(AluAnd, EBP, 0xFF & ~(Cpu::negativeMask | Cpu::overflowMask | Cpu::zeroMask));
+        e.movRegReg(EAX, ECX);
+        e.aluRegImm(AluAnd, EAX, Cpu::negativeMask | Cpu::overflowMask);
+        e.aluRegReg(0x09, EBP, EAX);
+        e.aluRegReg(0x21, ECX, GUEST_A);
+        e.testRegReg(ECX, ECX);
+        e.byte(0x75);
+        e.byte(0x06);
+        e.aluRegImm(AluOr, EBP, Cpu::zeroMask);
+        break;
+
+      case JitIncrementMemory:
+      case JitDecrementMemory:
+        e.address(mode, operand);
+        e.load(ECX, mode, operand);
+        e.aluRegImm((instruction.operation == JitIncrementMemory) ? AluAdd : AluSub, ECX, 1);
+        e.aluRegImm(AluAnd, ECX, 0xFF);
+        e.movRegReg(ESI, ECX);
+        e.setNegativeZero(ESI, true);
+        e.movRegReg(ECX, ESI);
+        e.store();
+        break;
+
+      case JitShiftLeft:
+      case JitRotateLeft:
+        e.movRegReg(EAX, GUEST_A);
+        e.shiftRegImm(false, EAX, 1);
+        if (instruction.operation == JitRotateLeft)
+        {
+          e.movRegReg(EDX, EBP);
+          e.aluRegImm(AluAnd, EDX, Cpu::carryMask);
+          e.aluRegReg(0x09, EAX, EDX);
+        }
+        e.setCarryFromBit8();
+        e.zeroExtendEax(false);
+        e.movRegReg(GUEST_A, EAX);
+        e.setNegativeZero(GUEST_A, true);
+        break;
+
+      case JitShiftRight:
+      case JitRotateRight:
+        e.movRegReg(EAX, GUEST_A);
+        e.movRegReg(ESI, EAX);
+        e.aluRegImm(AluAnd, ESI, Cpu::carryMask);
+        e.shiftRegImm(true, EAX, 1);
+        if (instruction.operation == JitRotateRight)
+        {
+          e.movRegReg(EDX, EBP);
+          e.aluRegImm(AluAnd, EDX, Cpu::carryMask);
+          e.shiftRegImm(false, EDX, 7);
+          e.aluRegReg(0x09, EAX, EDX);
+        }
+        e.aluRegImm(AluAnd, EBP, 0xFF & ~Cpu::carryMask);
+        e.aluRegReg(0x09, EBP, ESI);
+        e.movRegReg(GUEST_A, EAX);
+        e.setNegativeZero(GUEST_A, true);
+        break;
+
+      case JitTransfer:
+        e.movRegReg(instruction.reg, instruction.source);
+        e.setNegativeZero(instruction.reg, true);
+        break;
+
+      case JitIncrementRegister:
+      case JitDecrementRegister:
+        e.aluRegImm((instruction.operation == JitIncrementRegister) ? AluAdd : AluSub, instruction.reg, 1);
+        e.aluRegImm(AluAnd, instruction.reg, 0xFF);
+        // Cpu::iDEY only updates Z
+        e.setNegativeZero(instruction.reg, !(instruction.operation == JitDecrementRegister && instruction.reg == GUEST_Y));
+        break;
+
+      case JitSetFlag:
+      case JitClearFlag:
+        if (instruction.operation == JitSetFlag)
+        {
+          e.aluRegImm(AluOr, EBP, instruction.mask);
+        }
+        else
+        {
+          e.aluRegImm(AluAnd, EBP, 0xFF & ~instruction.mask);
+        }
+
+        // CLI and SEI go back to Jit::execute, whose setFlags decides if an IRQ is taken now
+        if (instruction.mask == Cpu::interruptMask)
+        {
+          e.exit(nextPc, cycles, instructions, false);
+          blockEnded = true;
+        }
+        break;
+
+      case JitNop:
+        break;
+
+      case JitPush:
+        // as Cpu::pushStack: store at 0x100 + SP, then decrement
+        e.loadContext(EAX, CONTEXT_OFFSET(sp), false);
+        e.aluRegImm(AluOr, EAX, 0x100);
+        e.movRegReg(ECX, GUEST_A);
+        e.store();
+        e.aluRegImm(AluSub, EAX, 1);
+        e.aluRegImm(AluAnd, EAX, 0xFF);
+        e.storeContext(CONTEXT_OFFSET(sp), EAX);
+        break;
+
+      case JitPull:
+        e.loadContext(EAX, CONTEXT_OFFSET(sp), false);
+        e.aluRegImm(AluAdd, EAX, 1);
+        e.aluRegImm(AluAnd, EAX, 0xFF);
+        e.storeContext(CONTEXT_OFFSET(sp), EAX);
+        e.aluRegImm(AluOr, EAX, 0x100);
+        e.loadGuestByte(GUEST_A, 0);
+        e.setNegativeZero(GUEST_A, true);
+        break;
+
+      case JitBranch:
+      {
+        uint16_t target = pc + (int8_t)operand[0] + 2;
+        e.byte(0xF7);   // test ebp, mask
+        e.modrm(3, 0, EBP);
+        e.dword(instruction.mask);
+        uint8_t *taken = e.jumpIf(instruction.branchIfSet ? ConditionNotZero : ConditionZero);
+        e.exit(nextPc, cycles, instructions, true);
+        e.patch(taken, e.code);
+        e.exit(target, cycles + 1, instructions, true);
+        blockEnded = true;
+        break;
+      }
+
+      case JitJump:
+        e.exit(operand[0] | (operand[1] << 8), cycles, instructions, true);
+        blockEnded = true;
+        break;
+
+      default:
+        break;
+    }
+
+    pc = nextPc;
+  }
+
+  if (instructions == 0)
+  {
+    untranslatable[startPc / 8] |= 1 << (startPc % 8);
+    if (!protectCode(codeEnd, codeEnd, false))
+    {
+      disable();
+    }
+    return nullptr;
+  }
+
+  if (!blockEnded)
+  {
+    e.exit(pc, cycles, instructions, true);
+  }
+
+  e.sideExitTails();
+
+  if (!protectCode(codeEnd, e.code, false))
+  {
+    disable();
+    return nullptr;
+  }
+
+  uint8_t *block = codeEnd;
+  codeEnd = e.code;
+  entries[startPc] = block;
+
+  for (unsigned page = startPc >> 8; page <= (unsigned)((pc - 1) & 0xFFFF) >> 8; page++)
+  {
+    pageBlocks[page].push_back(startPc);
+    cpu.markCodePage(page, Cpu::CodePageJit);
+  }
+
+  return block;
+}
+
+uint32_t Jit::execute(Cpu &cpu, uint32_t cycleBudget)
+{
+  uint16_t pc = cpu.pc;
+  uint8_t *block = entries[pc];
+
+  if (!block)
+  {
+    if (!codeBuffer || (untranslatable[pc / 8] & (1 << (pc % 8))))
+    {
+      return 0;
+    }
+
+    block = translate(cpu, pc);
+    if (!block)
+    {
+      return 0;
+    }
+  }
+
+  JitContext context;
+  context.memory = cpu.startAddr;
+  context.readPages = cpu.readPages;
+  context.writePages = cpu.writePages;
+  context.entries = entries;
+  context.codePages = codePages;
+  context.a = cpu.a;
+  context.x = cpu.x;
+  context.y = cpu.y;
+  context.flags = cpu.getFlags();
+  context.pc = pc;
+  context.cycles = 0;
+  context.instructions = 0;
+  context.cycleBudget = cycleBudget;
+  context.sp = cpu.sp;
+  context.cpu = &cpu;
+
+  entryCode(&context, block);
+
+  cpu.a = context.a;
+  cpu.x = context.x;
+  cpu.y = context.y;
+  cpu.setFlags(context.flags);
+  cpu.pc = context.pc;
+  cpu.sp = context.sp;
+  cpu.cycles += context.cycles;
+
+  return context.instructions;
+}
+
+#else
+
+// no translator for this host, the Cpu interprets everything
+
+Jit::Jit()
+: codeBuffer(nullptr),
+  codeEnd(nullptr),
+  exitCode(nullptr),
+  entryCode(nullptr),
+  codePages(nullptr)
+{
+  memset(entries, 0, sizeof(entries));
+  memset(untranslatable, 0, sizeof(untranslatable));
+}
+
+Jit::~Jit()
+{
+}
+
+bool Jit::emitEntryAndExit()
+{
+  return false;
+}
+
+void Jit::disable()
+{
+}
+
+bool Jit::isAvailable()
+{
+  return false;
+}
+
+uint8_t *Jit::translate(Cpu &cpu, uint16_t pc)
+{
+  return nullptr;
+}
+
+uint32_t Jit::execute(Cpu &cpu, uint32_t cycleBudget)
+{
+  return 0;
+}
+
+#endif
+
+// called by translated code that reads or writes $FE
+void Jit::generateRandom(JitContext *context)
+{
+  context->cpu->generateRandomVar();
+}
+
+void Jit::setCodePages(uint8_t *pages)
+{
+  codePages = pages;
+}
+
+void Jit::invalidatePage(uint8_t page)
+{
+  for (size_t i = 0; i < pageBlocks[page].size(); i++)
+  {
+    entries[pageBlocks[page][i]] = nullptr;
+  }
+
+  pageBlocks[page].clear();
+  memset(&untranslatable[page * 256 / 8], 0, 256 / 8);
+
+  if (codePages)
+  {
+    codePages[page] &= ~Cpu::CodePageJit;
+  }
+}
+
+void Jit::invalidateAll()
+{
+  for (unsigned page = 0; page < 256; page++)
+  {
+    invalidatePage(page);
+  }
+
+  memset(entries, 0, sizeof(entries));
+
+  if (codeBuffer && !emitEntryAndExit())
+  {
+    disable();
+  }
+}
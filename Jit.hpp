@@ -0,0 +1,80 @@
+#ifndef JIT_HPP
+#define JIT_HPP
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+class Cpu;
+
+// Guest state handed to translated code. Translated code keeps A, X, Y and
+// the status register in host registers and only reads/writes this struct
+// on block entry and exit.
+struct JitContext
+{
+  uint8_t *memory;          // guest memory, &memory[0x0 -> 0xFFFF]
+  uint8_t *const *readPages;  // Memory bus read pages, nullptr for handler pages
+  uint8_t *const *writePages; // Memory bus write pages, nullptr for handler pages
+  uint8_t **entries;        // translated code for each guest PC, nullptr if none
+  uint8_t *codePages;       // Cpu::CodePageFlags, stores into flagged pages leave the block
+  Cpu *cpu;                 // for Cpu::generateRandomVar
+  uint32_t a;               // Accumulator register
+  uint32_t x;               // X register
+  uint32_t y;               // Y register
+  uint32_t flags;           // status register, NVss DIZC
+  uint32_t pc;              // PC of the next guest instruction
+  uint32_t cycles;          // cycles charged by executed blocks
+  uint32_t instructions;    // guest instructions executed by blocks
+  uint32_t cycleBudget;     // ticks the caller has, instructions only start inside them
+  uint32_t ticksLeft;       // cycleBudget left when the running block was entered
+  uint32_t sp;              // Stack Pointer
+};
+
+// x86-64 basic block translator for the 6502 core
+//
+// A block is translated at the first guest PC that has no code and ends at a
+// branch or JMP, after CLI or SEI so the Cpu sees the new I flag and takes a
+// pending IRQ, or right before an instruction the translator can't handle
+// (JSR, RTS, RTI, BRK, PHP/PLP, 65816 operations, ...). The Cpu interprets
+// those. Blocks chain to each other through the entries table. Each
+// instruction checks it starts inside the cycle budget and leaves the block
+// otherwise, so the jit stops at the same instruction as the interpreters and
+// sees interrupts at the same place. Accesses go through the Memory bus read
+// and write page pointers inline, so banks and mirrors cost the same as any
+// other page. Stores into pages with cached code, and accesses to handler
+// pages, leave the block in front of the instruction so the Cpu runs it (and
+// drops the code it overwrites).
+class Jit
+{
+  public:
+    Jit();
+    ~Jit();
+
+    bool isAvailable();                               // false if translated code can't run on this host
+    uint32_t execute(Cpu &cpu, uint32_t cycleBudget);  // run blocks from the Cpu PC, returns instructions executed
+    void invalidatePage(uint8_t page);                // drop all blocks that use bytes of the given page
+    void invalidateAll();
+
+  private:
+    typedef void (*Entry_T)(JitContext *context, uint8_t *block);
+
+    static const size_t CodeBufferSize = 4 * 1024 * 1024;
+    static const size_t MaxBlockSize = 32 * 1024;     // host bytes reserved for one block (64 INC a, X take ~18K)
+    static const int MaxBlockInstructions = 64;
+
+    uint8_t *codeBuffer;                              // entry, exit, then blocks, never writable and executable at once
+    uint8_t *codeEnd;                                 // next free byte
+    uint8_t *exitCode;                                // common block exit, returns to execute()
+    Entry_T entryCode;                                // loads host registers and jumps to a block
+    uint8_t *entries[0x10000];                        // translated block for each guest PC
+    uint8_t untranslatable[0x10000 / 8];              // PCs that start with an instruction the Jit can't handle
+    std::vector<uint16_t> pageBlocks[256];            // start PC of each block touching the page
+    uint8_t *codePages;                               // owned by the Cpu, shared with its interpreter stores
+
+    friend class Cpu;
+    void setCodePages(uint8_t *pages);
+    uint8_t *translate(Cpu &cpu, uint16_t pc);
+    static void generateRandom(JitContext *context);
+    bool emitEntryAndExit();
+    void disable();
+};
+#endif
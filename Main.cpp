@@ -1,12 +1,85 @@
 #include <iostream>
 #include <string>
 #include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <atomic>
 #include "Ppu.hpp"
 #include "Cpu.hpp"
 #include "Memory.hpp"
+#include "TripleBuffer.hpp"
+#include "Scheduler.hpp"
+#include "Ppu2C02.hpp"
+#include "FramePacer.hpp"
 #include <string.h>
+#include <stdlib.h>
+#include <time.h>
 
-int main()
+// the presenter looks for a new frame at this rate
+#define PRESENT_INTERVAL_NS   16666667
+
+// one NTSC frame of master clock
+#define FRAME_TICKS           ((uint64_t)Ppu2C02::DotsPerScanline * Ppu2C02::ScanlinesPerFrame * Scheduler::PpuDivider)
+#define SNAKE_CPU_SLOWDOWN    100
+
+// one emulated frame of the $0200-$05FF display, dirty includes the bytes
+// changed in frames the presenter dropped
+struct DisplayFrame
+{
+  uint8_t display[Memory::DirtyMaxPages * 0x100];
+  uint64_t dirty[Memory::DirtyWords];
+};
+
+// key presses for the emulation thread, handed over from the main thread,
+// wake also ends a park for a request to exit
+struct InputQueue
+{
+  std::mutex lock;
+  std::condition_variable wake;
+  std::vector<uint8_t> keys;
+  std::atomic<bool> pending;
+};
+
+// nothing in the machine can get the CPU going again: it stopped, or it waits
+// for an interrupt with no event scheduled that could raise one
+static bool isParked(Cpu &cpu, Scheduler &scheduler)
+{
+  Cpu::RunState state = cpu.getRunState();
+
+  return state == Cpu::RunStateStopped
+      || (state == Cpu::RunStateWaiting && scheduler.getNextEventTime() == Scheduler::Never);
+}
+
+// the display with everything written since the last published frame, the
+// changes of a frame the presenter drops go out with the next one
+static void publishFrame(Memory &memory, TripleBuffer<DisplayFrame> &frames, uint64_t *carryDirty)
+{
+  DisplayFrame &frame = frames.getWriteBuffer();
+
+  if (!memory.take_dirty(frame.dirty))
+  {
+    memset(frame.dirty, 0, sizeof(frame.dirty));
+  }
+
+  for (int word = 0; word < Memory::DirtyWords; word++)
+  {
+    frame.dirty[word] |= carryDirty[word];
+  }
+  memcpy(frame.display, memory.get_chr_rom_data(), sizeof(frame.display));
+
+  if (frames.publish())
+  {
+    memcpy(carryDirty, frames.getWriteBuffer().dirty, Memory::DirtyWords * sizeof(uint64_t));
+  }
+  else
+  {
+    memset(carryDirty, 0, Memory::DirtyWords * sizeof(uint64_t));
+  }
+}
+
+int main(int argc, char *argv[])
 {
   typedef std::chrono::high_resolution_clock Time;
   using std::chrono::nanoseconds;
@@ -42,66 +115,201 @@ int main()
   Cpu nes_cpu;
   nes_cpu.setMemory(&nes_memory);
   nes_memory.set_cpu(&nes_cpu);
+  nes_memory.track_dirty(0x02, 0x04);   // $0200-$05FF display
   nes_cpu.setPc(0x0600);
-  // set chrdata
-  nesPpu.SetData(nes_memory.get_chr_rom_data());
-  nesPpu.addPixels();
-
-  auto currentTime = Time::now();
-  bool mRequestExit = SDL_FALSE;
-
-  // (1 sec / 1.789773 mhz) * (1 mhz / 1,000,000 hz) * (1,000,000,000 nanoseconds / 1 second) = nanoseconds / cycle
-  // 1.789773 MHz = 558.73007359 -> ~ 559
-  //
-  // (1 sec / 60 frames) * (1,000,000,000 nanoseconds / 1 second) = nanoseconds / frame
-  // 1,6666,666.6667 -> 1,666,667 ns / frame
-  //
-  nanoseconds frameRate(55873);       // nanoseconds/frame
-  nanoseconds cpuRate(55873);         // nanoseconds/instruction
-  nanoseconds cpuAccumulator(0);
-  nanoseconds frameAccumulator(0);
-  nanoseconds cycleTimer(0);
-
-  while (mRequestExit != SDL_TRUE) 
-  {
-    SDL_Event event;
-    auto newTime = Time::now();
-    nanoseconds cycleTime = duration_cast<nanoseconds>(newTime - currentTime);
 
-    // display
-    if (frameAccumulator < frameRate)
+  // "--seed N" replays the same $FE values, otherwise a new seed every run
+  // "--palette file.pal" replaces the generated NES colours
+  // "--pal" paces frames at 50 Hz instead of 60.0988
+  // "--fast-forward N" runs N times the frame rate, "--unthrottled" flat out
+  uint32_t seed = (uint32_t)time(nullptr);
+  FramePacer pacer;
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
     {
-      frameAccumulator += cycleTime;
+      seed = strtoul(argv[++i], nullptr, 0);
     }
-    else
+    else if (strcmp(argv[i], "--palette") == 0 && i + 1 < argc)
+    {
+      NesPalette nesPalette;
+      const char *fileName = argv[++i];
+      if (nesPalette.load(fileName))
+      {
+        nesPpu.setPalette(nesPalette);
+      }
+      else
+      {
+        printf("%s: not a 64 or 512 colour .pal file\n", fileName);
+      }
+    }
+    else if (strcmp(argv[i], "--pal") == 0)
+    {
+      pacer.setRegion(RomInfo::RegionPal);
+    }
+    else if (strcmp(argv[i], "--fast-forward") == 0 && i + 1 < argc)
     {
-      nesPpu.updatePixels();
-      nesPpu.RenderAll();
-      frameAccumulator -= frameRate;
+      pacer.setMode(FramePacer::ModeFastForward, strtoul(argv[++i], nullptr, 0));
     }
+    else if (strcmp(argv[i], "--unthrottled") == 0)
+    {
+      pacer.setMode(FramePacer::ModeUnthrottled);
+    }
+  }
+  nes_cpu.setRandomSeed(seed);
+  printf("seed: %u\n", seed);
 
-    while (SDL_PollEvent(&event)) 
+  TripleBuffer<DisplayFrame> frames;
+  InputQueue input;
+  std::atomic<bool> mRequestExit(false);
+  std::atomic<bool> emulationParked(false);
+  input.pending = false;
+
+  // Emulation runs on its own thread so a slow present or vsync never holds
+  // up the CPU. Cpu and Memory belong to it, the main thread only sees
+  // finished frames and hands it input.
+  std::thread emulation([&]()
+  {
+    // The snake program was written for a slow machine: its CPU runs at
+    // 1/100 of the NES clock, 17.9 kHz (the old 55873 ns a cycle), while
+    // frames come at the NTSC rate. Everything runs on the master clock, the
+    // pacer only says when the next frame may start.
+    Scheduler scheduler(&nes_cpu, Scheduler::CpuDivider * SNAKE_CPU_SLOWDOWN);
+    uint64_t carryDirty[Memory::DirtyWords] = { 0 };
+    uint64_t frameEnd = 0;
+    pacer.restart();
+
+    while (!mRequestExit.load(std::memory_order_relaxed))
     {
-      if (event.type == SDL_KEYDOWN
-          || event.type == SDL_KEYUP) 
+      frameEnd += FRAME_TICKS;
+      scheduler.run(frameEnd);
+
+      // display, while catching up the changes wait in Memory for a frame that is published
+      if (pacer.shouldRender())
+      {
+        publishFrame(nes_memory, frames, carryDirty);
+      }
+
+      // input is latched between frames
+      if (input.pending.load(std::memory_order_acquire))
       {
-        nes_cpu.handlePlayerInput(&event);
+        std::lock_guard<std::mutex> lock(input.lock);
+        for (uint8_t key : input.keys)
+        {
+          nes_cpu.handlePlayerInput(key);
+        }
+        input.keys.clear();
+        input.pending = false;
       }
 
-      if (event.type == SDL_QUIT) 
+      // Parked after BRK / STP, or WAI without events: get the last frame
+      // out, then sleep until there are keys or an exit instead of running
+      // empty frames
+      if (isParked(nes_cpu, scheduler))
       {
-        mRequestExit = SDL_TRUE;
+        if (!pacer.shouldRender())
+        {
+          publishFrame(nes_memory, frames, carryDirty);
+        }
+
+        std::unique_lock<std::mutex> lock(input.lock);
+        emulationParked.store(true, std::memory_order_release);
+        input.wake.wait(lock, [&]() { return input.pending.load() || mRequestExit.load(); });
+        emulationParked.store(false, std::memory_order_release);
+
+        // the schedule goes on from now, it doesn't catch up the park
+        pacer.restart();
+        continue;
       }
+
+      pacer.waitFrame();
     }
+  });
+
+  // Presenter: SDL events as they come, the newest finished frame once per
+  // present interval. An interval without a new frame is counted as a repeat,
+  // frames the emulation finished in between as dropped. While the emulation
+  // is parked and its last frame is on screen only an event wakes it.
+  nanoseconds presentInterval(PRESENT_INTERVAL_NS);
+  auto nextPresent = Time::now() + presentInterval;
+  uint64_t presented = 0;
+  bool drained = false;
 
-    // cpu catch up
-    while (cpuAccumulator >= cpuRate)
+  while (!mRequestExit)
+  {
+    SDL_Event event;
+    bool idle = drained && emulationParked.load(std::memory_order_acquire);
+    int64_t waitNs = duration_cast<nanoseconds>(nextPresent - Time::now()).count();
+    // rounded up, a 0 ms timeout with time left would only poll
+    int waitMs = (waitNs > 0) ? (int)((waitNs + 999999) / 1000000) : 0;
+
+    if (idle ? SDL_WaitEvent(&event) : SDL_WaitEventTimeout(&event, waitMs))
     {
-      nes_cpu.doInstruction();
-      cpuAccumulator -= cpuRate;
+      do
+      {
+        // SDL key names are upper case, add 0x20 to change to lower case
+        if (event.type == SDL_KEYDOWN)
+        {
+          std::lock_guard<std::mutex> lock(input.lock);
+          input.keys.push_back((*SDL_GetKeyName(event.key.keysym.sym) + 0x20) & 0xFF);
+          input.pending.store(true, std::memory_order_release);
+          input.wake.notify_one();
+        }
+
+        if (event.type == SDL_WINDOWEVENT)
+        {
+          nesPpu.invalidate();
+          drained = false;
+        }
+
+        if (event.type == SDL_QUIT)
+        {
+          std::lock_guard<std::mutex> lock(input.lock);
+          mRequestExit = true;
+          input.wake.notify_one();
+        }
+      }
+      while (SDL_PollEvent(&event));
+      continue;
     }
 
-    currentTime = newTime;
-    cpuAccumulator += cycleTime;
+    auto now = Time::now();
+    if (now < nextPresent)
+    {
+      continue;
+    }
+
+    // back from an idle wait, don't present the intervals it slept through
+    nextPresent = (now - nextPresent > presentInterval) ? now + presentInterval : nextPresent + presentInterval;
+
+    // parked is published after the last frame, nothing new then means it's on screen
+    bool parked = emulationParked.load(std::memory_order_acquire);
+    if (frames.take())
+    {
+      const DisplayFrame &frame = frames.getReadBuffer();
+      nesPpu.SetData((uint8_t *)frame.display);
+      nesPpu.updatePixels(frame.dirty);
+      drained = false;
+    }
+    else
+    {
+      drained = parked;
+    }
+
+    // unchanged frames aren't uploaded or presented
+    if (nesPpu.RenderAll())
+    {
+      presented++;
+    }
   }
+
+  emulation.join();
+  printf("frames presented: %llu, dropped: %llu, repeated: %llu\n", (unsigned long long)presented,
+      (unsigned long long)frames.getDropped(), (unsigned long long)frames.getRepeated());
+
+  const FramePacer::Stats &pacing = pacer.getStats();
+  printf("frames emulated: %llu, skipped: %llu, late: %llu, resyncs: %llu, wake error: %.1f us mean, %.1f us max\n",
+      (unsigned long long)pacing.frames, (unsigned long long)pacing.skipped, (unsigned long long)pacing.late,
+      (unsigned long long)pacing.resyncs, pacing.slept ? pacing.wakeErrorTotal / 1000.0 / pacing.slept : 0.0,
+      pacing.wakeErrorMax / 1000.0);
 }
@@ -0,0 +1,531 @@
+#include "Cpu.hpp"
+#include "Mapper.hpp"
+#include "Memory.hpp"
+#include <string.h>
+
+// bank modulo the bank count, negative banks count from the last one
+static int wrapBank(int bank, size_t count)
+{
+  int banks = (count != 0) ? (int)count : 1;
+  return ((bank % banks) + banks) % banks;
+}
+
+Mapper *Mapper::create(uint16_t number, Memory *memory, const uint8_t *prg, size_t prgSize, const uint8_t *chr, size_t chrSize, Mirroring mirroring)
+{
+  Mapper *mapper = nullptr;
+
+  if (prg == nullptr || prgSize == 0 || (prgSize % 0x2000) != 0 || (chrSize % 0x400) != 0)
+  {
+    return nullptr;
+  }
+
+  switch (number)
+  {
+    case 0: mapper = new MapperNrom(memory, prg, prgSize, chr, chrSize, mirroring); break;
+    case 1: mapper = new MapperMmc1(memory, prg, prgSize, chr, chrSize, mirroring); break;
+    case 2: mapper = new MapperUxrom(memory, prg, prgSize, chr, chrSize, mirroring); break;
+    case 3: mapper = new MapperCnrom(memory, prg, prgSize, chr, chrSize, mirroring); break;
+    case 4: mapper = new MapperMmc3(memory, prg, prgSize, chr, chrSize, mirroring); break;
+    default:
+      return nullptr;
+  }
+
+  mapper->reset();
+  return mapper;
+}
+
+Mapper::Mapper(uint16_t number, Memory *memory, const uint8_t *prg, size_t prgSize, const uint8_t *chr, size_t chrSize, Mirroring mirroring)
+: memory(memory),
+  number(number),
+  prg(prg),
+  prgSize(prgSize),
+  chr(chr),
+  chrSize(chrSize),
+  mirroring(mirroring),
+  headerMirroring(mirroring),
+  irq(false),
+  rendering(false)
+{
+  memset(prgBanks, 0, sizeof(prgBanks));
+  memset(chrPages, 0, sizeof(chrPages));
+  memset(chrRam, 0, sizeof(chrRam));
+  memset(prgRam, 0, sizeof(prgRam));
+
+  if (chr == nullptr || chrSize == 0)
+  {
+    this->chr = chrRam;
+    this->chrSize = sizeof(chrRam);
+  }
+}
+
+Mapper::~Mapper()
+{
+}
+
+// PRG RAM and the register window, boards map their banks after this
+void Mapper::reset()
+{
+  mirroring = headerMirroring;
+  setIrq(false);
+  memory->map_pages(0x60, 0x20, prgRam);
+  memory->map_write_handler(0x80, 0x80, &Mapper::registerWrite, this);
+}
+
+uint16_t Mapper::getNumber()
+{
+  return number;
+}
+
+Mapper::Mirroring Mapper::getMirroring()
+{
+  return mirroring;
+}
+
+const uint8_t *const *Mapper::getChrPages()
+{
+  return chrPages;
+}
+
+bool Mapper::isChrRam()
+{
+  return chr == chrRam;
+}
+
+// CHR pages are read-only views, CHR RAM is written through the bank it maps
+void Mapper::writeChr(uint16_t address, uint8_t value)
+{
+  if (!isChrRam())
+  {
+    return;
+  }
+
+  const uint8_t *page = chrPages[(address >> 10) & 7];
+  chrRam[(page - chrRam) + (address & 0x3FF)] = value;
+}
+
+uint64_t Mapper::cyclesUntilIrq()
+{
+  return NoIrq;
+}
+
+void Mapper::runCycles(uint64_t cycles)
+{
+}
+
+bool Mapper::getIrq()
+{
+  return irq;
+}
+
+void Mapper::setRendering(bool enabled)
+{
+  rendering = enabled;
+}
+
+void Mapper::setIrq(bool level)
+{
+  Cpu *cpu = memory->get_cpu();
+
+  irq = level;
+  if (cpu)
+  {
+    cpu->setIrq(Cpu::IrqMapper, level);
+  }
+}
+
+void Mapper::registerWrite(void *context, uint16_t address, uint8_t value)
+{
+  ((Mapper *)context)->writeRegister(address, value);
+}
+
+void Mapper::mapPrg8k(uint8_t slot, int bank)
+{
+  const uint8_t *data = prg + wrapBank(bank, prgSize / 0x2000) * 0x2000;
+
+  prgBanks[slot] = data;
+  memory->map_read_pages(0x80 + slot * 0x20, 0x20, data);
+}
+
+void Mapper::mapPrg16k(uint8_t slot, int bank)
+{
+  bank = wrapBank(bank, prgSize / 0x4000);
+  mapPrg8k(slot * 2, bank * 2);
+  mapPrg8k(slot * 2 + 1, bank * 2 + 1);
+}
+
+// 16KB PRG shows up twice
+void Mapper::mapPrg32k(int bank)
+{
+  bank = wrapBank(bank, prgSize / 0x8000);
+  for (uint8_t slot = 0; slot < 4; slot++)
+  {
+    mapPrg8k(slot, bank * 4 + slot);
+  }
+}
+
+void Mapper::mapChr1k(uint8_t slot, int bank)
+{
+  chrPages[slot] = chr + wrapBank(bank, chrSize / 0x400) * 0x400;
+}
+
+void Mapper::mapChr4k(uint8_t slot, int bank)
+{
+  for (uint8_t i = 0; i < 4; i++)
+  {
+    mapChr1k(slot * 4 + i, bank * 4 + i);
+  }
+}
+
+void Mapper::mapChr8k(int bank)
+{
+  for (uint8_t i = 0; i < 8; i++)
+  {
+    mapChr1k(i, bank * 8 + i);
+  }
+}
+
+// NROM
+
+MapperNrom::MapperNrom(Memory *memory, const uint8_t *prg, size_t prgSize, const uint8_t *chr, size_t chrSize, Mirroring mirroring)
+: Mapper(0, memory, prg, prgSize, chr, chrSize, mirroring)
+{
+}
+
+void MapperNrom::reset()
+{
+  Mapper::reset();
+  mapPrg32k(0);
+  mapChr8k(0);
+}
+
+void MapperNrom::writeRegister(uint16_t address, uint8_t value)
+{
+}
+
+// UxROM
+
+MapperUxrom::MapperUxrom(Memory *memory, const uint8_t *prg, size_t prgSize, const uint8_t *chr, size_t chrSize, Mirroring mirroring)
+: Mapper(2, memory, prg, prgSize, chr, chrSize, mirroring)
+{
+}
+
+void MapperUxrom::reset()
+{
+  Mapper::reset();
+  mapPrg16k(0, 0);
+  mapPrg16k(1, -1);
+  mapChr8k(0);
+}
+
+void MapperUxrom::writeRegister(uint16_t address, uint8_t value)
+{
+  mapPrg16k(0, value);
+}
+
+// CNROM
+
+MapperCnrom::MapperCnrom(Memory *memory, const uint8_t *prg, size_t prgSize, const uint8_t *chr, size_t chrSize, Mirroring mirroring)
+: Mapper(3, memory, prg, prgSize, chr, chrSize, mirroring)
+{
+}
+
+void MapperCnrom::reset()
+{
+  Mapper::reset();
+  mapPrg32k(0);
+  mapChr8k(0);
+}
+
+void MapperCnrom::writeRegister(uint16_t address, uint8_t value)
+{
+  mapChr8k(value);
+}
+
+// MMC1
+
+MapperMmc1::MapperMmc1(Memory *memory, const uint8_t *prg, size_t prgSize, const uint8_t *chr, size_t chrSize, Mirroring mirroring)
+: Mapper(1, memory, prg, prgSize, chr, chrSize, mirroring),
+  shift(0),
+  shiftCount(0),
+  control(0x0C),
+  chrBank0(0),
+  chrBank1(0),
+  prgBank(0)
+{
+}
+
+void MapperMmc1::reset()
+{
+  Mapper::reset();
+  shift = 0;
+  shiftCount = 0;
+  control = 0x0C;
+  chrBank0 = 0;
+  chrBank1 = 0;
+  prgBank = 0;
+  updateBanks();
+}
+
+// bit 7 resets the port, otherwise bit 0 is shifted in and the fifth write picks the register from A14-A13
+void MapperMmc1::writeRegister(uint16_t address, uint8_t value)
+{
+  if (value & 0x80)
+  {
+    shift = 0;
+    shiftCount = 0;
+    control |= 0x0C;
+    updateBanks();
+    return;
+  }
+
+  shift = (shift >> 1) | ((value & 0x01) << 4);
+  shiftCount++;
+
+  if (shiftCount < 5)
+  {
+    return;
+  }
+
+  switch ((address >> 13) & 0x3)
+  {
+    case 0: control = shift; break;
+    case 1: chrBank0 = shift; break;
+    case 2: chrBank1 = shift; break;
+    case 3: prgBank = shift; break;
+  }
+
+  shift = 0;
+  shiftCount = 0;
+  updateBanks();
+}
+
+void MapperMmc1::updateBanks()
+{
+  static const Mirroring controlMirroring[] = { MirrorSingleLow, MirrorSingleHigh, MirrorVertical, MirrorHorizontal };
+  mirroring = controlMirroring[control & 0x3];
+
+  // SUROM: CHR bank bit 4 picks the 256KB half of 512KB PRG
+  int outer = (prgSize > 0x40000) ? (chrBank0 & 0x10) : 0;
+  int bank = prgBank & 0x0F;
+
+  switch ((control >> 2) & 0x3)
+  {
+    case 0:
+    case 1:
+      mapPrg32k((outer | bank) >> 1);
+      break;
+    case 2:
+      mapPrg16k(0, outer);
+      mapPrg16k(1, outer | bank);
+      break;
+    case 3:
+      mapPrg16k(0, outer | bank);
+      mapPrg16k(1, outer | 0x0F);
+      break;
+  }
+
+  if (control & 0x10)
+  {
+    mapChr4k(0, chrBank0);
+    mapChr4k(1, chrBank1);
+  }
+  else
+  {
+    mapChr8k(chrBank0 >> 1);
+  }
+}
+
+// MMC3
+
+MapperMmc3::MapperMmc3(Memory *memory, const uint8_t *prg, size_t prgSize, const uint8_t *chr, size_t chrSize, Mirroring mirroring)
+: Mapper(4, memory, prg, prgSize, chr, chrSize, mirroring),
+  bankSelect(0),
+  irqLatch(0),
+  irqCounter(0),
+  irqReload(false),
+  irqEnabled(false),
+  frameDot(0)
+{
+  memset(banks, 0, sizeof(banks));
+}
+
+void MapperMmc3::reset()
+{
+  static const uint8_t powerOnBanks[8] = { 0, 2, 4, 5, 6, 7, 0, 1 };
+
+  Mapper::reset();
+  bankSelect = 0;
+  memcpy(banks, powerOnBanks, sizeof(banks));
+  irqLatch = 0;
+  irqCounter = 0;
+  irqReload = false;
+  irqEnabled = false;
+  frameDot = 0;
+  updateBanks();
+}
+
+// registers are picked by A15-A13 and A0
+void MapperMmc3::writeRegister(uint16_t address, uint8_t value)
+{
+  switch (address & 0xE001)
+  {
+    case 0x8000:
+      bankSelect = value;
+      updateBanks();
+      break;
+    case 0x8001:
+      banks[bankSelect & 0x7] = value;
+      updateBanks();
+      break;
+    case 0xA000:
+      if (headerMirroring != MirrorFourScreen)
+      {
+        mirroring = (value & 0x01) ? MirrorHorizontal : MirrorVertical;
+      }
+      break;
+    case 0xA001:
+      // PRG RAM protect, PRG RAM stays writable
+      break;
+    case 0xC000:
+      irqLatch = value;
+      break;
+    case 0xC001:
+      irqCounter = 0;
+      irqReload = true;
+      break;
+    case 0xE000:
+      irqEnabled = false;
+      setIrq(false);
+      break;
+    case 0xE001:
+      irqEnabled = true;
+      break;
+  }
+}
+
+void MapperMmc3::updateBanks()
+{
+  // PRG mode 1 swaps $8000 and $C000, the second to last bank is fixed at the other one
+  if (bankSelect & 0x40)
+  {
+    mapPrg8k(0, -2);
+    mapPrg8k(2, banks[6]);
+  }
+  else
+  {
+    mapPrg8k(0, banks[6]);
+    mapPrg8k(2, -2);
+  }
+  mapPrg8k(1, banks[7]);
+  mapPrg8k(3, -1);
+
+  // CHR A12 inversion swaps the 2KB banks at $0000 and the 1KB banks at $1000
+  uint8_t inversion = (bankSelect & 0x80) ? 4 : 0;
+  mapChr1k(0 ^ inversion, banks[0] & 0xFE);
+  mapChr1k(1 ^ inversion, banks[0] | 0x01);
+  mapChr1k(2 ^ inversion, banks[1] & 0xFE);
+  mapChr1k(3 ^ inversion, banks[1] | 0x01);
+  mapChr1k(4 ^ inversion, banks[2]);
+  mapChr1k(5 ^ inversion, banks[3]);
+  mapChr1k(6 ^ inversion, banks[4]);
+  mapChr1k(7 ^ inversion, banks[5]);
+}
+
+void MapperMmc3::clockCounter()
+{
+  if (irqCounter == 0 || irqReload)
+  {
+    irqCounter = irqLatch;
+    irqReload = false;
+  }
+  else
+  {
+    irqCounter--;
+  }
+
+  if (irqCounter == 0 && irqEnabled)
+  {
+    setIrq(true);
+  }
+}
+
+uint32_t MapperMmc3::dotsToNextClock(uint32_t dot)
+{
+  uint32_t scanline = dot / DotsPerScanline;
+  uint32_t next;
+
+  if (dot % DotsPerScanline < CounterDot && (scanline < 240 || scanline == PreRenderScanline))
+  {
+    next = scanline;
+  }
+  else if (scanline < 239)
+  {
+    next = scanline + 1;
+  }
+  else if (scanline < PreRenderScanline)
+  {
+    next = PreRenderScanline;
+  }
+  else
+  {
+    next = ScanlinesPerFrame;   // scanline 0 of the next frame
+  }
+
+  return next * DotsPerScanline + CounterDot - dot;
+}
+
+// clocks left until the counter reaches 0, converted to CPU cycles
+uint64_t MapperMmc3::cyclesUntilIrq()
+{
+  if (irq)
+  {
+    return 0;
+  }
+
+  // the count can only resume at a scanline end, which asks again
+  if (!irqEnabled || !rendering)
+  {
+    return NoIrq;
+  }
+
+  // the next clock reloads an empty counter, a latch of 0 fires on every clock
+  uint32_t clocks = irqCounter;
+  if (irqReload || irqCounter == 0)
+  {
+    clocks = (irqLatch == 0) ? 1 : (uint32_t)irqLatch + 1;
+  }
+
+  uint64_t dots = 0;
+  uint32_t dot = frameDot;
+  for (uint32_t i = 0; i < clocks; i++)
+  {
+    uint32_t step = dotsToNextClock(dot);
+    dots += step;
+    dot = (dot + step) % (DotsPerScanline * ScanlinesPerFrame);
+  }
+
+  return (dots + DotsPerCpuCycle - 1) / DotsPerCpuCycle;
+}
+
+// one loop iteration per counter clock, never per CPU cycle
+void MapperMmc3::runCycles(uint64_t cycles)
+{
+  const uint32_t frameDots = DotsPerScanline * ScanlinesPerFrame;
+  uint64_t dots = cycles * DotsPerCpuCycle;
+
+  while (rendering)
+  {
+    uint32_t step = dotsToNextClock(frameDot);
+
+    if (step > dots)
+    {
+      break;
+    }
+
+    dots -= step;
+    frameDot = (frameDot + step) % frameDots;
+    clockCounter();
+  }
+
+  frameDot = (uint32_t)((frameDot + dots) % frameDots);
+}
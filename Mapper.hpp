@@ -0,0 +1,168 @@
+#ifndef MAPPER_HPP
+#define MAPPER_HPP
+#include <stdint.h>
+#include <stddef.h>
+
+class Memory;
+
+// Cartridge board
+//
+// PRG banks are mapped into the Memory bus page table ($8000-$FFFF) and CHR
+// banks into eight 1KB pattern table pages. A bank switch only repoints
+// pages, bank data is never copied. Writes to $8000-$FFFF go to the board
+// registers, $6000-$7FFF is 8KB of PRG RAM.
+class Mapper
+{
+  public:
+    enum Mirroring
+    {
+      MirrorHorizontal,     // $2000 = $2400, $2800 = $2C00
+      MirrorVertical,       // $2000 = $2800, $2400 = $2C00
+      MirrorSingleLow,      // every nametable is the first 1KB of VRAM
+      MirrorSingleHigh,     // every nametable is the second 1KB of VRAM
+      MirrorFourScreen,     // 4KB of VRAM on the cartridge
+    };
+
+    // nullptr for bad sizes or boards that aren't supported, prg and chr stay owned
+    // by the caller and must outlive the mapper
+    static Mapper *create(uint16_t number, Memory *memory, const uint8_t *prg, size_t prgSize, const uint8_t *chr, size_t chrSize, Mirroring mirroring);
+    virtual ~Mapper();
+
+    virtual void reset();                         // power-on banks and registers
+    uint16_t getNumber();
+    Mirroring getMirroring();
+    const uint8_t *const *getChrPages();          // PPU $0000-$1FFF in 1KB pages
+    bool isChrRam();                              // chr is 8KB of RAM, the PPU may write it
+    void writeChr(uint16_t address, uint8_t value);  // PPU write to $0000-$1FFF, ignored for CHR ROM
+
+    // Scanline IRQ. Boards that have one work out when it fires instead of
+    // being clocked per instruction: run the CPU for cyclesUntilIrq cycles,
+    // then runCycles, which raises the CPU's IRQ line. The PPU sets whether
+    // it renders at each scanline end, the count only moves while it does.
+    static const uint64_t NoIrq = UINT64_MAX;
+    virtual uint64_t cyclesUntilIrq();            // CPU cycles until the board raises IRQ, NoIrq if it won't
+    virtual void runCycles(uint64_t cycles);      // catch the board up with the CPU
+    bool getIrq();                                // IRQ line asserted
+    void setRendering(bool enabled);              // PPUMASK shows background or sprites, so CHR is fetched
+
+  protected:
+    Mapper(uint16_t number, Memory *memory, const uint8_t *prg, size_t prgSize, const uint8_t *chr, size_t chrSize, Mirroring mirroring);
+
+    virtual void writeRegister(uint16_t address, uint8_t value) = 0;
+    void setIrq(bool level);                      // irq and the CPU's IRQ line
+
+    // negative banks count from the last one, banks wrap at the PRG / CHR size
+    void mapPrg8k(uint8_t slot, int bank);        // slot 0 -> 3 = $8000, $A000, $C000, $E000
+    void mapPrg16k(uint8_t slot, int bank);       // slot 0 -> 1 = $8000, $C000
+    void mapPrg32k(int bank);
+    void mapChr1k(uint8_t slot, int bank);        // slot 0 -> 7 = $0000, $0400, ... $1C00
+    void mapChr4k(uint8_t slot, int bank);        // slot 0 -> 1 = $0000, $1000
+    void mapChr8k(int bank);
+
+    Memory *memory;
+    uint16_t number;              // iNES mapper number
+    const uint8_t *prg;           // read-only, usually a RomImage mapping
+    size_t prgSize;               // multiple of 8KB
+    const uint8_t *chr;
+    size_t chrSize;               // multiple of 1KB
+    const uint8_t *prgBanks[4];   // 8KB PRG bank at $8000, $A000, $C000, $E000
+    const uint8_t *chrPages[8];   // 1KB CHR bank at $0000 -> $1C00
+    Mirroring mirroring;
+    Mirroring headerMirroring;    // from the ROM header, boards without mirroring control keep it
+    bool irq;                     // set through setIrq
+    bool rendering;               // set through setRendering, false until the PPU says
+    uint8_t chrRam[0x2000];       // chr for boards without CHR ROM
+    uint8_t prgRam[0x2000];       // $6000-$7FFF
+
+  private:
+    static void registerWrite(void *context, uint16_t address, uint8_t value);
+};
+
+// NROM (0): 16KB or 32KB PRG, 8KB CHR, no registers
+class MapperNrom : public Mapper
+{
+  public:
+    MapperNrom(Memory *memory, const uint8_t *prg, size_t prgSize, const uint8_t *chr, size_t chrSize, Mirroring mirroring);
+    void reset();
+
+  protected:
+    void writeRegister(uint16_t address, uint8_t value);
+};
+
+// UxROM (2): 16KB bank at $8000, last bank fixed at $C000
+class MapperUxrom : public Mapper
+{
+  public:
+    MapperUxrom(Memory *memory, const uint8_t *prg, size_t prgSize, const uint8_t *chr, size_t chrSize, Mirroring mirroring);
+    void reset();
+
+  protected:
+    void writeRegister(uint16_t address, uint8_t value);
+};
+
+// CNROM (3): fixed PRG, 8KB CHR bank
+class MapperCnrom : public Mapper
+{
+  public:
+    MapperCnrom(Memory *memory, const uint8_t *prg, size_t prgSize, const uint8_t *chr, size_t chrSize, Mirroring mirroring);
+    void reset();
+
+  protected:
+    void writeRegister(uint16_t address, uint8_t value);
+};
+
+// MMC1 / SxROM (1): registers loaded through a 5 bit serial port
+class MapperMmc1 : public Mapper
+{
+  public:
+    MapperMmc1(Memory *memory, const uint8_t *prg, size_t prgSize, const uint8_t *chr, size_t chrSize, Mirroring mirroring);
+    void reset();
+
+  protected:
+    void writeRegister(uint16_t address, uint8_t value);
+
+  private:
+    uint8_t shift;                // serial bits so far, bit 4 is the next one in
+    uint8_t shiftCount;
+    uint8_t control;              // $8000: CPPMM, CHR mode, PRG mode, mirroring
+    uint8_t chrBank0;             // $A000
+    uint8_t chrBank1;             // $C000
+    uint8_t prgBank;              // $E000
+    void updateBanks();
+};
+
+// MMC3 / TxROM (4): 8KB PRG and 1KB/2KB CHR banks, scanline counter IRQ
+class MapperMmc3 : public Mapper
+{
+  public:
+    MapperMmc3(Memory *memory, const uint8_t *prg, size_t prgSize, const uint8_t *chr, size_t chrSize, Mirroring mirroring);
+    void reset();
+    uint64_t cyclesUntilIrq();
+    void runCycles(uint64_t cycles);
+
+  protected:
+    void writeRegister(uint16_t address, uint8_t value);
+
+  private:
+    // NTSC PPU timing, the counter is clocked by the A12 rise near dot 260 of
+    // visible and pre-render scanlines. Without rendering the PPU fetches no
+    // patterns and A12 never rises, the count holds.
+    static const uint32_t DotsPerScanline = 341;
+    static const uint32_t ScanlinesPerFrame = 262;
+    static const uint32_t DotsPerCpuCycle = 3;
+    static const uint32_t CounterDot = 260;
+    static const uint32_t PreRenderScanline = 261;
+
+    uint8_t bankSelect;           // $8000: CP...RRR, CHR A12 inversion, PRG mode, register R0 -> R7
+    uint8_t banks[8];             // R0 -> R7
+    uint8_t irqLatch;             // $C000
+    uint8_t irqCounter;
+    bool irqReload;               // $C001 written, reload on the next clock
+    bool irqEnabled;              // $E001 / $E000
+    uint32_t frameDot;            // PPU dot within the frame the board is caught up to
+
+    void updateBanks();
+    void clockCounter();
+    uint32_t dotsToNextClock(uint32_t dot);   // PPU dots from a frame dot to the next counter clock
+};
+#endif
@@ -1,5 +1,6 @@
 #include "Cpu.hpp"
 #include "Memory.hpp"
+#include "Mapper.hpp"
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -11,25 +12,9 @@
 
 #define INES_ROM_HEADER = {'N','E','S',1A};    // ines always equals 'N', 'E', 'S', 1A
 
-const uint8_t Memory::AddressModeSizeTable[] = 
-{
-          //    description                   symbol
-     0,   // No address/value
-     1,   // immediate value:                 #$
-     1,   // direct zero addr + X:            d, X
-     1,   // direct zero addr + Y:            d, Y
-     1,   // direct zero addr:                d
-     2,   // absolute address + X:            a, X
-     2,   // absolute address + Y:            a, Y
-     2,   // absolute address:                a
-     1,   // indirect zero page address + X   (d, X)
-     1,   // indirect zero page address       (d)
-     1,   // indirect zero page ddress[Y]     (d), Y
-     1,   // indirect absolute address + x    (a, X)
-     1,   // indirect absolute address        (a)
-     1,   // relative value:                  r
-     0,   // register address:                A
-};
+// AddressModeSizeTable and AddressModeLookupTable are initialized in Memory.hpp
+constexpr uint8_t Memory::AddressModeSizeTable[];
+constexpr uint8_t Memory::AddressModeLookupTable[];
 
 const Memory::AddressMode_T Memory::AddressModeFunctionTable[] = 
 {
@@ -48,121 +33,101 @@ const Memory::AddressMode_T Memory::AddressModeFunctionTable[] =
   &Memory::AddressIndirectAbsZ,                // indirect absolute address        (a)
   &Memory::AddressRelative,                    // relative value:                  r
   &Memory::AddressRegisterA,                   // register address:                A
-};
-
-const uint8_t Memory::AddressModeLookupTable[] = 
-{
-  b,                IndirectZeroX,        b,                dS,       DirectZeroZ,      DirectZeroZ,  DirectZeroZ,    bdb,    None,   Immediate,          RegisterA,    None,   DirectAbsoluteZ,    DirectAbsoluteZ,  DirectAbsoluteZ,  al,
-  RelativeAddress,  IndirectZeroIndexY,   IndirectZeroZ,    pdSpY,    DirectZeroZ,      DirectZeroX,  DirectZeroX,    bdby,   None,   DirectAbsoluteY,    RegisterA,    None,   DirectAbsoluteZ,    DirectAbsoluteX,  DirectAbsoluteX,  alX,
-  DirectAbsoluteZ,  IndirectZeroX,        al,               dS,       DirectZeroZ,      DirectZeroZ,  DirectZeroZ,    bdb,    None,   Immediate,          RegisterA,    None,   DirectAbsoluteZ,    DirectAbsoluteZ,  DirectAbsoluteZ,  al,
-  RelativeAddress,  IndirectZeroIndexY,   IndirectZeroZ,    pdSpY,    DirectZeroX,      DirectZeroX,  DirectZeroX,    bdby,   None,   DirectAbsoluteY,    RegisterA,    None,   DirectAbsoluteX,    DirectAbsoluteX,  DirectAbsoluteX,  alX,
-  None,             IndirectZeroX,        None,             dS,       sd,               DirectZeroZ,  DirectZeroZ,    bdb,    None,   Immediate,          RegisterA,    None,   DirectAbsoluteZ,    DirectAbsoluteZ,  DirectAbsoluteZ,  al,
-  RelativeAddress,  IndirectZeroIndexY,   IndirectZeroZ,    pdSpY,    sd,               DirectZeroX,  DirectZeroX,    bdby,   None,   DirectAbsoluteY,    None,         None,   al,                 DirectAbsoluteX,  DirectAbsoluteX,  alX,
-  None,             IndirectZeroX,        rl,               dS,       DirectZeroZ,      DirectZeroZ,  DirectZeroZ,    bdb,    None,   Immediate,          RegisterA,    None,   IndirectAbsoluteZ,  DirectAbsoluteZ,  DirectAbsoluteZ,  al,
-  RelativeAddress,  IndirectZeroIndexY,   IndirectZeroZ,    pdSpY,    DirectZeroX,      DirectZeroX,  DirectZeroX,    bdby,   None,   DirectAbsoluteY,    None,         None,   IndirectAbsoluteX,  DirectAbsoluteX,  DirectAbsoluteX,  alX,
-  RelativeAddress,  IndirectZeroX,        rl,               dS,       DirectZeroZ,      DirectZeroZ,  DirectZeroZ,    bdb,    None,   Immediate,          None,         None,   DirectAbsoluteZ,    DirectAbsoluteZ,  DirectAbsoluteZ,  al,
-  RelativeAddress,  IndirectZeroIndexY,   IndirectZeroZ,    pdSpY,    DirectZeroX,      DirectZeroX,  DirectZeroY,    bdby,   None,   DirectAbsoluteY,    None,         None,   DirectAbsoluteZ,    DirectAbsoluteX,  DirectAbsoluteX,  alX,
-  Immediate,        IndirectZeroX,        Immediate,        dS,       DirectZeroZ,      DirectZeroZ,  DirectZeroZ,    bdb,    None,   Immediate,          None,         None,   DirectAbsoluteZ,    DirectAbsoluteZ,  DirectAbsoluteZ,  al,
-  RelativeAddress,  IndirectZeroIndexY,   IndirectZeroZ,    pdSpY,    DirectZeroX,      DirectZeroX,  DirectZeroY,    bdby,   None,   DirectAbsoluteY,    None,         None,   DirectAbsoluteX,    DirectAbsoluteX,  DirectAbsoluteY,  alX,
-  Immediate,        IndirectZeroX,        Immediate,        dS,       DirectZeroZ,      DirectZeroZ,  DirectZeroZ,    bdb,    None,   Immediate,          None,         None,   DirectAbsoluteZ,    DirectAbsoluteZ,  DirectAbsoluteZ,  al,
-  RelativeAddress,  IndirectZeroIndexY,   IndirectZeroZ,    pdSpY,    DirectZeroZ,      DirectZeroX,  DirectZeroX,    bdby,   None,   DirectAbsoluteY,    None,         None,   IndirectAbsoluteZ,  DirectAbsoluteX,  DirectAbsoluteX,  alX,
-  Immediate,        IndirectZeroX,        Immediate,        dS,       DirectZeroZ,      DirectZeroZ,  DirectZeroZ,    bdb,    None,   Immediate,          None,         None,   DirectAbsoluteZ,    DirectAbsoluteZ,  DirectAbsoluteZ,  al,
-  RelativeAddress,  IndirectZeroIndexY,   IndirectZeroZ,    pdSpY,    DirectAbsoluteZ,  DirectZeroX,  DirectZeroX,    bdby,   None,   DirectAbsoluteY,    None,         None,   IndirectAbsoluteX,  DirectAbsoluteX,  DirectAbsoluteX,  alX,
-};
-
-struct InesHeader_T
-{
-  uint32_t  RomType;                      // ines always equals 'N', 'E', 'S', 1A
-	uint8_t   PrgRomPages;                  // PRG-ROM pages (16KB each, minimum 1 page) - PrgRomPages * 16384
-	uint8_t   ChrRomPages;                  // CHR-ROM pages (8KB each, minimum 1 page) - ChrBytePages * 8192
-
-	uint8_t   FlagsByte6;                   // Flags at byte 6
-#define MirroringVertical         0 << 0  //  0: horizontal (vertical arrangement) (CIRAM A10 = PPU A11)
-#define MirroringHorizontal       1 << 0  //  1: vertical (horizontal arrangement) (CIRAM A10 = PPU A10)
-#define BatteryBacked             1 << 1  //  Cartridge contains battery-backed PRG RAM ($6000-7FFF) or other persistent memory
-#define TrainerPresent            1 << 2  //  512-byte trainer at $7000-$71FF (stored before PRG data)
-#define IgnoreMirroringControl    1 << 3  //  Ignore mirroring control or above mirroring bit; instead provide four-screen VRAM
-#define LowerMapperNybble       0xF << 4  //  Lower nybble of mapper number
-
-	uint8_t   FlagsByte7;                   // flags at byte 7
-#define VsUnisystem               1 << 0  // 
-#define PlayChoice                1 << 1  //  PlayChoice-10 (8KB of Hint Screen data stored after CHR data)
-#define NesFormat                 3 << 2  //  If equal to 2, flags 8-15 are in NES 2.0 format
-#define NesFormat2                2 << 2  //  If equal to 2, flags 8-15 are in NES 2.0 format
-#define UpperMapperNybble       0xF << 4  //  Upper nybble of mapper number
-
-	uint8_t   RamPages;                     // RAM pages (8KB each)
-	uint8_t   Unused[7];                    // unused padding
+  &Memory::AddressNone,                        // ImplementedCount: not implemented, no address used
+  &Memory::AddressNone,                        // al: not implemented, no address used
+  &Memory::AddressNone,                        // alX: not implemented, no address used
+  &Memory::AddressNone,                        // b: not implemented, no address used
+  &Memory::AddressNone,                        // rl: not implemented, no address used
+  &Memory::AddressNone,                        // pdSpY: not implemented, no address used
+  &Memory::AddressNone,                        // dS: not implemented, no address used
+  &Memory::AddressNone,                        // sd: not implemented, no address used
+  &Memory::AddressNone,                        // bdb: not implemented, no address used
+  &Memory::AddressNone,                        // bdby: not implemented, no address used
 };
 
 // 5b
 // u/d/l/r/sel/start/a/b = 8
 // 
 Memory::Memory()
+: cpu_callback(nullptr),
+  mapper(nullptr)
 {
+  memset(&rom_info, 0, sizeof(rom_info));
   memset(cpu_mem, 0, sizeof(cpu_mem));
   memset(cpu_mem, 0xFF, 0x100);
-}
 
-// byte 8 holds size of PRG RAM in 8 KB units (Value 0 infers 8 KB)
+  for (uint32_t page = 0; page < 0x100; page++)
+  {
+    read_pages[page] = &cpu_mem[page << 8];
+    write_pages[page] = &cpu_mem[page << 8];
+    read_handlers[page] = &Memory::open_bus_read;
+    write_handlers[page] = &Memory::ignore_write;
+    read_contexts[page] = nullptr;
+    write_contexts[page] = nullptr;
+  }
 
-// flags at byte 9 - not used
-#define TvSystem                  1 << 0 //
-#define TvSystemNtsc              0 << 0 //
-#define TvSystemPal               1 << 0 //
+  ppu_read = nullptr;
+  ppu_write = nullptr;
+  ppu_context = nullptr;
+  ppu_repeatable = 0xFF;
+  memset(ppu_registers, 0, sizeof(ppu_registers));
 
-// flags at byte 10 - unofficial
-// flags at bytes 11-15 - zero
+  dirty_first = 0;
+  dirty_size = 0;
+  dirty_any = false;
+  memset(dirty_bitmap, 0, sizeof(dirty_bitmap));
+}
 
-//  https://wiki.nesdev.com/w/index.php/INES
-//  If byte 7 AND $0C = $08, and the size taking into account byte 9 does not exceed the actual size of the ROM image, then NES 2.0.
-//  If byte 7 AND $0C = $00, and bytes 12-15 are all 0, then iNES.
-//  Otherwise, archaic iNES.
+Memory::~Memory()
+{
+  delete mapper;
+}
 
-void Memory::loadRom(char *file)
+// nothing is touched until the image and its board are good, a failed load
+// leaves the previous ROM running
+RomImage::Error Memory::loadRom(const char *fileName, RomDatabase *database)
 {
-  FILE *infile;
-  infile = fopen(file, "rb");
+  RomImage::Error error;
+  std::shared_ptr<RomImage> image = RomImage::open(fileName, error);
 
-  if (!infile)
+  if (!image)
   {
-    std::cout << "fail to open file" << std::endl;
-    return;
+    return error;
   }
-  else
-  {
-    std::cout << "opened file: " << file << std::endl;
-  }
-
-  InesHeader_T headerData;
-  uint8_t trainerData[512];
 
-  size_t result = fread(&headerData, sizeof(headerData), 1, infile);
-  if (result != 1)
+  RomInfo info = image->getInfo();
+  if (database)
   {
-    std::cout << "fail to read header" << std::endl;
-    return;
+    database->apply(fileName, *image, info);
   }
 
-  if ((headerData.FlagsByte6 & TrainerPresent) == 1)
+  // the board maps PRG banks straight from the image, nothing is copied into cpu_mem
+  Mapper *board = Mapper::create(info.mapper, this, image->getPrg(), image->getPrgSize(),
+      image->getChr(), image->getChrSize(), info.mirroring);
+  if (board == nullptr)
   {
-    std::cout << "trainer present" << std::endl;
-    fread(trainerData, sizeof(trainerData), 1, infile);
+    return RomImage::ErrorMapper;
   }
 
-  if (headerData.PrgRomPages == 0)
-    headerData.PrgRomPages = 1;
-  PrgRomData = (uint8_t *) malloc(16384*headerData.PrgRomPages);
-  fread(&cpu_mem[0x8000], (16384*headerData.PrgRomPages), 1, infile);
+  delete mapper;
+  mapper = board;
+  rom = image;
+  rom_info = info;
+
+  map_ram_mirrors();
+  map_ppu_registers(ppu_read, ppu_write, ppu_context, ppu_repeatable);    // keeps a PPU that is already attached
 
-  if (headerData.ChrRomPages == 0)
+  // the trainer goes into PRG RAM at $7000-$71FF
+  const uint8_t *trainer = rom->getTrainer();
+  if (trainer != nullptr)
   {
-    headerData.ChrRomPages = 1;
+    for (uint16_t i = 0; i < 512; i++)
+    {
+      bus_write(0x7000 + i, trainer[i]);
+    }
   }
-  ChrRomData = (uint8_t *) malloc(1024*8*headerData.ChrRomPages);
-  result = fread(ChrRomData, (1024*8*headerData.ChrRomPages), 1, infile);
 
-  fclose(infile);
+  return RomImage::ErrorNone;
 }
 
 uint8_t *Memory::get_chr_rom_data()
@@ -172,6 +137,21 @@ uint8_t *Memory::get_chr_rom_data()
   return get_memory(0x200);
 }
 
+Mapper *Memory::get_mapper()
+{
+  return mapper;
+}
+
+class Cpu *Memory::get_cpu()
+{
+  return cpu_callback;
+}
+
+const RomInfo &Memory::get_rom_info()
+{
+  return rom_info;
+}
+
 void Memory::set_cpu(class Cpu *cpu)
 {
   cpu_callback = cpu;
@@ -197,6 +177,316 @@ void Memory::set_memory(uint16_t offset, uint8_t *source, uint16_t size)
   }
 
   memcpy(&cpu_mem[offset], source, size);
+  mark_dirty(offset, size);
+
+  if (cpu_callback)
+  {
+    cpu_callback->invalidateCode(offset, size);
+  }
+}
+
+// the zero page and stack page can't be remapped
+bool Memory::check_pages(uint8_t firstPage, uint16_t count)
+{
+  if (firstPage < 0x02 || firstPage + count > 0x100)
+  {
+    printf("can't map pages %02x-%02x\n", firstPage, (firstPage + count - 1) & 0xFF);
+    return false;
+  }
+
+  return true;
+}
+
+// the Cpu picks up the new pages and drops code it cached from the old ones
+void Memory::pages_changed(uint8_t firstPage, uint16_t count)
+{
+  if (cpu_callback)
+  {
+    cpu_callback->remapPages(firstPage, count);
+  }
+}
+
+void Memory::map_pages(uint8_t firstPage, uint16_t count, uint8_t *data)
+{
+  if (!check_pages(firstPage, count))
+  {
+    return;
+  }
+
+  for (uint16_t i = 0; i < count; i++)
+  {
+    read_pages[firstPage + i] = data + (i << 8);
+    write_pages[firstPage + i] = data + (i << 8);
+  }
+
+  pages_changed(firstPage, count);
+}
+
+void Memory::map_rom_pages(uint8_t firstPage, uint16_t count, const uint8_t *data)
+{
+  if (!check_pages(firstPage, count))
+  {
+    return;
+  }
+
+  // ROM may be a read-only mapping, the Cpu never writes through read pages
+  uint8_t *bytes = (uint8_t *)data;
+
+  for (uint16_t i = 0; i < count; i++)
+  {
+    read_pages[firstPage + i] = bytes + (i << 8);
+    write_pages[firstPage + i] = nullptr;
+    write_handlers[firstPage + i] = &Memory::ignore_write;
+    write_contexts[firstPage + i] = nullptr;
+  }
+
+  pages_changed(firstPage, count);
+}
+
+// only pages that change are handed to the Cpu, a mapper rewriting the same bank costs nothing
+void Memory::map_read_pages(uint8_t firstPage, uint16_t count, const uint8_t *data)
+{
+  if (!check_pages(firstPage, count))
+  {
+    return;
+  }
+
+  // ROM may be a read-only mapping, the Cpu never writes through read pages
+  uint8_t *bytes = (uint8_t *)data;
+
+  uint16_t changedFirst = count;
+  uint16_t changedLast = 0;
+
+  for (uint16_t i = 0; i < count; i++)
+  {
+    if (read_pages[firstPage + i] != bytes + (i << 8))
+    {
+      read_pages[firstPage + i] = bytes + (i << 8);
+      changedFirst = (i < changedFirst) ? i : changedFirst;
+      changedLast = i;
+    }
+  }
+
+  if (changedFirst < count)
+  {
+    pages_changed(firstPage + changedFirst, changedLast - changedFirst + 1);
+  }
+}
+
+void Memory::map_io_pages(uint8_t firstPage, uint16_t count, BusRead_T read, BusWrite_T write, void *context)
+{
+  if (!check_pages(firstPage, count))
+  {
+    return;
+  }
+
+  for (uint16_t i = 0; i < count; i++)
+  {
+    read_pages[firstPage + i] = nullptr;
+    write_pages[firstPage + i] = nullptr;
+    read_handlers[firstPage + i] = read ? read : &Memory::open_bus_read;
+    write_handlers[firstPage + i] = write ? write : &Memory::ignore_write;
+    read_contexts[firstPage + i] = context;
+    write_contexts[firstPage + i] = context;
+  }
+
+  pages_changed(firstPage, count);
+}
+
+void Memory::map_write_handler(uint8_t firstPage, uint16_t count, BusWrite_T write, void *context)
+{
+  if (!check_pages(firstPage, count))
+  {
+    return;
+  }
+
+  for (uint16_t i = 0; i < count; i++)
+  {
+    write_pages[firstPage + i] = nullptr;
+    write_handlers[firstPage + i] = write ? write : &Memory::ignore_write;
+    write_contexts[firstPage + i] = context;
+  }
+
+  pages_changed(firstPage, count);
+}
+
+// Mirrors are page aliases, a mirrored access costs the same as a direct one
+void Memory::map_ram_mirrors()
+{
+  for (uint16_t mirror = 0x08; mirror < 0x20; mirror += 0x08)
+  {
+    map_pages(mirror, 0x08, cpu_mem);
+  }
+
+  track_dirty_mirrors();
+}
+
+// repeatableReads has bit n set when the handler's state behind $2000 + n only
+// changes between Scheduler events, so once read a register reads the same
+// until then. The plain register bytes always do.
+void Memory::map_ppu_registers(BusRead_T read, BusWrite_T write, void *context, uint8_t repeatableReads)
+{
+  ppu_read = read;
+  ppu_write = write;
+  ppu_context = context;
+  ppu_repeatable = read ? repeatableReads : 0xFF;
+  map_io_pages(0x20, 0x20, &Memory::ppu_register_read, &Memory::ppu_register_write, this);
+}
+
+uint8_t Memory::bus_read(uint16_t address)
+{
+  uint8_t *page = read_pages[address >> 8];
+
+  if (page != nullptr)
+  {
+    return page[address & 0xFF];
+  }
+
+  return read_handlers[address >> 8](read_contexts[address >> 8], address);
+}
+
+// Direct pages and the PPU registers the PPU says repeat, what a polling loop
+// may read and still be skipped
+bool Memory::is_read_repeatable(uint16_t address)
+{
+  if (read_pages[address >> 8] != nullptr)
+  {
+    return true;
+  }
+
+  return read_handlers[address >> 8] == &Memory::ppu_register_read && ((ppu_repeatable >> (address & 0x7)) & 1);
+}
+
+void Memory::bus_write(uint16_t address, uint8_t value)
+{
+  uint8_t *page = write_pages[address >> 8];
+
+  if (page != nullptr)
+  {
+    page[address & 0xFF] = value;
+    return;
+  }
+
+  write_handlers[address >> 8](write_contexts[address >> 8], address, value);
+}
+
+void Memory::track_dirty(uint8_t firstPage, uint16_t count)
+{
+  if (count > DirtyMaxPages || firstPage + count > 0x08 || !check_pages(firstPage, count))
+  {
+    printf("can't track pages %02x -> %02x\n", firstPage, firstPage + count - 1);
+    return;
+  }
+
+  dirty_first = firstPage << 8;
+  dirty_size = count << 8;
+  map_write_handler(firstPage, count, &Memory::dirty_write, this);
+  track_dirty_mirrors();
+  mark_dirty(dirty_first, dirty_size);
+}
+
+// mirrors of the region that alias it would write around the handler, so
+// they get it too whenever the region or the mirrors are mapped
+void Memory::track_dirty_mirrors()
+{
+  uint8_t firstPage = dirty_first >> 8;
+  uint16_t count = dirty_size >> 8;
+
+  for (uint16_t mirror = 0x08; mirror < 0x20 && count != 0; mirror += 0x08)
+  {
+    if (write_pages[mirror + firstPage] == &cpu_mem[firstPage << 8])
+    {
+      map_write_handler(mirror + firstPage, count, &Memory::dirty_write, this);
+    }
+  }
+}
+
+bool Memory::take_dirty(uint64_t *bitmap)
+{
+  if (!dirty_any)
+  {
+    return false;
+  }
+
+  memcpy(bitmap, dirty_bitmap, sizeof(dirty_bitmap));
+  memset(dirty_bitmap, 0, sizeof(dirty_bitmap));
+  dirty_any = false;
+  return true;
+}
+
+// bytes written around the bus (set_memory) that fall in the region
+void Memory::mark_dirty(uint16_t address, uint16_t size)
+{
+  uint32_t regionEnd = (uint32_t)dirty_first + dirty_size;
+  uint32_t first = (address > dirty_first) ? address : dirty_first;
+  uint32_t end = ((uint32_t)address + size < regionEnd) ? (uint32_t)address + size : regionEnd;
+
+  for (uint32_t byte = first; byte < end; byte++)
+  {
+    uint32_t offset = byte - dirty_first;
+    dirty_bitmap[offset >> 6] |= (uint64_t)1 << (offset & 63);
+    dirty_any = true;
+  }
+}
+
+// region pages and their RAM mirrors, rewriting a byte with its value isn't a change
+void Memory::dirty_write(void *context, uint16_t address, uint8_t value)
+{
+  Memory *memory = (Memory *)context;
+  uint16_t offset = (address & 0x7FF) - memory->dirty_first;
+
+  if (memory->cpu_mem[address & 0x7FF] != value)
+  {
+    memory->cpu_mem[address & 0x7FF] = value;
+    memory->dirty_bitmap[offset >> 6] |= (uint64_t)1 << (offset & 63);
+    memory->dirty_any = true;
+  }
+}
+
+uint8_t *const *Memory::get_read_pages()
+{
+  return read_pages;
+}
+
+uint8_t *const *Memory::get_write_pages()
+{
+  return write_pages;
+}
+
+// nothing drives the data bus, the last value on it was the high byte of the address
+uint8_t Memory::open_bus_read(void *context, uint16_t address)
+{
+  return address >> 8;
+}
+
+void Memory::ignore_write(void *context, uint16_t address, uint8_t value)
+{
+}
+
+// $2008-$3FFF repeat the 8 PPU registers every 8 bytes
+uint8_t Memory::ppu_register_read(void *context, uint16_t address)
+{
+  Memory *memory = (Memory *)context;
+
+  if (memory->ppu_read)
+  {
+    return memory->ppu_read(memory->ppu_context, PPUCTRL | (address & 0x7));
+  }
+
+  return memory->ppu_registers[address & 0x7];
+}
+
+void Memory::ppu_register_write(void *context, uint16_t address, uint8_t value)
+{
+  Memory *memory = (Memory *)context;
+
+  if (memory->ppu_write)
+  {
+    memory->ppu_write(memory->ppu_context, PPUCTRL | (address & 0x7), value);
+    return;
+  }
+
+  memory->ppu_registers[address & 0x7] = value;
 }
 
 // No address/value
@@ -391,10 +681,10 @@ uint8_t *Memory::AddressIndirectAbsX(uint8_t *instructionAddr)
   directAddr |= *(instructionAddr) & 0xFF;
   directAddr += x;
 
-  // get absolute address by dereferencing directAddr
-  absoluteAddr = *(cpu_mem + (directAddr + 1)) & 0xFF;
+  // get absolute address by dereferencing directAddr, the pointer may be in ROM
+  absoluteAddr = bus_read(directAddr + 1);
   absoluteAddr <<= 8;
-  absoluteAddr |= *(cpu_mem + directAddr) & 0xFF;
+  absoluteAddr |= bus_read(directAddr);
 
   // memory address of given absolute address + x register
   tempAddr = cpu_mem + absoluteAddr;
@@ -414,10 +704,10 @@ uint8_t *Memory::AddressIndirectAbsZ(uint8_t *instructionAddr)
   directAddr <<= 8;
   directAddr |= *(instructionAddr) & 0xFF;
 
-  // dereference direct address to get absolute address
-  absoluteAddr = *(cpu_mem + (directAddr + 1)) & 0xFF;
+  // dereference direct address to get absolute address, the pointer may be in ROM
+  absoluteAddr = bus_read(directAddr + 1);
   absoluteAddr <<= 8;
-  absoluteAddr |= *(cpu_mem + directAddr) & 0xFF;
+  absoluteAddr |= bus_read(directAddr);
 
   // memory address of given absolute address + x register
   tempAddr = cpu_mem + absoluteAddr;
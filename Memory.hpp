@@ -1,7 +1,10 @@
 #ifndef MEMORY_HPP
 #define MEMORY_HPP
 #include "Cpu.hpp"
+#include "RomImage.hpp"
+#include "RomDatabase.hpp"
 #include <iostream>
+#include <memory>
 
 
 // shared space
@@ -46,12 +49,17 @@
 #define JOYPAD1                         0x4016      // 
 #define JOYPAD2                         0x4017      // 
 
+class Mapper;
+
 class Memory
 {
   public:
     Memory();
+    ~Memory();
 
-    void loadRom(char *fileName);
+    // maps the image and creates its board, memory is left as it was on failure,
+    // a database entry for the ROM overrides its header
+    RomImage::Error loadRom(const char *fileName, RomDatabase *database = nullptr);
 
     void printHeader();
     void printTrainer();
@@ -62,11 +70,49 @@ class Memory
 
     uint8_t getPrgSize();
     uint8_t *get_chr_rom_data();
+    Mapper *get_mapper();                 // board of the loaded ROM, nullptr without one
+    class Cpu *get_cpu();                 // set by set_cpu, its interrupt lines are driven by the PPU and the board
+    const RomInfo &get_rom_info();        // header of the loaded ROM after database corrections
     void set_cpu(class Cpu *cpu);
     uint8_t *get_memory();
     uint8_t *get_memory(uint16_t addr);
     void set_memory(uint16_t offset, uint8_t *source, uint16_t size);
 
+    // CPU bus
+    // ======
+    // Every 256 byte page is either direct, a pointer to the bytes the CPU sees
+    // (RAM, ROM, a bank of either), or a pair of handlers for pages with side
+    // effects (PPU registers, joypads, mapper registers). All pages start as
+    // direct pages of cpu_mem. The zero page and stack page always stay that
+    // way, the Cpu reads pointers and the stack from cpu_mem.
+    typedef uint8_t (*BusRead_T)(void *context, uint16_t address);
+    typedef void (*BusWrite_T)(void *context, uint16_t address, uint8_t value);
+
+    void map_pages(uint8_t firstPage, uint16_t count, uint8_t *data);         // direct reads and writes, data holds count * 0x100 bytes
+    void map_rom_pages(uint8_t firstPage, uint16_t count, const uint8_t *data);     // direct reads, writes are ignored
+    void map_read_pages(uint8_t firstPage, uint16_t count, const uint8_t *data);    // direct reads, writes are unchanged (bank switching)
+    void map_io_pages(uint8_t firstPage, uint16_t count, BusRead_T read, BusWrite_T write, void *context);
+    void map_write_handler(uint8_t firstPage, uint16_t count, BusWrite_T write, void *context);  // writes go to the handler, reads are unchanged
+    void map_ram_mirrors();                                                   // $0800-$1FFF alias the 2KB internal RAM at $0000-$07FF
+    void map_ppu_registers(BusRead_T read, BusWrite_T write, void *context, uint8_t repeatableReads = 0);  // $2000-$3FFF, handlers see $2000-$2007, nullptr for plain register bytes
+    uint8_t bus_read(uint16_t address);
+    bool is_read_repeatable(uint16_t address);                                // reading again returns the same value and changes nothing until the next Scheduler event
+    void bus_write(uint16_t address, uint8_t value);
+    uint8_t *const *get_read_pages();                                         // nullptr for pages read through a handler
+    uint8_t *const *get_write_pages();                                        // nullptr for pages written through a handler
+
+    // Dirty tracking
+    // ======
+    // Writes to a tracked region of internal RAM (the $0200-$05FF display) go
+    // through a write handler that also sets one bit per changed byte, reads
+    // stay direct. A frame only converts and presents what the bitmap says
+    // changed. The RAM mirrors of the region write through the handler as
+    // well, also when they are mapped after the region.
+    static const uint16_t DirtyMaxPages = 4;
+    static const uint16_t DirtyWords = DirtyMaxPages * 0x100 / 64;
+    void track_dirty(uint8_t firstPage, uint16_t count);    // internal RAM pages, everything starts dirty
+    bool take_dirty(uint64_t *bitmap);                      // DirtyWords words, bit n = byte n of the region, false if nothing changed
+
     // CPU Memory
     // ======
     // 0x100   => Zero Page (0x0 -> 0xFF)
@@ -127,8 +173,6 @@ class Memory
 
     bool testPageBoundary(uint8_t addressOffset);
 
-    static const uint8_t AddressModeSizeTable[];
-
     enum AddressModesEnum
     {
                                   //    description                   symbol
@@ -161,14 +205,93 @@ class Memory
     };                            
     typedef uint8_t* (Memory::*AddressMode_T)(uint8_t *instructionAddr);
     static const AddressMode_T AddressModeFunctionTable[];
-    static const uint8_t AddressModeLookupTable[];
+
+    // constexpr so the Cpu can resolve address modes of each opcode at compile time
+    static constexpr uint8_t AddressModeSizeTable[AddressModeCount] =
+    {
+          //    description                   symbol
+      0,   // No address/value
+      1,   // immediate value:                 #$
+      1,   // direct zero addr + X:            d, X
+      1,   // direct zero addr + Y:            d, Y
+      1,   // direct zero addr:                d
+      2,   // absolute address + X:            a, X
+      2,   // absolute address + Y:            a, Y
+      2,   // absolute address:                a
+      1,   // indirect zero page address + X   (d, X)
+      1,   // indirect zero page address       (d)
+      1,   // indirect zero page ddress[Y]     (d), Y
+      1,   // indirect absolute address + x    (a, X)
+      1,   // indirect absolute address        (a)
+      1,   // relative value:                  r
+      0,   // register address:                A
+      0,   // ImplementedCount: not implemented, no address used
+      0,   // al: not implemented, no address used
+      0,   // alX: not implemented, no address used
+      0,   // b: not implemented, no address used
+      0,   // rl: not implemented, no address used
+      0,   // pdSpY: not implemented, no address used
+      0,   // dS: not implemented, no address used
+      0,   // sd: not implemented, no address used
+      0,   // bdb: not implemented, no address used
+      0,   // bdby: not implemented, no address used
+    };
+
+    static constexpr uint8_t AddressModeLookupTable[256] =
+    {
+      b,                IndirectZeroX,        b,                dS,       DirectZeroZ,      DirectZeroZ,  DirectZeroZ,    bdb,    None,   Immediate,          RegisterA,    None,   DirectAbsoluteZ,    DirectAbsoluteZ,  DirectAbsoluteZ,  al,
+      RelativeAddress,  IndirectZeroIndexY,   IndirectZeroZ,    pdSpY,    DirectZeroZ,      DirectZeroX,  DirectZeroX,    bdby,   None,   DirectAbsoluteY,    RegisterA,    None,   DirectAbsoluteZ,    DirectAbsoluteX,  DirectAbsoluteX,  alX,
+      DirectAbsoluteZ,  IndirectZeroX,        al,               dS,       DirectZeroZ,      DirectZeroZ,  DirectZeroZ,    bdb,    None,   Immediate,          RegisterA,    None,   DirectAbsoluteZ,    DirectAbsoluteZ,  DirectAbsoluteZ,  al,
+      RelativeAddress,  IndirectZeroIndexY,   IndirectZeroZ,    pdSpY,    DirectZeroX,      DirectZeroX,  DirectZeroX,    bdby,   None,   DirectAbsoluteY,    RegisterA,    None,   DirectAbsoluteX,    DirectAbsoluteX,  DirectAbsoluteX,  alX,
+      None,             IndirectZeroX,        None,             dS,       sd,               DirectZeroZ,  DirectZeroZ,    bdb,    None,   Immediate,          RegisterA,    None,   DirectAbsoluteZ,    DirectAbsoluteZ,  DirectAbsoluteZ,  al,
+      RelativeAddress,  IndirectZeroIndexY,   IndirectZeroZ,    pdSpY,    sd,               DirectZeroX,  DirectZeroX,    bdby,   None,   DirectAbsoluteY,    None,         None,   al,                 DirectAbsoluteX,  DirectAbsoluteX,  alX,
+      None,             IndirectZeroX,        rl,               dS,       DirectZeroZ,      DirectZeroZ,  DirectZeroZ,    bdb,    None,   Immediate,          RegisterA,    None,   IndirectAbsoluteZ,  DirectAbsoluteZ,  DirectAbsoluteZ,  al,
+      RelativeAddress,  IndirectZeroIndexY,   IndirectZeroZ,    pdSpY,    DirectZeroX,      DirectZeroX,  DirectZeroX,    bdby,   None,   DirectAbsoluteY,    None,         None,   IndirectAbsoluteX,  DirectAbsoluteX,  DirectAbsoluteX,  alX,
+      RelativeAddress,  IndirectZeroX,        rl,               dS,       DirectZeroZ,      DirectZeroZ,  DirectZeroZ,    bdb,    None,   Immediate,          None,         None,   DirectAbsoluteZ,    DirectAbsoluteZ,  DirectAbsoluteZ,  al,
+      RelativeAddress,  IndirectZeroIndexY,   IndirectZeroZ,    pdSpY,    DirectZeroX,      DirectZeroX,  DirectZeroY,    bdby,   None,   DirectAbsoluteY,    None,         None,   DirectAbsoluteZ,    DirectAbsoluteX,  DirectAbsoluteX,  alX,
+      Immediate,        IndirectZeroX,        Immediate,        dS,       DirectZeroZ,      DirectZeroZ,  DirectZeroZ,    bdb,    None,   Immediate,          None,         None,   DirectAbsoluteZ,    DirectAbsoluteZ,  DirectAbsoluteZ,  al,
+      RelativeAddress,  IndirectZeroIndexY,   IndirectZeroZ,    pdSpY,    DirectZeroX,      DirectZeroX,  DirectZeroY,    bdby,   None,   DirectAbsoluteY,    None,         None,   DirectAbsoluteX,    DirectAbsoluteX,  DirectAbsoluteY,  alX,
+      Immediate,        IndirectZeroX,        Immediate,        dS,       DirectZeroZ,      DirectZeroZ,  DirectZeroZ,    bdb,    None,   Immediate,          None,         None,   DirectAbsoluteZ,    DirectAbsoluteZ,  DirectAbsoluteZ,  al,
+      RelativeAddress,  IndirectZeroIndexY,   IndirectZeroZ,    pdSpY,    DirectZeroZ,      DirectZeroX,  DirectZeroX,    bdby,   None,   DirectAbsoluteY,    None,         None,   IndirectAbsoluteZ,  DirectAbsoluteX,  DirectAbsoluteX,  alX,
+      Immediate,        IndirectZeroX,        Immediate,        dS,       DirectZeroZ,      DirectZeroZ,  DirectZeroZ,    bdb,    None,   Immediate,          None,         None,   DirectAbsoluteZ,    DirectAbsoluteZ,  DirectAbsoluteZ,  al,
+      RelativeAddress,  IndirectZeroIndexY,   IndirectZeroZ,    pdSpY,    DirectAbsoluteZ,  DirectZeroX,  DirectZeroX,    bdby,   None,   DirectAbsoluteY,    None,         None,   IndirectAbsoluteX,  DirectAbsoluteX,  DirectAbsoluteX,  alX,
+    };
 
   private:
     class Cpu *cpu_callback;
     uint8_t header[16];
-    uint8_t *PrgRomData;
-    uint8_t *ChrRomData;
+    std::shared_ptr<RomImage> rom;        // PRG / CHR of the loaded ROM, shared with other instances running it
+    RomInfo rom_info;
+    Mapper *mapper;                       // banks point into rom
     uint8_t cpu_mem[0x10000];
+
+    uint8_t *read_pages[0x100];           // direct bytes of each page, nullptr to call read_handlers
+    uint8_t *write_pages[0x100];          // direct bytes of each page, nullptr to call write_handlers
+    BusRead_T read_handlers[0x100];
+    BusWrite_T write_handlers[0x100];
+    void *read_contexts[0x100];
+    void *write_contexts[0x100];
+
+    bool check_pages(uint8_t firstPage, uint16_t count);
+    void pages_changed(uint8_t firstPage, uint16_t count);
+    static uint8_t open_bus_read(void *context, uint16_t address);
+    static void ignore_write(void *context, uint16_t address, uint8_t value);
+
+    BusRead_T ppu_read;                   // map_ppu_registers handlers, nullptr for ppu_registers
+    BusWrite_T ppu_write;
+    void *ppu_context;
+    uint8_t ppu_repeatable;               // bit n: reads of $2000 + n repeat after the first one, see map_ppu_registers
+    uint8_t ppu_registers[8];             // $2000-$2007 until a PPU handles them
+    static uint8_t ppu_register_read(void *context, uint16_t address);
+    static void ppu_register_write(void *context, uint16_t address, uint8_t value);
     uint8_t ppu_mem[0x10000];
+
+    uint16_t dirty_first;                 // first byte of the tracked region
+    uint16_t dirty_size;                  // 0 when nothing is tracked
+    bool dirty_any;
+    uint64_t dirty_bitmap[DirtyWords];
+    void mark_dirty(uint16_t address, uint16_t size);
+    void track_dirty_mirrors();           // dirty_write on the RAM mirrors of the region
+    static void dirty_write(void *context, uint16_t address, uint8_t value);
 };
 #endif
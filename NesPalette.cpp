@@ -0,0 +1,139 @@
+#include "NesPalette.hpp"
+#include <stdio.h>
+#include <math.h>
+
+#define NES_PALETTE_FILE_SIZE           (NesPalette::Colours * 3)
+#define NES_PALETTE_EMPHASIS_FILE_SIZE  (NesPalette::Entries * 3)
+
+// composite signal, volts above sync (nesdev "NTSC video")
+#define SIGNAL_BLACK                    0.518f
+#define SIGNAL_WHITE                    1.962f
+#define SIGNAL_ATTENUATION              0.746f      // an emphasis bit dims the other two thirds of the colour wheel
+#define SIGNAL_GAMMA                    (2.2f / 1.8f)
+
+static uint32_t packColour(int red, int green, int blue)
+{
+  return 0xFF000000 | (red << 16) | (green << 8) | blue;
+}
+
+static int clampChannel(float value)
+{
+  int channel = (int)(255.95f * ((value <= 0.0f) ? 0.0f : powf(value, SIGNAL_GAMMA)));
+  return (channel < 0) ? 0 : (channel > 255) ? 255 : channel;
+}
+
+NesPalette::NesPalette()
+{
+  generate();
+}
+
+// Each colour is a square wave between two levels at one of 12 phases of the
+// colour subcarrier, hue 0 and $D -> $F have no wave. Averaging it over a
+// cycle gives Y, multiplying by the subcarrier gives I and Q. Emphasis
+// attenuates the phases its colour isn't in.
+void NesPalette::generate()
+{
+  static const float levels[8] =
+  {
+    0.350f, 0.518f, 0.962f, 1.550f,   // low
+    1.094f, 1.506f, 1.962f, 1.962f,   // high
+  };
+  static const int emphasisPhases[3] = { 12, 4, 8 };    // red, green, blue
+
+  for (int entry = 0; entry < Entries; entry++)
+  {
+    int hue = entry & 0x0F;
+    int level = (hue < 0x0E) ? (entry >> 4) & 3 : 1;
+    int emphasis = entry >> 6;
+    float low = levels[level + ((hue == 0x00) ? 4 : 0)];
+    float high = levels[level + ((hue < 0x0D) ? 4 : 0)];
+    float y = 0.0f;
+    float i = 0.0f;
+    float q = 0.0f;
+
+    for (int phase = 0; phase < 12; phase++)
+    {
+      float signal = ((hue + phase + 8) % 12 < 6) ? high : low;
+
+      for (int bit = 0; bit < 3; bit++)
+      {
+        if ((emphasis & (1 << bit)) && (emphasisPhases[bit] + phase + 8) % 12 < 6)
+        {
+          signal *= SIGNAL_ATTENUATION;
+          break;
+        }
+      }
+
+      float value = (signal - SIGNAL_BLACK) / (SIGNAL_WHITE - SIGNAL_BLACK) / 12.0f;
+      y += value;
+      i += value * cosf((float)M_PI * phase / 6.0f);
+      q += value * sinf((float)M_PI * phase / 6.0f);
+    }
+
+    colours[entry] = packColour(clampChannel(y + 0.946882f * i + 0.623557f * q),
+                                clampChannel(y - 0.274788f * i - 0.635691f * q),
+                                clampChannel(y - 1.108545f * i + 1.709007f * q));
+  }
+}
+
+// .pal files are raw RGB, 64 colours or all 512 with emphasis
+bool NesPalette::load(const char *fileName)
+{
+  FILE *infile = fopen(fileName, "rb");
+  uint8_t rgb[NES_PALETTE_EMPHASIS_FILE_SIZE + 1];
+
+  if (!infile)
+  {
+    return false;
+  }
+
+  size_t size = fread(rgb, 1, sizeof(rgb), infile);
+  fclose(infile);
+
+  if (size != NES_PALETTE_FILE_SIZE && size != NES_PALETTE_EMPHASIS_FILE_SIZE)
+  {
+    return false;
+  }
+
+  for (size_t entry = 0; entry < size / 3; entry++)
+  {
+    colours[entry] = packColour(rgb[entry * 3], rgb[entry * 3 + 1], rgb[entry * 3 + 2]);
+  }
+
+  if (size == NES_PALETTE_FILE_SIZE)
+  {
+    emphasise();
+  }
+
+  return true;
+}
+
+// emphasis variants of the first 64 colours: each bit dims the two channels
+// it doesn't name
+void NesPalette::emphasise()
+{
+  for (int emphasis = 1; emphasis < Emphases; emphasis++)
+  {
+    float red = (emphasis & 6) ? SIGNAL_ATTENUATION : 1.0f;
+    float green = (emphasis & 5) ? SIGNAL_ATTENUATION : 1.0f;
+    float blue = (emphasis & 3) ? SIGNAL_ATTENUATION : 1.0f;
+
+    for (int colour = 0; colour < Colours; colour++)
+    {
+      uint32_t pixel = colours[colour];
+      colours[emphasis * Colours + colour] = packColour((int)(((pixel >> 16) & 0xFF) * red),
+                                                        (int)(((pixel >> 8) & 0xFF) * green),
+                                                        (int)((pixel & 0xFF) * blue));
+    }
+  }
+}
+
+void NesPalette::convert(const uint8_t *indices, uint8_t emphasis, uint32_t *pixels, size_t count) const
+{
+  const uint32_t *table = getColours(emphasis);
+
+  for (size_t i = 0; i < count; i++)
+  {
+    pixels[i] = table[indices[i] & (Colours - 1)];
+  }
+}
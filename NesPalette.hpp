@@ -0,0 +1,38 @@
+#ifndef NES_PALETTE_HPP
+#define NES_PALETTE_HPP
+#include <stdint.h>
+#include <stddef.h>
+
+// NES colour -> ARGB8888 pixel
+//
+// 64 colours for each of the 8 combinations of the PPUMASK emphasis bits, so
+// turning a line of palette indices into pixels is one table lookup each.
+// Greyscale needs no entries of its own, the PPU masks the index with $30.
+// The table starts out generated from the 2C02's NTSC signal levels and can
+// be replaced from a .pal file.
+class NesPalette
+{
+  public:
+    static const int Colours = 64;
+    static const int Emphases = 8;                // PPUMASK bits 5 -> 7
+    static const int Entries = Colours * Emphases;
+
+    NesPalette();
+
+    bool load(const char *fileName);              // 64 or 512 RGB triplets, emphasis is worked out for 64
+    void generate();                              // NTSC composite decode, emphasis included
+
+    // 64 pixels for the emphasis bits of PPUMASK >> 5
+    inline const uint32_t *getColours(uint8_t emphasis) const
+    {
+      return &colours[(emphasis & (Emphases - 1)) * Colours];
+    }
+
+    void convert(const uint8_t *indices, uint8_t emphasis, uint32_t *pixels, size_t count) const;
+
+  private:
+    uint32_t colours[Entries];                    // ARGB8888, emphasis * 64 + colour
+
+    void emphasise();
+};
+#endif
@@ -1,32 +1,21 @@
 #include "Ppu.hpp"
 #include "SDL2/SDL.h"
+#include <string.h>
 #define WINDOW_WIDTH 1024
 #define WINDOW_HEIGHT 768
 
-const colors Ppu::rgb[] = 
-{
-  {101, 101, 101},
-  {0, 45, 105},
-  {19, 31, 127},
-  {60, 19, 124},
-  {96, 11, 98},
-  {115, 10, 55},
-  {113, 15, 7},
-  {90, 26, 0},
-  {52, 40, 0},
-  {11, 52, 0},
-  {0, 60, 0},
-  {0, 61, 16},
-  {0, 56, 64},
-  {0, 0, 0},
-  {0, 0, 0},
-  {0, 0, 0},
-};
-
 Ppu::Ppu()
-: pWindow(NULL),
-  pRenderer(NULL)
+: chrData(NULL),
+  dirtyFirstRow(0),
+  dirtyLastRow(SCREEN_HEIGHT - 1),
+  presentNeeded(true),
+  pWindow(NULL),
+  pRenderer(NULL),
+  pTexture(NULL)
 {
+  setPalette(NesPalette());
+  memset(framebuffer, 0, sizeof(framebuffer));
+
   if (SDL_Init(SDL_INIT_VIDEO) != 0)
   {
     SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Couldn't initialize SDL: %s", SDL_GetError());
@@ -38,11 +27,23 @@ Ppu::Ppu()
     SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Couldn't initialize renderer/window: %s", SDL_GetError());
     throw "Couldn't initialize renderer/window";
   }
+
+  // nearest neighbour, the texture is scaled up to the window in one copy
+  SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "0");
+  pTexture = SDL_CreateTexture(pRenderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, SCREEN_WIDTH, SCREEN_HEIGHT);
+  if (!pTexture)
+  {
+    SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Couldn't create texture: %s", SDL_GetError());
+    throw "Couldn't create texture";
+  }
 }
 
 Ppu::~Ppu()
 {
-  deletePixels();
+  if (pTexture)
+  {
+    SDL_DestroyTexture(pTexture);
+  }
 
   if (pRenderer)
   {
@@ -62,68 +63,62 @@ void Ppu::SetData(uint8_t *data)
   chrData = data;
 }
 
-void Ppu::addPixels()
+// the display bytes only use the low nybble for colour, rows are 32 bits of
+// the dirty bitmap
+void Ppu::updatePixels(const uint64_t *dirty)
 {
-  int windowHeight;
-  int windowWidth;
-  SDL_GetWindowSize(pWindow, &windowWidth, &windowHeight);
-
-  // field is 32 pixels x 32 pixels
-  int rWidth = windowWidth/32;
-  int rHeight = windowHeight/32;
-  SDL_Rect *sprite;
-  uint8_t rgbValues;
-
-  for (int pixelRow = 0; pixelRow < 32; pixelRow++)
+  for (int row = 0; row < SCREEN_HEIGHT; row++)
   {
-    for (int pixelCol = 0; pixelCol < 32; pixelCol++)
+    uint32_t rowBits = (dirty != NULL) ? (uint32_t)(dirty[row / 2] >> ((row & 1) * 32)) : 0xFFFFFFFF;
+    if (rowBits == 0)
     {
-      sprite = new SDL_Rect();
-      rgbValues = chrData[pixelRow + pixelCol];
-
-      sprite->x = pixelCol * rWidth;
-      sprite->y = pixelRow * rHeight;
-      sprite->w = rWidth;
-      sprite->h = rHeight;
+      continue;
+    }
 
-      pRgb.push_back(rgbValues);
-      pSprites.push_back(sprite);
+    dirtyFirstRow = (row < dirtyFirstRow) ? row : dirtyFirstRow;
+    dirtyLastRow = (row > dirtyLastRow) ? row : dirtyLastRow;
+    for (; rowBits != 0; rowBits &= rowBits - 1)
+    {
+      int pixelNum = row * SCREEN_WIDTH + __builtin_ctz(rowBits);
+      framebuffer[pixelNum] = palette[chrData[pixelNum] & 0x0F];
     }
   }
 }
 
-void Ppu::deletePixels()
+void Ppu::invalidate()
 {
-  SDL_Rect *sprite = NULL;
+  presentNeeded = true;
+}
 
-  while (!pSprites.empty())
+// only the changed rows are uploaded, an unchanged frame isn't presented at all
+bool Ppu::RenderAll()
+{
+  if (dirtyFirstRow > dirtyLastRow && !presentNeeded)
   {
-    sprite = pSprites.back();
-    pSprites.pop_back();
-    delete sprite;
+    return false;
   }
-}
 
-void Ppu::updatePixels()
-{
-  for (int pixelNum = 0; pixelNum < 1024; pixelNum++)
+  if (dirtyFirstRow <= dirtyLastRow)
   {
-    pRgb[pixelNum] = chrData[pixelNum];
+    SDL_Rect rows = { 0, dirtyFirstRow, SCREEN_WIDTH, dirtyLastRow - dirtyFirstRow + 1 };
+    SDL_UpdateTexture(pTexture, &rows, &framebuffer[dirtyFirstRow * SCREEN_WIDTH], SCREEN_WIDTH * sizeof(uint32_t));
   }
+
+  SDL_RenderCopy(pRenderer, pTexture, NULL, NULL);
+  SDL_RenderPresent(pRenderer);
+  dirtyFirstRow = SCREEN_HEIGHT;
+  dirtyLastRow = -1;
+  presentNeeded = false;
+  return true;
 }
 
-void Ppu::RenderAll()
+void Ppu::setPalette(const NesPalette &nesPalette)
 {
-  SDL_SetRenderDrawColor(pRenderer, 0, 0, 0, SDL_ALPHA_OPAQUE);
-  SDL_RenderClear(pRenderer);
-
-  for (size_t i = 0; i < 1024; i++)
+  memcpy(palette, nesPalette.getColours(0), sizeof(palette));
+  if (chrData)
   {
-    SDL_SetRenderDrawColor(pRenderer, rgb[pRgb[i]][0], rgb[pRgb[i]][1], rgb[pRgb[i]][2], SDL_ALPHA_OPAQUE);
-    SDL_RenderFillRect(pRenderer, pSprites[i]);
+    updatePixels(NULL);
   }
-
-  SDL_RenderPresent(pRenderer);
 }
 
 void Ppu::clear_screen()
@@ -132,4 +127,7 @@ void Ppu::clear_screen()
   {
     chrData[i] = 0;
   }
+
+  // written around the Memory dirty bitmap
+  updatePixels(NULL);
 }
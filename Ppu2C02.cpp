@@ -0,0 +1,698 @@
+#include "Cpu.hpp"
+#include "Memory.hpp"
+#include "Mapper.hpp"
+#include "Ppu2C02.hpp"
+#include "Scheduler.hpp"
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// loopy VRAM address fields
+#define VRAM_COARSE_X                   0x001F
+#define VRAM_COARSE_Y                   0x03E0
+#define VRAM_NAMETABLE_X                0x0400
+#define VRAM_NAMETABLE                  0x0C00
+#define VRAM_FINE_Y                     0x7000
+#define VRAM_HORIZONTAL                 (VRAM_COARSE_X | VRAM_NAMETABLE_X)
+#define VRAM_VERTICAL                   (VRAM_COARSE_Y | 0x0800 | VRAM_FINE_Y)
+
+#define ATTRIBUTE_TABLE                 0x03C0      // within a nametable
+#define SPRITES_PER_SCANLINE            8
+#define SCANLINE_TICKS                  (Ppu2C02::DotsPerScanline * Scheduler::PpuDivider)
+
+Ppu2C02::Ppu2C02(Memory *memory)
+: memory(memory),
+  scheduler(nullptr),
+  scanlineEnd(0),
+  boardIrqEvent(-1),
+  tileMapper(nullptr)
+{
+  memset(chrRam, 0, sizeof(chrRam));
+  for (int page = 0; page < 8; page++)
+  {
+    chrRamPages[page] = &chrRam[page * 0x400];
+  }
+
+  reset();
+
+  // state only changes at scanline events and register writes: after one read
+  // PPUSTATUS has vblank and the write toggle clear and reads the same until
+  // the next event, only PPUDATA moves on with every read
+  memory->map_ppu_registers(&Ppu2C02::registerRead, &Ppu2C02::registerWrite, this, (uint8_t)~(1 << (PPUDATA & 0x7)));
+  memory->map_write_handler(OAMDMA >> 8, 1, &Ppu2C02::dmaWrite, this);
+}
+
+Ppu2C02::~Ppu2C02()
+{
+}
+
+// power-on state, VRAM and OAM hold whatever they held
+void Ppu2C02::reset()
+{
+  ctrl = 0;
+  mask = 0;
+  status = 0;
+  oamAddress = 0;
+  latch = 0;
+  readBuffer = 0;
+  v = 0;
+  t = 0;
+  fineX = 0;
+  writeToggle = false;
+  scanline = 0;
+  frameCount = 0;
+
+  memset(name_tables, 0, sizeof(name_tables));
+  memset(oam_entries, 0, sizeof(oam_entries));
+  memset(oamY, 0, sizeof(oamY));
+  memset(oamTile, 0, sizeof(oamTile));
+  memset(oamAttribute, 0, sizeof(oamAttribute));
+  memset(oamX, 0, sizeof(oamX));
+  memset(paletteRam, 0, sizeof(paletteRam));
+  memset(frame, 0, sizeof(frame));
+  memset(emphasis, 0, sizeof(emphasis));
+  mapTables();
+}
+
+void Ppu2C02::attach(Scheduler *newScheduler)
+{
+  scheduler = newScheduler;
+  scanlineEnd = scheduler->getTime() + SCANLINE_TICKS;
+  scheduler->schedule(scheduler->addEvent(&Ppu2C02::scanlineEvent, this), scanlineEnd);
+  boardIrqEvent = scheduler->addEvent(&Ppu2C02::boardIrq, this);
+  scheduler->addCatchUp(&Ppu2C02::clockBoard, this);
+}
+
+void Ppu2C02::runFrame()
+{
+  scheduler->run(scanlineEnd + (ScanlinesPerFrame - 1 - scanline) * SCANLINE_TICKS);
+}
+
+void Ppu2C02::endScanline()
+{
+  if (scanline < Height)
+  {
+    renderScanline();
+  }
+  else if (scanline == VblankScanline)
+  {
+    status |= PPUSTATUS_VBLANK;
+    updateNmi();
+  }
+  else if (scanline == PreRenderScanline)
+  {
+    status &= ~(PPUSTATUS_VBLANK | PPUSTATUS_HIT | PPUSTATUS_OVERFLOW);
+    updateNmi();
+    if (isRendering())
+    {
+      v = (v & ~(VRAM_HORIZONTAL | VRAM_VERTICAL)) | (t & (VRAM_HORIZONTAL | VRAM_VERTICAL));
+    }
+  }
+
+  if (++scanline == ScanlinesPerFrame)
+  {
+    scanline = 0;
+    frameCount++;
+  }
+}
+
+uint16_t Ppu2C02::getScanline()
+{
+  return scanline;
+}
+
+uint64_t Ppu2C02::getFrameCount()
+{
+  return frameCount;
+}
+
+bool Ppu2C02::getNmi()
+{
+  return (status & PPUSTATUS_VBLANK) && (ctrl & PPUCTRL_NMI);
+}
+
+// the CPU latches the rising edge, so enabling NMI during vblank fires one too
+void Ppu2C02::updateNmi()
+{
+  Cpu *cpu = memory->get_cpu();
+
+  if (cpu)
+  {
+    cpu->setNmi(getNmi());
+  }
+}
+
+const uint8_t *Ppu2C02::getFrame()
+{
+  return &frame[0][0];
+}
+
+const uint8_t *Ppu2C02::getEmphasis()
+{
+  return emphasis;
+}
+
+uint8_t Ppu2C02::readRegister(uint16_t address)
+{
+  switch (address)
+  {
+    case PPUSTATUS:
+    {
+      uint8_t value = (status & 0xE0) | (latch & 0x1F);
+      status &= ~PPUSTATUS_VBLANK;
+      writeToggle = false;
+      updateNmi();
+      return value;
+    }
+
+    case OAMDATA:
+      return ((uint8_t *)oam_entries)[oamAddress];
+
+    case PPUDATA:
+    {
+      uint16_t vramAddress = v & 0x3FFF;
+      uint8_t value = readBuffer;
+
+      // palette reads are immediate, the buffer gets the nametable byte under them
+      if (vramAddress >= PALETTE_RAM_INDEXES)
+      {
+        value = (paletteEntry(vramAddress) & 0x3F) | (latch & 0xC0);
+        readBuffer = vramRead(vramAddress - 0x1000);
+      }
+      else
+      {
+        readBuffer = vramRead(vramAddress);
+      }
+
+      v = (v + ((ctrl & PPUCTRL_INCREMENT_MODE) ? 32 : 1)) & 0x7FFF;
+      return value;
+    }
+
+    default:
+      return latch;
+  }
+}
+
+void Ppu2C02::writeRegister(uint16_t address, uint8_t value)
+{
+  latch = value;
+
+  switch (address)
+  {
+    case PPUCTRL:
+      ctrl = value;
+      t = (t & ~VRAM_NAMETABLE) | ((value & PPUCTRL_NAMETABLE_SELECT) << 10);
+      updateNmi();
+      break;
+
+    case PPUMASK:
+      mask = value;
+      break;
+
+    case OAMADDR:
+      oamAddress = value;
+      break;
+
+    case OAMDATA:
+      writeOam(oamAddress++, value);
+      break;
+
+    case PPUSCROLL:
+      if (!writeToggle)
+      {
+        t = (t & ~VRAM_COARSE_X) | (value >> 3);
+        fineX = value & 7;
+      }
+      else
+      {
+        t = (t & ~(VRAM_COARSE_Y | VRAM_FINE_Y)) | ((value & 0xF8) << 2) | ((value & 7) << 12);
+      }
+      writeToggle = !writeToggle;
+      break;
+
+    case PPUADDR:
+      if (!writeToggle)
+      {
+        t = (t & 0x00FF) | ((value & 0x3F) << 8);
+      }
+      else
+      {
+        t = (t & 0xFF00) | value;
+        v = t;
+      }
+      writeToggle = !writeToggle;
+      break;
+
+    case PPUDATA:
+      vramWrite(v & 0x3FFF, value);
+      v = (v + ((ctrl & PPUCTRL_INCREMENT_MODE) ? 32 : 1)) & 0x7FFF;
+      break;
+  }
+}
+
+// the board can change mirroring and CHR banks at any time, picked up once per scanline
+void Ppu2C02::mapTables()
+{
+  static const uint8_t layouts[][4] =
+  {
+    { 0, 0, 1, 1 },     // MirrorHorizontal
+    { 0, 1, 0, 1 },     // MirrorVertical
+    { 0, 0, 0, 0 },     // MirrorSingleLow
+    { 1, 1, 1, 1 },     // MirrorSingleHigh
+    { 0, 1, 2, 3 },     // MirrorFourScreen
+  };
+  Mapper *mapper = memory->get_mapper();
+  const uint8_t *layout = layouts[mapper ? mapper->getMirroring() : Mapper::MirrorHorizontal];
+
+  for (int table = 0; table < 4; table++)
+  {
+    tables[table] = (uint8_t *)&name_tables[layout[table]];
+  }
+  chrPages = mapper ? mapper->getChrPages() : chrRamPages;
+
+  // a new ROM's pages can land where the old one's were
+  if (mapper != tileMapper)
+  {
+    tileCache.clear();
+    tileMapper = mapper;
+  }
+}
+
+// $2000 -> $3EFF, $3000 up mirrors $2000
+uint8_t *Ppu2C02::nameTableByte(uint16_t address)
+{
+  return &tables[(address >> 10) & 3][address & 0x3FF];
+}
+
+// $3F10, $3F14, $3F18 and $3F1C are the backdrop entries of the background palettes
+uint8_t &Ppu2C02::paletteEntry(uint16_t address)
+{
+  uint8_t index = address & 0x1F;
+  return paletteRam[((index & 0x13) == 0x10) ? (index & 0x0F) : index];
+}
+
+uint8_t Ppu2C02::vramRead(uint16_t address)
+{
+  mapTables();
+
+  if (address < NAME_TABLE_0)
+  {
+    return chrPages[address >> 10][address & 0x3FF];
+  }
+
+  if (address < PALETTE_RAM_INDEXES)
+  {
+    return *nameTableByte(address);
+  }
+
+  return paletteEntry(address);
+}
+
+void Ppu2C02::vramWrite(uint16_t address, uint8_t value)
+{
+  mapTables();
+
+  if (address < NAME_TABLE_0)
+  {
+    Mapper *mapper = memory->get_mapper();
+    if (mapper)
+    {
+      mapper->writeChr(address, value);
+    }
+    else
+    {
+      chrRam[address] = value;
+    }
+    tileCache.invalidate(chrPages[address >> 10], address & 0x3FF);
+  }
+  else if (address < PALETTE_RAM_INDEXES)
+  {
+    *nameTableByte(address) = value;
+  }
+  else
+  {
+    paletteEntry(address) = value & 0x3F;
+  }
+}
+
+// OAMDATA and DMA both land here, bits 2 -> 4 of the attribute byte don't exist
+void Ppu2C02::writeOam(uint8_t address, uint8_t value)
+{
+  uint8_t sprite = address >> 2;
+
+  switch (address & 3)
+  {
+    case 0: oamY[sprite] = value; break;
+    case 1: oamTile[sprite] = value; break;
+    case 2: value &= 0xE3; oamAttribute[sprite] = value; break;
+    case 3: oamX[sprite] = value; break;
+  }
+  ((uint8_t *)oam_entries)[address] = value;
+}
+
+bool Ppu2C02::isRendering()
+{
+  return (mask & (PPUMASK_BACKGROUND_ENABLE | PPUMASK_SPRITE_ENABLE)) != 0;
+}
+
+// one visible line into frame, then v moves down a line like the end of a
+// rendered scanline (dots 256 and 257)
+void Ppu2C02::renderScanline()
+{
+  uint8_t *line = frame[scanline];
+  uint8_t colourMask = (mask & PPUMASK_GREYSCALE) ? 0x30 : 0x3F;
+
+  emphasis[scanline] = mask >> 5;
+  if (!isRendering())
+  {
+    memset(line, paletteRam[0] & colourMask, Width);
+    return;
+  }
+
+  mapTables();
+  tileCache.mapPages(chrPages);
+
+  const uint8_t *background = backgroundLine + fineX;
+  if (mask & PPUMASK_BACKGROUND_ENABLE)
+  {
+    renderBackground();
+  }
+  else
+  {
+    memset(backgroundLine, 0, sizeof(backgroundLine));
+  }
+
+  if (!(mask & PPUMASK_BG_LEFT_COLUMN_ENABLE))
+  {
+    memset(backgroundLine + fineX, 0, 8);
+  }
+
+  // sprites are evaluated (overflow) whenever rendering is on, even if they aren't shown
+  bool sprites = renderSprites() && (mask & PPUMASK_SPRITE_ENABLE);
+  if (sprites && !(mask & PPUMASK_LEFT_COLUMN_ENABLE))
+  {
+    memset(spriteLine, 0, 8);
+  }
+
+  uint8_t colours[32];
+  for (int i = 0; i < 32; i++)
+  {
+    colours[i] = paletteRam[i] & colourMask;
+  }
+
+  if (!sprites)
+  {
+    for (int x = 0; x < Width; x++)
+    {
+      line[x] = colours[background[x]];
+    }
+  }
+  else
+  {
+    for (int x = 0; x < Width; x++)
+    {
+      uint8_t backgroundPixel = background[x];
+      uint8_t spritePixel = spriteLine[x];
+      uint8_t index = backgroundPixel;
+
+      if (spritePixel != 0)
+      {
+        if (backgroundPixel != 0 && (spriteFlags[x] & SpriteZero) && x != Width - 1)
+        {
+          status |= PPUSTATUS_HIT;
+        }
+
+        if (backgroundPixel == 0 || !(spriteFlags[x] & SpriteBehind))
+        {
+          index = spritePixel;
+        }
+      }
+
+      line[x] = colours[index];
+    }
+  }
+
+  incrementY();
+  v = (v & ~VRAM_HORIZONTAL) | (t & VRAM_HORIZONTAL);
+}
+
+// 33 tiles from v, the first fineX pixels are scrolled off. A tile row is
+// one load from the tile cache, the palette is ORed into the opaque pixels.
+void Ppu2C02::renderBackground()
+{
+  uint16_t address = v;
+  uint16_t patternTable = (ctrl & PPUCTRL_BACKGROUND_SELECT) ? PATTERN_TABLE_1 : PATTERN_TABLE_0;
+  uint16_t fineY = (v & VRAM_FINE_Y) >> 12;
+  uint8_t *pixels = backgroundLine;
+
+  for (int tile = 0; tile < 33; tile++, pixels += 8)
+  {
+    const uint8_t *nameTable = tables[(address >> 10) & 3];
+    uint8_t tileNumber = nameTable[address & 0x3FF];
+    uint8_t attribute = nameTable[ATTRIBUTE_TABLE | ((address >> 4) & 0x38) | ((address >> 2) & 0x07)];
+    uint64_t palette = (uint64_t)(((attribute >> (((address >> 4) & 4) | (address & 2))) & 3) << 2) * 0x0101010101010101ull;
+
+    uint64_t colours;
+    memcpy(&colours, tileCache.getTile(patternTable | (tileNumber << 4)) + fineY * 8, sizeof(colours));
+    uint64_t opaque = ((colours | (colours >> 1)) & 0x0101010101010101ull) * 0xFF;
+    colours |= palette & opaque;
+    memcpy(pixels, &colours, sizeof(colours));
+
+    // coarse X, wrapping into the next horizontal nametable
+    if ((address & VRAM_COARSE_X) == VRAM_COARSE_X)
+    {
+      address = (address & ~VRAM_COARSE_X) ^ VRAM_NAMETABLE_X;
+    }
+    else
+    {
+      address++;
+    }
+  }
+}
+
+// bit n set when sprite n covers the line being drawn, it was fetched on the
+// line above so a sprite at Y starts on line Y + 1. No sprites on line 0.
+uint64_t Ppu2C02::spritesOnLine(uint8_t height)
+{
+  if (scanline == 0)
+  {
+    return 0;
+  }
+
+  uint8_t line = scanline - 1;
+  uint64_t inRange = 0;
+
+#ifdef __SSE2__
+  // Y <= line and line - Y < height, unsigned bytes with max and saturating subtract
+  const __m128i lines = _mm_set1_epi8((char)line);
+  const __m128i lastRow = _mm_set1_epi8((char)(height - 1));
+  const __m128i zero = _mm_setzero_si128();
+
+  for (int group = 0; group < 4; group++)
+  {
+    __m128i y = _mm_loadu_si128((const __m128i *)&oamY[group * 16]);
+    __m128i above = _mm_cmpeq_epi8(_mm_max_epu8(y, lines), lines);
+    __m128i within = _mm_cmpeq_epi8(_mm_subs_epu8(_mm_subs_epu8(lines, y), lastRow), zero);
+    inRange |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_and_si128(above, within)) << (group * 16);
+  }
+#else
+  for (int sprite = 0; sprite < 64; sprite++)
+  {
+    if (oamY[sprite] <= line && line - oamY[sprite] < height)
+    {
+      inRange |= (uint64_t)1 << sprite;
+    }
+  }
+#endif
+
+  return inRange;
+}
+
+// the first eight sprites in OAM order that cover the line, lower OAM index
+// wins where they overlap: a sprite's row only fills pixels that are opaque
+// in it and still empty in the line. A ninth sets overflow. Returns the
+// number of sprites drawn.
+int Ppu2C02::renderSprites()
+{
+  uint8_t height = (ctrl & PPUCTRL_SPRITE_HEIGHT) ? 16 : 8;
+  uint64_t inRange = spritesOnLine(height);
+  int found = 0;
+
+  if (inRange == 0)
+  {
+    return 0;
+  }
+
+  memset(spriteLine, 0, sizeof(spriteLine));
+  memset(spriteFlags, 0, sizeof(spriteFlags));
+
+  for (; inRange != 0; inRange &= inRange - 1)
+  {
+    if (found == SPRITES_PER_SCANLINE)
+    {
+      status |= PPUSTATUS_OVERFLOW;
+      break;
+    }
+    found++;
+
+    int sprite = __builtin_ctzll(inRange);
+    uint8_t attribute = oamAttribute[sprite];
+    uint8_t tileNumber = oamTile[sprite];
+    uint8_t x = oamX[sprite];
+    int row = scanline - 1 - oamY[sprite];
+
+    if (attribute & OAM_FLIP_VERTICALLY)
+    {
+      row = height - 1 - row;
+    }
+
+    uint16_t pattern;
+    if (height == 16)
+    {
+      pattern = ((tileNumber & 1) ? PATTERN_TABLE_1 : PATTERN_TABLE_0) | ((tileNumber & 0xFE) << 4);
+      pattern += (row & 8) ? 16 : 0;
+    }
+    else
+    {
+      pattern = ((ctrl & PPUCTRL_SPRITE_TILE_SELECT) ? PATTERN_TABLE_1 : PATTERN_TABLE_0) | (tileNumber << 4);
+    }
+    const uint8_t *tile = (attribute & OAM_FLIP_HORIZONTALLY) ? tileCache.getFlippedTile(pattern) : tileCache.getTile(pattern);
+    uint64_t colours;
+    memcpy(&colours, tile + (row & 7) * 8, sizeof(colours));
+
+    uint64_t palette = (uint64_t)(0x10 | ((attribute & OAM_PALETTE) << 2)) * 0x0101010101010101ull;
+    uint64_t flags = (uint64_t)(((attribute & OAM_PRIORITY) ? SpriteBehind : 0) | ((sprite == 0) ? SpriteZero : 0)) * 0x0101010101010101ull;
+    uint64_t pixels;
+    uint64_t pixelFlags;
+    memcpy(&pixels, spriteLine + x, sizeof(pixels));
+    memcpy(&pixelFlags, spriteFlags + x, sizeof(pixelFlags));
+
+    // sprite pixels always have bit 4 set
+    uint64_t opaque = ((colours | (colours >> 1)) & 0x0101010101010101ull) * 0xFF;
+    uint64_t empty = ~(((pixels >> 4) & 0x0101010101010101ull) * 0xFF);
+    uint64_t fill = opaque & empty;
+    pixels |= (colours | palette) & fill;
+    pixelFlags |= flags & fill;
+    memcpy(spriteLine + x, &pixels, sizeof(pixels));
+    memcpy(spriteFlags + x, &pixelFlags, sizeof(pixelFlags));
+  }
+
+  return found;
+}
+
+// fine Y, then coarse Y wrapping from row 29 into the next vertical nametable
+void Ppu2C02::incrementY()
+{
+  if ((v & VRAM_FINE_Y) != VRAM_FINE_Y)
+  {
+    v += 0x1000;
+    return;
+  }
+
+  v &= ~VRAM_FINE_Y;
+  uint16_t coarseY = (v & VRAM_COARSE_Y) >> 5;
+  if (coarseY == 29)
+  {
+    coarseY = 0;
+    v ^= 0x0800;
+  }
+  else if (coarseY == 31)
+  {
+    coarseY = 0;
+  }
+  else
+  {
+    coarseY++;
+  }
+  v = (v & ~VRAM_COARSE_Y) | (coarseY << 5);
+}
+
+uint64_t Ppu2C02::scanlineEvent(void *context, uint64_t time)
+{
+  Ppu2C02 *ppu = (Ppu2C02 *)context;
+
+  ppu->endScanline();
+  ppu->scanlineEnd = time + SCANLINE_TICKS;
+
+  // like the other registers, PPUMASK reaches the board's counter from the next line on
+  Mapper *mapper = ppu->memory->get_mapper();
+  if (mapper)
+  {
+    mapper->setRendering(ppu->isRendering());
+  }
+  ppu->scheduleBoardIrq();
+  return ppu->scanlineEnd;
+}
+
+// A board IRQ due before the next scanline end gets its own batch boundary,
+// the catch-up that reaches it raises the line. One enabled mid-line is seen
+// by the catch-up at the end of the line at the latest.
+void Ppu2C02::scheduleBoardIrq()
+{
+  Mapper *mapper = memory->get_mapper();
+  uint64_t cycles = mapper ? mapper->cyclesUntilIrq() : Mapper::NoIrq;
+  uint64_t now = scheduler->getTime();
+
+  if (cycles != 0 && cycles != Mapper::NoIrq && now + cycles * scheduler->getCpuDivider() < scanlineEnd)
+  {
+    scheduler->schedule(boardIrqEvent, now + cycles * scheduler->getCpuDivider());
+  }
+  else
+  {
+    scheduler->cancel(boardIrqEvent);
+  }
+}
+
+// boards with a scanline counter follow the PPU, which runs with the CPU
+void Ppu2C02::clockBoard(void *context, uint64_t cycles)
+{
+  Mapper *mapper = ((Ppu2C02 *)context)->memory->get_mapper();
+
+  if (mapper)
+  {
+    mapper->runCycles(cycles);
+  }
+}
+
+uint64_t Ppu2C02::boardIrq(void *context, uint64_t time)
+{
+  return Scheduler::Never;
+}
+
+uint8_t Ppu2C02::registerRead(void *context, uint16_t address)
+{
+  return ((Ppu2C02 *)context)->readRegister(address);
+}
+
+void Ppu2C02::registerWrite(void *context, uint16_t address, uint8_t value)
+{
+  ((Ppu2C02 *)context)->writeRegister(address, value);
+}
+
+// $4014 copies a CPU page into OAM from OAMADDR, the rest of $40xx stays plain memory.
+// The CPU is halted for the copy: 513 cycles, and one more to line up when it
+// starts on an odd cycle.
+void Ppu2C02::dmaWrite(void *context, uint16_t address, uint8_t value)
+{
+  Ppu2C02 *ppu = (Ppu2C02 *)context;
+
+  if (address != OAMDMA)
+  {
+    *ppu->memory->get_memory(address) = value;
+    return;
+  }
+
+  for (uint16_t i = 0; i < 0x100; i++)
+  {
+    ppu->writeRegister(OAMDATA, ppu->memory->bus_read((value << 8) | i));
+  }
+
+  Cpu *cpu = ppu->memory->get_cpu();
+  if (cpu)
+  {
+    uint64_t cycle = cpu->getBatchCycles() + (ppu->scheduler ? ppu->scheduler->getCpuCycles() : 0);
+    cpu->stall(DmaCycles + (uint32_t)(cycle & 1));
+  }
+}
@@ -0,0 +1,212 @@
+#ifndef PPU_2C02_HPP
+#define PPU_2C02_HPP
+#include <stdint.h>
+#include <stddef.h>
+#include "TileCache.hpp"
+
+class Memory;
+class Mapper;
+class Scheduler;
+
+// Object Attribute Memory can be viewed as an array with 64 entries
+typedef struct 
+{
+  uint8_t y;
+  uint8_t tile_number;
+  // For 8x8 sprites, this is the tile number of this sprite within the pattern table selected in bit 3 of PPUCTRL ($2000).
+  // For 8x16 sprites, the PPU ignores the pattern table selection and selects a pattern table from bit 0 of this number.
+  uint8_t attribute;
+#define OAM_PALETTE           (0x3 << 0)    // Palette (4 to 7) of sprite
+#define OAM_PRIORITY          (0x1 << 5)    // Priority (0: in front of background; 1: behind background)
+#define OAM_FLIP_HORIZONTALLY (0x1 << 6)    // Flip sprite horizontally
+#define OAM_FLIP_VERTICALLY   (0x1 << 7)    // Flip sprite vertically
+  uint8_t x;
+} oam_t;
+
+typedef struct
+{
+  uint8_t data;
+} tile_t;
+
+#define TABLE_TILE_ROW_COUNT 30
+#define TABLE_TILE_COL_COUNT 32
+#define TABLE_ATTRIBUTE_ROW_COUNT 8
+#define TABLE_ATTRIBUTE_COL_COUNT 8
+
+typedef struct
+{
+  uint8_t tile[TABLE_TILE_ROW_COUNT][TABLE_TILE_COL_COUNT];                       // 960 bytes
+  uint8_t attribute_table[TABLE_ATTRIBUTE_ROW_COUNT][TABLE_ATTRIBUTE_ROW_COUNT];  // 64 bytes
+#define TOP_LEFT_QUADRANT_MASK      (0x3 << 0)
+#define TOP_RIGHT_QUADRANT_MASK     (0x3 << 2)
+#define BOTTOM_LEFT_QUADRANT_MASK   (0x3 << 4)
+#define BOTTOM_RIGHT_QUADRANT_MASK  (0x3 << 6)
+} name_table_t;
+
+#define TOP_LEFT_NAME_TABLE       1     // 0x2000
+#define TOP_RIGHT_NAME_TABLE      2     // 0x2400
+#define BOTTOM_LEFT_NAME_TABLE    3     // 0x2800
+#define BOTTOM_RIGHT_NAME_TABLE   4     // 0x2C00
+//       (0,0)     (256,0)     (511,0)
+//         +-----------+-----------+
+//         |           |           |
+//         |           |           |
+//         |   $2000   |   $2400   |
+//         |           |           |
+//         |           |           |
+//  (0,240)+-----------+-----------+(511,240)
+//         |           |           |
+//         |           |           |
+//         |   $2800   |   $2C00   |
+//         |           |           |
+//         |           |           |
+//         +-----------+-----------+
+//       (0,479)   (256,479)   (511,479)
+
+// memory map
+// 0x0000 - 0x3FFF - addressable area
+// (2k ram mapped to name table)
+
+// CHR-ROM
+// Pattern table address format: 000H RRRR CCCC PTTT
+#define PATTERN_TABLE_0       0x0000      // 0x1000 bytes - Left pattern table
+#define PATTERN_TABLE_1       0x1000      // 0x1000 bytes - Right pattern table
+#define PATTERN_FINE_Y_OFFSET (0x3 << 0)  // row number within tile
+#define PATTERN_BIT_PLANE     (0x1 << 3)  // lower/upper = 0/1
+#define PATTERN_TILE_COLUMN   (0xF << 4)  // tile column
+#define PATTERN_TILE_ROW      (0xF << 8)  // tile row
+#define PATTERN_TABLE_HALF    (0x1 << 12) // pattern table half
+
+// VRAM (mapped to 2kb internal VRAM)
+#define NAME_TABLE_0          0x2000    // 0x400 bytes
+#define NAME_TABLE_1          0x2400    // 0x400 bytes
+#define NAME_TABLE_2          0x2800    // 0x400 bytes
+#define NAME_TABLE_3          0x2C00    // 0x400 bytes
+
+#define MIRROR_1_BEGIN        0x3000    // 0x400 bytes
+#define MIRROR_1_END          0x3EFF    // 
+
+#define PALETTE_RAM_INDEXES   0x3F00    // 0x20 bytes
+// $3F00        Universal background color
+// $3F01-$3F03 	Background palette 0
+// $3F05-$3F07 	Background palette 1
+// $3F09-$3F0B 	Background palette 2
+// $3F0D-$3F0F 	Background palette 3
+// $3F11-$3F13 	Sprite palette 0
+// $3F15-$3F17 	Sprite palette 1
+// $3F19-$3F1B 	Sprite palette 2
+// $3F1D-$3F1F 	Sprite palette 3
+
+#define MIRROR_2_BEGIN        0x3F20    // 0xE0 bytes - mirrors palette indexes 3F00 - 3F1F
+#define MIRROR_2_END          0x3FFF
+
+// 2C02 picture processing unit
+//
+// Registers ($2000-$3FFF mirrored, OAM DMA at $4014) are mapped on the Memory
+// bus. The picture is produced a scanline at a time: the CPU runs for one
+// scanline of cycles (a Scheduler event at each scanline end), then the
+// whole line is drawn from the registers, VRAM and OAM as they are at that
+// point. Writes in the middle of a line take
+// effect on the next one. Pattern tables come from the cartridge board's CHR
+// pages, or 8KB of CHR RAM when there is no board.
+class Ppu2C02
+{
+  public:
+    static const int Width = 256;
+    static const int Height = 240;
+    static const uint32_t DotsPerScanline = 341;
+    static const uint32_t ScanlinesPerFrame = 262;
+    static const uint32_t DotsPerCpuCycle = 3;
+    static const uint16_t VblankScanline = 241;
+    static const uint16_t PreRenderScanline = 261;
+    static const uint32_t DmaCycles = 513;        // CPU cycles an OAM DMA halts it for, 514 from an odd cycle
+
+    Ppu2C02(Memory *memory);
+    ~Ppu2C02();
+
+    void reset();
+    void attach(Scheduler *scheduler);            // scanline ends become events, the board is clocked with the CPU
+    void runFrame();                              // run the attached scheduler through the pre-render line
+    void endScanline();                           // the CPU reached the end of the current scanline
+    uint16_t getScanline();                       // next scanline endScanline finishes, 0 -> 261
+    uint64_t getFrameCount();
+    bool getNmi();                                // vblank with NMI enabled, the CPU's NMI line
+    const uint8_t *getFrame();                    // Width x Height colours, 0 -> 63 of the NES palette
+    const uint8_t *getEmphasis();                 // PPUMASK emphasis bits (>> 5) of each line, see NesPalette
+
+    uint8_t readRegister(uint16_t address);       // $2000 -> $2007
+    void writeRegister(uint16_t address, uint8_t value);
+
+  private:
+    Memory *memory;
+
+    // registers
+    uint8_t ctrl;                                 // PPUCTRL
+    uint8_t mask;                                 // PPUMASK
+    uint8_t status;                               // PPUSTATUS
+    uint8_t oamAddress;                           // OAMADDR
+    uint8_t latch;                                // last value written to any register, read back from write-only ones
+    uint8_t readBuffer;                           // PPUDATA reads below the palette are one access behind
+    uint16_t v;                                   // VRAM address: yyy NN YYYYY XXXXX (fine Y, nametable, coarse Y, coarse X)
+    uint16_t t;                                   // temporary VRAM address, top left of the screen
+    uint8_t fineX;                                // fine X scroll
+    bool writeToggle;                             // second write of PPUSCROLL / PPUADDR
+
+    // memory
+    name_table_t name_tables[4];                  // 2KB CIRAM, all four with four-screen boards
+    oam_t oam_entries[64];
+    uint8_t oamY[64];                             // oam_entries by field, for evaluating a line 16 sprites at a time
+    uint8_t oamTile[64];
+    uint8_t oamAttribute[64];
+    uint8_t oamX[64];
+    uint8_t paletteRam[32];
+    uint8_t chrRam[0x2000];                       // pattern tables without a board
+    const uint8_t *chrRamPages[8];
+
+    uint16_t scanline;
+    uint64_t frameCount;
+    Scheduler *scheduler;
+    uint64_t scanlineEnd;                         // master clock of the next endScanline event
+    int boardIrqEvent;                            // batch boundary at the board's next IRQ
+    uint8_t frame[Height][Width];
+    uint8_t emphasis[Height];
+
+    // per scanline
+    uint8_t *tables[4];                           // $2000, $2400, $2800, $2C00 after mirroring
+    const uint8_t *const *chrPages;               // $0000 -> $1FFF in 1KB pages
+    TileCache tileCache;                          // chrPages expanded a byte per pixel
+    Mapper *tileMapper;                           // board the cached pages came from
+    uint8_t backgroundLine[Width + 16];           // palette index 0 -> 15, 0 transparent, starts fineX early
+    uint8_t spriteLine[Width + 8];                // palette index 16 -> 31, 0 transparent, sprites at x > 248 spill over
+    uint8_t spriteFlags[Width + 8];               // SpriteBehind / SpriteZero of the pixel in spriteLine
+
+    enum SpritePixelFlags
+    {
+      SpriteBehind  = 1,
+      SpriteZero    = 2,
+    };
+
+    void mapTables();
+    uint8_t *nameTableByte(uint16_t address);
+    uint8_t vramRead(uint16_t address);
+    void vramWrite(uint16_t address, uint8_t value);
+    uint8_t &paletteEntry(uint16_t address);
+    void writeOam(uint8_t address, uint8_t value);
+
+    bool isRendering();
+    void renderScanline();
+    void renderBackground();
+    uint64_t spritesOnLine(uint8_t height);
+    int renderSprites();
+    void incrementY();
+    void updateNmi();                             // drive the CPU's NMI line from getNmi
+    void scheduleBoardIrq();
+
+    static uint8_t registerRead(void *context, uint16_t address);
+    static void registerWrite(void *context, uint16_t address, uint8_t value);
+    static void dmaWrite(void *context, uint16_t address, uint8_t value);
+    static uint64_t scanlineEvent(void *context, uint64_t time);
+    static void clockBoard(void *context, uint64_t cycles);
+    static uint64_t boardIrq(void *context, uint64_t time);
+};
+#endif
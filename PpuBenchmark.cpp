@@ -0,0 +1,125 @@
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+#include <string.h>
+#include <stdio.h>
+#include "Cpu.hpp"
+#include "Memory.hpp"
+#include "Ppu2C02.hpp"
+
+// Renders frames of a busy synthetic scene and reports the time per frame.
+// Everything goes through the PPU registers like a game would set it up:
+// random CHR RAM, all four nametables and attribute tables, palettes, and 64
+// sprites (8x16, flipped, overlapping, more than eight on some lines) loaded
+// with OAM DMA. The scroll moves every frame so no two frames are the same.
+//
+// The checksum covers every rendered frame and the status flags, renderer
+// changes must keep it ("--frames N" changes it).
+
+#define PPU_BENCHMARK_FRAMES    2000
+#define PPU_BENCHMARK_SEED      1234
+
+static uint32_t benchmarkRandom = PPU_BENCHMARK_SEED;
+
+static uint8_t nextRandom()
+{
+  benchmarkRandom = benchmarkRandom * 1103515245 + 12345;
+  return (uint8_t)(benchmarkRandom >> 16);
+}
+
+static void setupScene(Memory &memory)
+{
+  // pattern tables, nametables and attributes
+  memory.bus_write(PPUADDR, 0x00);
+  memory.bus_write(PPUADDR, 0x00);
+  for (uint32_t i = 0; i < 0x3000; i++)
+  {
+    memory.bus_write(PPUDATA, nextRandom());
+  }
+
+  memory.bus_write(PPUADDR, 0x3F);
+  memory.bus_write(PPUADDR, 0x00);
+  for (uint32_t i = 0; i < 0x20; i++)
+  {
+    memory.bus_write(PPUDATA, nextRandom() & 0x3F);
+  }
+
+  // OAM from $0200, a cluster of sprites on the same lines for the overflow flag
+  uint8_t *oam = memory.get_memory(0x200);
+  for (uint32_t sprite = 0; sprite < 64; sprite++)
+  {
+    oam[sprite * 4 + 0] = (sprite < 12) ? 100 + sprite : nextRandom() % 240;
+    oam[sprite * 4 + 1] = nextRandom();
+    oam[sprite * 4 + 2] = nextRandom();
+    oam[sprite * 4 + 3] = nextRandom();
+  }
+  memory.bus_write(OAMADDR, 0x00);
+  memory.bus_write(OAMDMA, 0x02);
+
+  memory.bus_write(PPUCTRL, PPUCTRL_SPRITE_HEIGHT | PPUCTRL_BACKGROUND_SELECT);
+  memory.bus_write(PPUMASK, PPUMASK_SPRITE_ENABLE | PPUMASK_BACKGROUND_ENABLE | PPUMASK_LEFT_COLUMN_ENABLE);
+}
+
+// FNV-1a
+static uint32_t hashBytes(uint32_t hash, const uint8_t *bytes, size_t size)
+{
+  for (size_t i = 0; i < size; i++)
+  {
+    hash = (hash ^ bytes[i]) * 16777619u;
+  }
+
+  return hash;
+}
+
+int main(int argc, char *argv[])
+{
+  typedef std::chrono::high_resolution_clock Time;
+  uint64_t frames = PPU_BENCHMARK_FRAMES;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+    {
+      frames = strtoull(argv[++i], nullptr, 0);
+    }
+  }
+
+  Memory memory;
+  Ppu2C02 ppu(&memory);
+  uint32_t hash = 2166136261u;
+  double seconds = 0;
+
+  setupScene(memory);
+
+  for (uint64_t frame = 0; frame < frames; frame++)
+  {
+    memory.bus_write(PPUSCROLL, (uint8_t)(frame * 3));
+    memory.bus_write(PPUSCROLL, (uint8_t)(frame % 240));
+
+    // sprite 0 hit and overflow are cleared on the pre-render line, read them after the picture
+    auto startTime = Time::now();
+    while (ppu.getScanline() != Ppu2C02::Height)
+    {
+      ppu.endScanline();
+    }
+    seconds += std::chrono::duration<double>(Time::now() - startTime).count();
+
+    uint8_t status = memory.bus_read(PPUSTATUS);
+
+    startTime = Time::now();
+    do
+    {
+      ppu.endScanline();
+    }
+    while (ppu.getScanline() != 0);
+    seconds += std::chrono::duration<double>(Time::now() - startTime).count();
+
+    hash = hashBytes(hash, ppu.getFrame(), Ppu2C02::Width * Ppu2C02::Height);
+    hash = hashBytes(hash, &status, 1);
+  }
+
+  printf("%-10s %12s %10s %12s %10s\n", "renderer", "frames", "seconds", "us/frame", "checksum");
+  printf("%-10s %12llu %10.3f %12.2f   %08x\n", "scanline", (unsigned long long)frames, seconds,
+      seconds * 1000000.0 / frames, hash);
+  return 0;
+}
@@ -0,0 +1,283 @@
+#include <cstdlib>
+#include <string.h>
+#include <stdio.h>
+#include "Cpu.hpp"
+#include "Memory.hpp"
+#include "Ppu2C02.hpp"
+
+// Compares the frames Ppu2C02 renders with a plain pixel by pixel renderer.
+// The scene is random CHR RAM, nametables and palettes, loaded through the PPU
+// registers with no mapper (horizontal mirroring). Each trial loads random OAM
+// (every other one crowds sprites on the same lines), picks random PPUCTRL,
+// PPUMASK and scroll values, renders a frame and checks every pixel, the
+// sprite 0 hit and the sprite overflow flag.
+//
+// Prints the mismatches and exits with 1 if there are any ("--trials N").
+
+#define PPU_CHECK_TRIALS    400
+#define PPU_CHECK_SEED      99
+
+static uint32_t checkRandom = PPU_CHECK_SEED;
+
+static uint8_t nextRandom()
+{
+  checkRandom = checkRandom * 1103515245 + 12345;
+  return (uint8_t)(checkRandom >> 16);
+}
+
+// what the reference renderer reads, written to the PPU as well
+static uint8_t chr[0x2000];
+static uint8_t nametables[2][0x400];          // $2000 and $2800, $2400 and $2C00 mirror them
+static uint8_t palette[0x20];
+static uint8_t oam[0x100];
+
+static void setupScene(Memory &memory)
+{
+  memory.bus_write(PPUADDR, 0x00);
+  memory.bus_write(PPUADDR, 0x00);
+  for (uint32_t i = 0; i < sizeof(chr); i++)
+  {
+    chr[i] = nextRandom();
+    memory.bus_write(PPUDATA, chr[i]);
+  }
+
+  for (uint32_t table = 0; table < 2; table++)
+  {
+    memory.bus_write(PPUADDR, 0x20 + table * 0x08);
+    memory.bus_write(PPUADDR, 0x00);
+    for (uint32_t i = 0; i < 0x400; i++)
+    {
+      nametables[table][i] = nextRandom();
+      memory.bus_write(PPUDATA, nametables[table][i]);
+    }
+  }
+
+  memory.bus_write(PPUADDR, 0x3F);
+  memory.bus_write(PPUADDR, 0x00);
+  for (uint32_t i = 0; i < sizeof(palette); i++)
+  {
+    palette[i] = nextRandom() & 0x3F;
+    memory.bus_write(PPUDATA, palette[i]);
+  }
+
+  // $3F10/$3F14/$3F18/$3F1C are the background entries, the later writes win
+  for (uint32_t i = 0; i < 0x10; i += 4)
+  {
+    palette[i] = palette[i + 0x10];
+  }
+}
+
+static void setupSprites(Memory &memory, bool crowded)
+{
+  for (uint32_t i = 0; i < sizeof(oam); i++)
+  {
+    oam[i] = nextRandom();
+  }
+
+  for (uint32_t sprite = 0; sprite < 64; sprite++)
+  {
+    if (crowded)
+    {
+      oam[sprite * 4 + 0] = 80 + sprite / 4;
+    }
+
+    // attribute bits 4-2 don't exist
+    oam[sprite * 4 + 2] &= 0xE3;
+  }
+
+  memcpy(memory.get_memory(0x300), oam, sizeof(oam));
+  memory.bus_write(OAMADDR, 0x00);
+  memory.bus_write(OAMDMA, 0x03);
+}
+
+// 2 bit pixel of the pattern table row at address, column 0 is the left one
+static uint8_t patternPixel(uint32_t address, uint32_t column)
+{
+  return ((chr[address] >> (7 - column)) & 1) | (((chr[address + 8] >> (7 - column)) & 1) << 1);
+}
+
+// palette index of the background at x, y: 0 transparent, else 1 -> 15
+static uint8_t backgroundPixel(uint8_t ctrl, uint32_t scrollX, uint32_t scrollY, uint32_t x, uint32_t y)
+{
+  uint32_t worldX = (scrollX + x + (ctrl & 0x01) * 256) % 512;
+  uint32_t worldY = (scrollY + y + ((ctrl >> 1) & 0x01) * 240) % 480;
+  const uint8_t *nametable = nametables[worldY / 240];
+  uint32_t tileX = (worldX % 256) / 8;
+  uint32_t tileY = (worldY % 240) / 8;
+
+  uint8_t tile = nametable[tileY * 32 + tileX];
+  uint8_t attribute = nametable[0x3C0 + (tileY / 4) * 8 + tileX / 4];
+  uint8_t paletteNumber = (attribute >> (((tileY / 2) & 1) * 4 + ((tileX / 2) & 1) * 2)) & 3;
+
+  uint32_t address = ((ctrl & PPUCTRL_BACKGROUND_SELECT) ? 0x1000 : 0) + tile * 16 + (worldY & 7);
+  uint8_t pixel = patternPixel(address, worldX & 7);
+
+  return pixel ? paletteNumber * 4 + pixel : 0;
+}
+
+// renders the frame the way the PPU describes it and compares it with frame,
+// returns the mismatches
+static uint32_t compareFrame(uint8_t ctrl, uint8_t mask, uint32_t scrollX, uint32_t scrollY, const uint8_t *frame, uint8_t status, uint32_t trial)
+{
+  uint32_t height = (ctrl & PPUCTRL_SPRITE_HEIGHT) ? 16 : 8;
+  uint32_t mismatches = 0;
+  bool hit = false;
+  bool overflow = false;
+
+  for (uint32_t y = 0; y < Ppu2C02::Height; y++)
+  {
+    // the first eight sprites in range, OAM Y is one line above the sprite
+    uint32_t selected[8];
+    uint32_t count = 0;
+    for (uint32_t sprite = 0; sprite < 64; sprite++)
+    {
+      uint32_t row = y - oam[sprite * 4] - 1;
+      if (row < height)
+      {
+        if (count == 8)
+        {
+          overflow = true;
+          break;
+        }
+        selected[count++] = sprite;
+      }
+    }
+
+    for (uint32_t x = 0; x < Ppu2C02::Width; x++)
+    {
+      uint8_t background = 0;
+      if (x >= 8 || (mask & PPUMASK_BG_LEFT_COLUMN_ENABLE))
+      {
+        background = backgroundPixel(ctrl, scrollX, scrollY, x, y);
+      }
+
+      // the first opaque sprite pixel in OAM order wins
+      uint8_t sprite = 0;
+      bool behind = false;
+      bool spriteZero = false;
+      for (uint32_t i = 0; i < count && (x >= 8 || (mask & PPUMASK_LEFT_COLUMN_ENABLE)); i++)
+      {
+        const uint8_t *entry = &oam[selected[i] * 4];
+        uint32_t column = x - entry[3];
+        if (column >= 8)
+        {
+          continue;
+        }
+
+        uint32_t row = y - entry[0] - 1;
+        row = (entry[2] & 0x80) ? height - 1 - row : row;
+        column = (entry[2] & 0x40) ? 7 - column : column;
+
+        uint32_t address;
+        if (height == 16)
+        {
+          address = ((entry[1] & 1) ? 0x1000 : 0) + (entry[1] & 0xFE) * 16 + ((row & 8) ? 16 : 0) + (row & 7);
+        }
+        else
+        {
+          address = ((ctrl & PPUCTRL_SPRITE_TILE_SELECT) ? 0x1000 : 0) + entry[1] * 16 + row;
+        }
+
+        uint8_t pixel = patternPixel(address, column);
+        if (pixel)
+        {
+          sprite = 0x10 + (entry[2] & 3) * 4 + pixel;
+          behind = (entry[2] & 0x20) != 0;
+          spriteZero = (selected[i] == 0);
+          break;
+        }
+      }
+
+      uint8_t index = background;
+      if (sprite)
+      {
+        hit |= (background && spriteZero && x != 255);
+        index = (background && behind) ? background : sprite;
+      }
+
+      uint8_t colour = palette[index] & ((mask & PPUMASK_GREYSCALE) ? 0x30 : 0x3F);
+      if (frame[y * Ppu2C02::Width + x] != colour)
+      {
+        if (mismatches < 5)
+        {
+          printf("trial %u x %u y %u: %02x, expected %02x (ctrl %02x mask %02x)\n", trial, x, y,
+              frame[y * Ppu2C02::Width + x], colour, ctrl, mask);
+        }
+        mismatches++;
+      }
+    }
+  }
+
+  if (hit != ((status & PPUSTATUS_HIT) != 0) || overflow != ((status & PPUSTATUS_OVERFLOW) != 0))
+  {
+    printf("trial %u: status %02x, expected hit %d overflow %d\n", trial, status, hit, overflow);
+    mismatches++;
+  }
+
+  return mismatches;
+}
+
+int main(int argc, char *argv[])
+{
+  uint32_t trials = PPU_CHECK_TRIALS;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "--trials") == 0 && i + 1 < argc)
+    {
+      trials = strtoul(argv[++i], nullptr, 0);
+    }
+  }
+
+  Memory memory;
+  Ppu2C02 ppu(&memory);
+  uint32_t mismatches = 0;
+  uint32_t hits = 0;
+  uint32_t overflows = 0;
+
+  setupScene(memory);
+
+  for (uint32_t trial = 0; trial < trials; trial++)
+  {
+    setupSprites(memory, trial & 1);
+
+    uint8_t ctrl = nextRandom() & (PPUCTRL_SPRITE_HEIGHT | PPUCTRL_BACKGROUND_SELECT | PPUCTRL_SPRITE_TILE_SELECT | PPUCTRL_NAMETABLE_SELECT);
+    uint8_t mask = PPUMASK_SPRITE_ENABLE | PPUMASK_BACKGROUND_ENABLE |
+        (nextRandom() & (PPUMASK_LEFT_COLUMN_ENABLE | PPUMASK_BG_LEFT_COLUMN_ENABLE | PPUMASK_GREYSCALE));
+    uint8_t scrollX = nextRandom();
+    uint8_t scrollY = nextRandom() % 240;
+
+    memory.bus_write(PPUCTRL, ctrl);
+    memory.bus_write(PPUMASK, mask);
+    memory.bus_read(PPUSTATUS);
+    memory.bus_write(PPUSCROLL, scrollX);
+    memory.bus_write(PPUSCROLL, scrollY);
+
+    // the pre-render line loads the scroll, so finish the frame in progress first
+    do
+    {
+      ppu.endScanline();
+    }
+    while (ppu.getScanline() != 0);
+
+    // sprite 0 hit and overflow are cleared on the pre-render line, read them after the picture
+    while (ppu.getScanline() != Ppu2C02::Height)
+    {
+      ppu.endScanline();
+    }
+
+    uint8_t status = memory.bus_read(PPUSTATUS);
+    mismatches += compareFrame(ctrl, mask, scrollX, scrollY, ppu.getFrame(), status, trial);
+    hits += (status & PPUSTATUS_HIT) != 0;
+    overflows += (status & PPUSTATUS_OVERFLOW) != 0;
+
+    do
+    {
+      ppu.endScanline();
+    }
+    while (ppu.getScanline() != 0);
+  }
+
+  printf("%u frames, %u sprite 0 hits, %u overflows, %u mismatches\n", trials, hits, overflows, mismatches);
+  return mismatches ? 1 : 0;
+}
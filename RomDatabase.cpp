@@ -0,0 +1,331 @@
+#include "RomDatabase.hpp"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#define RomDatabaseLineSize       4096
+
+// CRC-32 (IEEE, reflected 0xEDB88320), slice-by-8: eight bytes per step
+// through eight tables instead of one table lookup per byte
+struct Crc32Tables_T
+{
+  uint32_t table[8][256];
+
+  Crc32Tables_T()
+  {
+    for (uint32_t i = 0; i < 256; i++)
+    {
+      uint32_t crc = i;
+      for (int bit = 0; bit < 8; bit++)
+      {
+        crc = (crc & 1) ? 0xEDB88320 ^ (crc >> 1) : crc >> 1;
+      }
+      table[0][i] = crc;
+    }
+
+    for (uint32_t i = 0; i < 256; i++)
+    {
+      for (int slice = 1; slice < 8; slice++)
+      {
+        table[slice][i] = (table[slice - 1][i] >> 8) ^ table[0][table[slice - 1][i] & 0xFF];
+      }
+    }
+  }
+};
+
+static uint32_t crc32(const uint8_t *data, size_t size)
+{
+  static const Crc32Tables_T tables;
+  const uint32_t (*table)[256] = tables.table;
+  uint32_t crc = 0xFFFFFFFF;
+
+  for (; size >= 8; data += 8, size -= 8)
+  {
+    uint32_t low = crc ^ (data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24));
+    uint32_t high = data[4] | (data[5] << 8) | (data[6] << 16) | ((uint32_t)data[7] << 24);
+
+    crc = table[7][low & 0xFF] ^ table[6][(low >> 8) & 0xFF] ^ table[5][(low >> 16) & 0xFF] ^ table[4][low >> 24]
+        ^ table[3][high & 0xFF] ^ table[2][(high >> 8) & 0xFF] ^ table[1][(high >> 16) & 0xFF] ^ table[0][high >> 24];
+  }
+
+  for (; size != 0; data++, size--)
+  {
+    crc = table[0][(crc ^ *data) & 0xFF] ^ (crc >> 8);
+  }
+
+  return ~crc;
+}
+
+RomDatabase::RomDatabase()
+: hashCacheChanged(false)
+{
+}
+
+bool RomDatabase::load(const char *fileName)
+{
+  FILE *infile = fopen(fileName, "r");
+  char line[RomDatabaseLineSize];
+  int lineNumber = 0;
+
+  if (!infile)
+  {
+    return false;
+  }
+
+  while (fgets(line, sizeof(line), infile))
+  {
+    lineNumber++;
+
+    char *comment = strchr(line, '#');
+    if (comment)
+    {
+      *comment = 0;
+    }
+
+    char *token = strtok(line, " \t\r\n");
+    if (token == nullptr)
+    {
+      continue;
+    }
+
+    char *end;
+    uint32_t hash = strtoul(token, &end, 16);
+    if (*end != 0)
+    {
+      printf("%s:%d: bad hash %s\n", fileName, lineNumber, token);
+      continue;
+    }
+
+    Entry entry;
+    entry.fields = 0;
+    memset(&entry.info, 0, sizeof(entry.info));
+
+    bool good = true;
+    while (good && (token = strtok(nullptr, " \t\r\n")) != nullptr)
+    {
+      char *value = strchr(token, '=');
+      if (value)
+      {
+        *value++ = 0;
+      }
+      good = value != nullptr && parseField(token, value, entry);
+    }
+
+    if (!good)
+    {
+      printf("%s:%d: bad field %s\n", fileName, lineNumber, token);
+      continue;
+    }
+
+    entries[hash] = entry;
+  }
+
+  fclose(infile);
+  return true;
+}
+
+bool RomDatabase::parseField(const char *name, const char *value, Entry &entry)
+{
+  struct
+  {
+    const char *name;
+    uint32_t field;
+    uint32_t *size;
+  } sizes[] =
+  {
+    { "prgram",   FieldPrgRam,    &entry.info.prgRamSize   },
+    { "prgnvram", FieldPrgNvram,  &entry.info.prgNvramSize },
+    { "chrram",   FieldChrRam,    &entry.info.chrRamSize   },
+    { "chrnvram", FieldChrNvram,  &entry.info.chrNvramSize },
+  };
+
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+  {
+    if (strcmp(name, sizes[i].name) == 0)
+    {
+      *sizes[i].size = strtoul(value, nullptr, 0);
+      entry.fields |= sizes[i].field;
+      return true;
+    }
+  }
+
+  if (strcmp(name, "mapper") == 0)
+  {
+    entry.info.mapper = strtoul(value, nullptr, 0);
+    entry.fields |= FieldMapper;
+  }
+  else if (strcmp(name, "submapper") == 0)
+  {
+    entry.info.submapper = strtoul(value, nullptr, 0);
+    entry.fields |= FieldSubmapper;
+  }
+  else if (strcmp(name, "battery") == 0)
+  {
+    entry.info.battery = strtoul(value, nullptr, 0) != 0;
+    entry.fields |= FieldBattery;
+  }
+  else if (strcmp(name, "mirroring") == 0)
+  {
+    switch (value[0])
+    {
+      case 'h': entry.info.mirroring = Mapper::MirrorHorizontal; break;
+      case 'v': entry.info.mirroring = Mapper::MirrorVertical; break;
+      case '4': entry.info.mirroring = Mapper::MirrorFourScreen; break;
+      case '0': entry.info.mirroring = Mapper::MirrorSingleLow; break;
+      case '1': entry.info.mirroring = Mapper::MirrorSingleHigh; break;
+      default: return false;
+    }
+    entry.fields |= FieldMirroring;
+  }
+  else if (strcmp(name, "region") == 0)
+  {
+    if (strcmp(value, "ntsc") == 0)
+      entry.info.region = RomInfo::RegionNtsc;
+    else if (strcmp(value, "pal") == 0)
+      entry.info.region = RomInfo::RegionPal;
+    else if (strcmp(value, "multi") == 0)
+      entry.info.region = RomInfo::RegionMulti;
+    else if (strcmp(value, "dendy") == 0)
+      entry.info.region = RomInfo::RegionDendy;
+    else
+      return false;
+    entry.fields |= FieldRegion;
+  }
+  else
+  {
+    return false;
+  }
+
+  return true;
+}
+
+// one "hash size modified path" line per ROM
+bool RomDatabase::loadHashCache(const char *fileName)
+{
+  FILE *infile = fopen(fileName, "r");
+  char line[RomDatabaseLineSize];
+
+  if (!infile)
+  {
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(hashCacheLock);
+  while (fgets(line, sizeof(line), infile))
+  {
+    unsigned int hash;
+    unsigned long long size;
+    long long modified;
+    int pathStart = 0;
+
+    if (sscanf(line, "%x %llu %lld %n", &hash, &size, &modified, &pathStart) != 3 || pathStart == 0)
+    {
+      continue;
+    }
+
+    std::string path(line + pathStart);
+    while (!path.empty() && (path.back() == '\n' || path.back() == '\r'))
+    {
+      path.pop_back();
+    }
+
+    CachedHash cached = { size, modified, hash };
+    hashCache[path] = cached;
+  }
+
+  fclose(infile);
+  hashCacheChanged = false;
+  return true;
+}
+
+bool RomDatabase::saveHashCache(const char *fileName)
+{
+  std::lock_guard<std::mutex> lock(hashCacheLock);
+
+  if (!hashCacheChanged)
+  {
+    return true;
+  }
+
+  FILE *outfile = fopen(fileName, "w");
+  if (!outfile)
+  {
+    return false;
+  }
+
+  for (auto &cached : hashCache)
+  {
+    fprintf(outfile, "%08x %llu %lld %s\n", cached.second.hash, (unsigned long long)cached.second.size,
+        (long long)cached.second.modified, cached.first.c_str());
+  }
+
+  bool written = fclose(outfile) == 0;
+  hashCacheChanged = !written;
+  return written;
+}
+
+size_t RomDatabase::getEntryCount()
+{
+  return entries.size();
+}
+
+uint32_t RomDatabase::hashRom(RomImage &image)
+{
+  return crc32(image.getRomData(), image.getPrgSize() + image.getChrSize());
+}
+
+// a file that can't be stat'ed is hashed every time
+uint32_t RomDatabase::getHash(const char *romFileName, RomImage &image)
+{
+  struct stat fileStat;
+
+  if (stat(romFileName, &fileStat) != 0)
+  {
+    return hashRom(image);
+  }
+
+  std::string path(romFileName);
+  {
+    std::lock_guard<std::mutex> lock(hashCacheLock);
+    auto found = hashCache.find(path);
+    if (found != hashCache.end() && found->second.size == (uint64_t)fileStat.st_size
+        && found->second.modified == (int64_t)fileStat.st_mtime)
+    {
+      return found->second.hash;
+    }
+  }
+
+  CachedHash cached = { (uint64_t)fileStat.st_size, (int64_t)fileStat.st_mtime, hashRom(image) };
+
+  std::lock_guard<std::mutex> lock(hashCacheLock);
+  hashCache[path] = cached;
+  hashCacheChanged = true;
+  return cached.hash;
+}
+
+bool RomDatabase::apply(const char *romFileName, RomImage &image, RomInfo &info)
+{
+  if (entries.empty())
+  {
+    return false;
+  }
+
+  auto found = entries.find(getHash(romFileName, image));
+  if (found == entries.end())
+  {
+    return false;
+  }
+
+  const Entry &entry = found->second;
+  if (entry.fields & FieldMapper)     info.mapper = entry.info.mapper;
+  if (entry.fields & FieldSubmapper)  info.submapper = entry.info.submapper;
+  if (entry.fields & FieldMirroring)  info.mirroring = entry.info.mirroring;
+  if (entry.fields & FieldRegion)     info.region = entry.info.region;
+  if (entry.fields & FieldPrgRam)     info.prgRamSize = entry.info.prgRamSize;
+  if (entry.fields & FieldPrgNvram)   info.prgNvramSize = entry.info.prgNvramSize;
+  if (entry.fields & FieldChrRam)     info.chrRamSize = entry.info.chrRamSize;
+  if (entry.fields & FieldChrNvram)   info.chrNvramSize = entry.info.chrNvramSize;
+  if (entry.fields & FieldBattery)    info.battery = entry.info.battery;
+  return true;
+}
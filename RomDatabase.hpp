@@ -0,0 +1,75 @@
+#ifndef ROM_DATABASE_HPP
+#define ROM_DATABASE_HPP
+#include "RomImage.hpp"
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <mutex>
+
+// Board configuration by ROM hash
+//
+// Headers are often wrong (bad mirroring, missing mapper bits, iNES files for
+// PAL games). Entries are keyed by the CRC-32 of PRG + CHR, the same key as
+// the usual NES 2.0 databases, and override whatever fields they name:
+//
+//   # crc32  fields...                                      name
+//   1a2b3c4d mapper=4 submapper=1 mirroring=v region=pal    # Some Game (E)
+//
+//   mapper, submapper       numbers
+//   mirroring               h, v, 4 (four screen), 0 / 1 (single screen low / high)
+//   region                  ntsc, pal, multi, dendy
+//   prgram, prgnvram        bytes
+//   chrram, chrnvram        bytes
+//   battery                 0 / 1
+//
+// Hashing a large ROM set every run is slow, so hashes are kept in a cache
+// file by path, size and modification time. An unchanged file is never read.
+class RomDatabase
+{
+  public:
+    RomDatabase();
+
+    bool load(const char *fileName);              // false if the file can't be read, bad lines are skipped
+    bool loadHashCache(const char *fileName);     // false if the file can't be read
+    bool saveHashCache(const char *fileName);     // writes only if hashes were added since the load
+    size_t getEntryCount();
+
+    uint32_t getHash(const char *romFileName, RomImage &image);  // through the hash cache
+    bool apply(const char *romFileName, RomImage &image, RomInfo &info);  // true if an entry corrected info
+    static uint32_t hashRom(RomImage &image);     // CRC-32 of PRG + CHR
+
+  private:
+    enum EntryFields
+    {
+      FieldMapper       = 1 << 0,
+      FieldSubmapper    = 1 << 1,
+      FieldMirroring    = 1 << 2,
+      FieldRegion       = 1 << 3,
+      FieldPrgRam       = 1 << 4,
+      FieldPrgNvram     = 1 << 5,
+      FieldChrRam       = 1 << 6,
+      FieldChrNvram     = 1 << 7,
+      FieldBattery      = 1 << 8,
+    };
+
+    struct Entry
+    {
+      uint32_t fields;                            // EntryFields present in the line
+      RomInfo info;
+    };
+
+    struct CachedHash
+    {
+      uint64_t size;
+      int64_t modified;
+      uint32_t hash;
+    };
+
+    std::unordered_map<uint32_t, Entry> entries;
+    std::unordered_map<std::string, CachedHash> hashCache;  // by ROM path
+    bool hashCacheChanged;
+    std::mutex hashCacheLock;                     // instances on other threads share one database
+
+    bool parseField(const char *name, const char *value, Entry &entry);
+};
+#endif
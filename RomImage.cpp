@@ -0,0 +1,363 @@
+#include "RomImage.hpp"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <map>
+#include <mutex>
+#include <tuple>
+
+#if defined(__linux__) || defined(__APPLE__)
+#define ROM_IMAGE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+struct InesHeader_T
+{
+  uint32_t  RomType;                      // ines always equals 'N', 'E', 'S', 1A
+	uint8_t   PrgRomPages;                  // PRG-ROM pages (16KB each, minimum 1 page) - PrgRomPages * 16384
+	uint8_t   ChrRomPages;                  // CHR-ROM pages (8KB each, minimum 1 page) - ChrBytePages * 8192
+
+	uint8_t   FlagsByte6;                   // Flags at byte 6
+#define MirroringVertical         0 << 0  //  0: horizontal (vertical arrangement) (CIRAM A10 = PPU A11)
+#define MirroringHorizontal       1 << 0  //  1: vertical (horizontal arrangement) (CIRAM A10 = PPU A10)
+#define BatteryBacked             1 << 1  //  Cartridge contains battery-backed PRG RAM ($6000-7FFF) or other persistent memory
+#define TrainerPresent            1 << 2  //  512-byte trainer at $7000-$71FF (stored before PRG data)
+#define IgnoreMirroringControl    1 << 3  //  Ignore mirroring control or above mirroring bit; instead provide four-screen VRAM
+#define LowerMapperNybble       0xF << 4  //  Lower nybble of mapper number
+
+	uint8_t   FlagsByte7;                   // flags at byte 7
+#define VsUnisystem               1 << 0  // 
+#define PlayChoice                1 << 1  //  PlayChoice-10 (8KB of Hint Screen data stored after CHR data)
+#define NesFormat                 3 << 2  //  If equal to 2, flags 8-15 are in NES 2.0 format
+#define NesFormat2                2 << 2  //  If equal to 2, flags 8-15 are in NES 2.0 format
+#define UpperMapperNybble       0xF << 4  //  Upper nybble of mapper number
+
+	uint8_t   FlagsByte8;                   // iNES: PRG RAM pages (8KB each, 0 infers 8KB)
+#define Nes2MapperMsb           0xF << 0  //  NES 2.0: mapper number bits 8-11
+#define Nes2Submapper           0xF << 4  //  NES 2.0: submapper
+
+	uint8_t   FlagsByte9;                   // flags at byte 9
+#define TvSystem                  1 << 0  //  iNES
+#define TvSystemNtsc              0 << 0  //
+#define TvSystemPal               1 << 0  //
+#define Nes2PrgRomMsb           0xF << 0  //  NES 2.0: PRG ROM size bits 8-11, 0xF for exponent-multiplier form
+#define Nes2ChrRomMsb           0xF << 4  //  NES 2.0: CHR ROM size bits 8-11
+
+	uint8_t   FlagsByte10;                  // NES 2.0: PRG RAM, 64 << shift bytes, 0 for none
+#define Nes2RamShift            0xF << 0  //  volatile
+#define Nes2NvramShift          0xF << 4  //  battery backed
+
+	uint8_t   FlagsByte11;                  // NES 2.0: CHR RAM, same layout as byte 10
+
+	uint8_t   FlagsByte12;                  // NES 2.0: CPU / PPU timing
+#define Nes2Timing                3 << 0  //  0: NTSC, 1: PAL, 2: multiple-region, 3: Dendy
+
+	uint8_t   Unused[3];                    // NES 2.0: system type, misc ROMs, default expansion device
+};
+
+//  https://wiki.nesdev.com/w/index.php/INES
+//  https://wiki.nesdev.com/w/index.php/NES_2.0
+//  If byte 7 AND $0C = $08, and the size taking into account byte 9 does not exceed the actual size of the ROM image, then NES 2.0.
+//  If byte 7 AND $0C = $00, and bytes 12-15 are all 0, then iNES.
+//  Otherwise, archaic iNES: bytes 7-15 are junk ("DiskDude!"), only the lower mapper nybble counts.
+
+#define InesHeaderSize            16
+#define InesTrainerSize           512
+#define InesPrgPageSize           0x4000
+#define InesChrPageSize           0x2000
+
+#ifdef ROM_IMAGE_MMAP
+// images that are open, by file identity: device, inode, size, modification time
+typedef std::tuple<uint64_t, uint64_t, uint64_t, int64_t> RomImageKey_T;
+static std::map<RomImageKey_T, std::weak_ptr<RomImage> > openImages;
+static std::mutex openImagesLock;
+#endif
+
+RomImage::RomImage()
+: data(nullptr),
+  size(0),
+  mapped(false),
+  trainer(nullptr),
+  prg(nullptr),
+  prgSize(0),
+  chr(nullptr),
+  chrSize(0)
+{
+  memset(&info, 0, sizeof(info));
+}
+
+RomImage::~RomImage()
+{
+#ifdef ROM_IMAGE_MMAP
+  if (mapped)
+  {
+    munmap(data, size);
+    return;
+  }
+#endif
+  free(data);
+}
+
+std::shared_ptr<RomImage> RomImage::open(const char *fileName, Error &error)
+{
+  std::shared_ptr<RomImage> image(new RomImage());
+
+#ifdef ROM_IMAGE_MMAP
+  int fd = ::open(fileName, O_RDONLY);
+  if (fd < 0)
+  {
+    error = ErrorOpen;
+    return nullptr;
+  }
+
+  struct stat fileStat;
+  if (fstat(fd, &fileStat) != 0)
+  {
+    close(fd);
+    error = ErrorOpen;
+    return nullptr;
+  }
+
+  RomImageKey_T key((uint64_t)fileStat.st_dev, (uint64_t)fileStat.st_ino, (uint64_t)fileStat.st_size, (int64_t)fileStat.st_mtime);
+  std::lock_guard<std::mutex> lock(openImagesLock);
+
+  auto found = openImages.find(key);
+  if (found != openImages.end())
+  {
+    std::shared_ptr<RomImage> shared = found->second.lock();
+    if (shared)
+    {
+      close(fd);
+      error = ErrorNone;
+      return shared;
+    }
+    openImages.erase(found);
+  }
+
+  // an empty file can't be mapped, it fails the header check below
+  image->size = (size_t)fileStat.st_size;
+  if (image->size != 0)
+  {
+    void *mapping = mmap(nullptr, image->size, PROT_READ, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED)
+    {
+      close(fd);
+      error = ErrorOpen;
+      return nullptr;
+    }
+    image->data = (uint8_t *)mapping;
+    image->mapped = true;
+  }
+  close(fd);
+#else
+  // no mmap: the image is read into memory and isn't shared between opens
+  FILE *infile = fopen(fileName, "rb");
+  if (!infile)
+  {
+    error = ErrorOpen;
+    return nullptr;
+  }
+
+  fseek(infile, 0, SEEK_END);
+  long length = ftell(infile);
+  fseek(infile, 0, SEEK_SET);
+  if (length < 0)
+  {
+    fclose(infile);
+    error = ErrorOpen;
+    return nullptr;
+  }
+
+  image->size = (size_t)length;
+  image->data = (uint8_t *)malloc(image->size ? image->size : 1);
+  if (image->size != 0 && fread(image->data, image->size, 1, infile) != 1)
+  {
+    fclose(infile);
+    error = ErrorOpen;
+    return nullptr;
+  }
+  fclose(infile);
+#endif
+
+  error = image->parse();
+  if (error != ErrorNone)
+  {
+    return nullptr;
+  }
+
+#ifdef ROM_IMAGE_MMAP
+  openImages[key] = image;
+#endif
+  return image;
+}
+
+const char *RomImage::getErrorString(Error error)
+{
+  switch (error)
+  {
+    case ErrorNone:       return "no error";
+    case ErrorOpen:       return "can't open file";
+    case ErrorNotInes:    return "not an iNES file";
+    case ErrorNoPrg:      return "no PRG ROM";
+    case ErrorTruncated:  return "file is shorter than its header";
+    case ErrorMapper:     return "mapper is not supported";
+  }
+
+  return "unknown error";
+}
+
+// NES 2.0 ROM size, size is the header byte, msb the nybble from byte 9,
+// false for an exponent-multiplier size no file can hold
+static bool romSize(uint8_t size, uint8_t msb, uint64_t pageSize, uint64_t &bytes)
+{
+  if (msb != 0xF)
+  {
+    bytes = (((uint64_t)msb << 8) | size) * pageSize;
+    return true;
+  }
+
+  // exponent-multiplier form: 2^E * (MM * 2 + 1)
+  uint8_t exponent = size >> 2;
+  uint8_t multiplier = (size & 3) * 2 + 1;
+  bytes = (exponent < 48) ? ((uint64_t)1 << exponent) * multiplier : 0;
+  return exponent < 48;
+}
+
+// PRG and CHR fit in what is left of the file after offset, without overflowing
+static bool romsFit(uint64_t offset, uint64_t prgSize, uint64_t chrSize, uint64_t size)
+{
+  return offset <= size && prgSize <= size - offset && chrSize <= size - offset - prgSize;
+}
+
+// NES 2.0 RAM size, 64 << shift bytes, 0 for none
+static uint32_t ramSize(uint8_t shift)
+{
+  return (shift != 0) ? (uint32_t)64 << shift : 0;
+}
+
+// header, then optional trainer, PRG ROM and CHR ROM back to back, anything
+// after CHR (PlayChoice-10 hint screen, misc ROMs) is ignored
+RomImage::Error RomImage::parse()
+{
+  InesHeader_T header;
+
+  if (size < InesHeaderSize || memcmp(data, "NES\x1A", 4) != 0)
+  {
+    return ErrorNotInes;
+  }
+  memcpy(&header, data, InesHeaderSize);
+
+  uint64_t offset = InesHeaderSize;
+  if (header.FlagsByte6 & TrainerPresent)
+  {
+    offset += InesTrainerSize;
+  }
+
+  bool nes20 = (header.FlagsByte7 & NesFormat) == NesFormat2;
+  uint64_t nes2PrgSize = 0;
+  uint64_t nes2ChrSize = 0;
+  uint64_t romPrgSize;
+  uint64_t romChrSize;
+  uint16_t lowerMapper = (header.FlagsByte6 & LowerMapperNybble) >> 4;
+
+  if (nes20 && (!romSize(header.PrgRomPages, header.FlagsByte9 & Nes2PrgRomMsb, InesPrgPageSize, nes2PrgSize) ||
+      !romSize(header.ChrRomPages, (header.FlagsByte9 & Nes2ChrRomMsb) >> 4, InesChrPageSize, nes2ChrSize)))
+  {
+    return ErrorTruncated;
+  }
+
+  info.nes20 = nes20 && romsFit(offset, nes2PrgSize, nes2ChrSize, size);
+  info.battery = (header.FlagsByte6 & BatteryBacked) != 0;
+  if (header.FlagsByte6 & IgnoreMirroringControl)
+  {
+    info.mirroring = Mapper::MirrorFourScreen;
+  }
+  else
+  {
+    info.mirroring = (header.FlagsByte6 & MirroringHorizontal) ? Mapper::MirrorVertical : Mapper::MirrorHorizontal;
+  }
+
+  if (info.nes20)
+  {
+    romPrgSize = nes2PrgSize;
+    romChrSize = nes2ChrSize;
+    info.mapper = lowerMapper | (header.FlagsByte7 & UpperMapperNybble) | ((header.FlagsByte8 & Nes2MapperMsb) << 8);
+    info.submapper = (header.FlagsByte8 & Nes2Submapper) >> 4;
+    info.region = (RomInfo::Region)(header.FlagsByte12 & Nes2Timing);
+    info.prgRamSize = ramSize(header.FlagsByte10 & Nes2RamShift);
+    info.prgNvramSize = ramSize((header.FlagsByte10 & Nes2NvramShift) >> 4);
+    info.chrRamSize = ramSize(header.FlagsByte11 & Nes2RamShift);
+    info.chrNvramSize = ramSize((header.FlagsByte11 & Nes2NvramShift) >> 4);
+  }
+  else
+  {
+    bool archaic = (header.FlagsByte7 & NesFormat) != 0 || header.FlagsByte12 != 0
+      || header.Unused[0] != 0 || header.Unused[1] != 0 || header.Unused[2] != 0;
+    uint32_t prgRamSize = (!archaic && header.FlagsByte8 != 0) ? header.FlagsByte8 * 0x2000 : 0x2000;
+
+    romPrgSize = (uint64_t)header.PrgRomPages * InesPrgPageSize;
+    romChrSize = (uint64_t)header.ChrRomPages * InesChrPageSize;
+    info.mapper = lowerMapper | (archaic ? 0 : (header.FlagsByte7 & UpperMapperNybble));
+    info.submapper = 0;
+    info.region = (!archaic && (header.FlagsByte9 & TvSystem) == TvSystemPal) ? RomInfo::RegionPal : RomInfo::RegionNtsc;
+    info.prgRamSize = info.battery ? 0 : prgRamSize;
+    info.prgNvramSize = info.battery ? prgRamSize : 0;
+    info.chrRamSize = (romChrSize == 0) ? 0x2000 : 0;
+    info.chrNvramSize = 0;
+  }
+
+  if (romPrgSize == 0)
+  {
+    return ErrorNoPrg;
+  }
+
+  if (!romsFit(offset, romPrgSize, romChrSize, size))
+  {
+    return ErrorTruncated;
+  }
+
+  trainer = (header.FlagsByte6 & TrainerPresent) ? data + InesHeaderSize : nullptr;
+  prgSize = (size_t)romPrgSize;
+  chrSize = (size_t)romChrSize;
+  prg = data + offset;
+  chr = (chrSize != 0) ? prg + prgSize : nullptr;
+  return ErrorNone;
+}
+
+const uint8_t *RomImage::getPrg()
+{
+  return prg;
+}
+
+size_t RomImage::getPrgSize()
+{
+  return prgSize;
+}
+
+const uint8_t *RomImage::getChr()
+{
+  return chr;
+}
+
+size_t RomImage::getChrSize()
+{
+  return chrSize;
+}
+
+const uint8_t *RomImage::getTrainer()
+{
+  return trainer;
+}
+
+const uint8_t *RomImage::getRomData()
+{
+  return prg;
+}
+
+const RomInfo &RomImage::getInfo()
+{
+  return info;
+}
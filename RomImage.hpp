@@ -0,0 +1,79 @@
+#ifndef ROM_IMAGE_HPP
+#define ROM_IMAGE_HPP
+#include "Mapper.hpp"
+#include <stdint.h>
+#include <stddef.h>
+#include <memory>
+
+// Board configuration from the header, a RomDatabase entry may correct it
+struct RomInfo
+{
+  enum Region
+  {
+    RegionNtsc,
+    RegionPal,
+    RegionMulti,              // runs on either
+    RegionDendy,
+  };
+
+  uint16_t mapper;            // 12 bits for NES 2.0, 8 for iNES
+  uint8_t submapper;          // NES 2.0 only
+  Mapper::Mirroring mirroring;
+  Region region;
+  uint32_t prgRamSize;        // bytes of volatile PRG RAM
+  uint32_t prgNvramSize;      // bytes of battery backed PRG RAM
+  uint32_t chrRamSize;
+  uint32_t chrNvramSize;
+  bool battery;
+  bool nes20;                 // NES 2.0 header
+};
+
+// iNES / NES 2.0 cartridge image
+//
+// The .nes file is mapped read-only and PRG / CHR are handed out as spans of
+// the mapping, nothing is copied. Images are shared: opening a file that is
+// already open (same device, inode, size and modification time) returns the
+// same image, so every emulator instance running a ROM uses one copy of it.
+// The image stays mapped until the last shared_ptr to it goes away.
+class RomImage
+{
+  public:
+    enum Error
+    {
+      ErrorNone,
+      ErrorOpen,            // file can't be opened, read or mapped
+      ErrorNotInes,         // no "NES" 1A signature
+      ErrorNoPrg,           // header has no PRG ROM
+      ErrorTruncated,       // file is shorter than the header says
+      ErrorMapper,          // board isn't supported (Memory::loadRom)
+    };
+
+    // nullptr and error set on failure
+    static std::shared_ptr<RomImage> open(const char *fileName, Error &error);
+    static const char *getErrorString(Error error);
+    ~RomImage();
+
+    const uint8_t *getPrg();
+    size_t getPrgSize();                  // 16KB pages, NES 2.0 exponent sizes can be anything
+    const uint8_t *getChr();              // nullptr if the board has CHR RAM
+    size_t getChrSize();                  // 8KB pages like PRG, 0 for CHR RAM
+    const uint8_t *getTrainer();          // 512 bytes for $7000-$71FF, nullptr without one
+    const uint8_t *getRomData();          // PRG followed by CHR, what RomDatabase hashes
+    const RomInfo &getInfo();             // as the header says
+
+  private:
+    RomImage();
+
+    uint8_t *data;                        // whole file
+    size_t size;
+    bool mapped;                          // data is an mmap, otherwise malloc'd
+    const uint8_t *trainer;
+    const uint8_t *prg;
+    size_t prgSize;
+    const uint8_t *chr;
+    size_t chrSize;
+    RomInfo info;
+
+    Error parse();
+};
+#endif
@@ -0,0 +1,129 @@
+#include "Cpu.hpp"
+#include "Scheduler.hpp"
+#include <algorithm>
+#include <functional>
+
+// 21.477272 MHz is 236.25 MHz / 11, a tick is 11000 / 236.25 = 8800 / 189 ns
+#define MASTER_TICK_NS_NUMERATOR        8800
+#define MASTER_TICK_NS_DENOMINATOR      189
+
+Scheduler::Scheduler(Cpu *cpu, uint32_t cpuDivider)
+: cpu(cpu),
+  cpuDivider(cpuDivider),
+  now(0),
+  cpuCycles(0),
+  posted(0)
+{
+}
+
+int Scheduler::addEvent(EventHandler_T handler, void *context)
+{
+  Event event = { handler, context, Never, 0 };
+  events.push_back(event);
+  return (int)events.size() - 1;
+}
+
+void Scheduler::schedule(int event, uint64_t time)
+{
+  Event &entry = events[event];
+  entry.generation++;
+  entry.time = time;
+
+  if (time != Never)
+  {
+    Pending pending = { time, posted++, event, entry.generation };
+    heap.push_back(pending);
+    std::push_heap(heap.begin(), heap.end(), std::greater<Pending>());
+  }
+}
+
+void Scheduler::cancel(int event)
+{
+  schedule(event, Never);
+}
+
+void Scheduler::addCatchUp(CatchUp_T catchUp, void *context)
+{
+  CatchUp entry = { catchUp, context };
+  catchUps.push_back(entry);
+}
+
+// cancelled and rescheduled events leave their old entries in the heap
+void Scheduler::dropStale()
+{
+  while (!heap.empty() && heap.front().generation != events[heap.front().event].generation)
+  {
+    std::pop_heap(heap.begin(), heap.end(), std::greater<Pending>());
+    heap.pop_back();
+  }
+}
+
+void Scheduler::run(uint64_t time)
+{
+  while (true)
+  {
+    dropStale();
+    uint64_t next = (!heap.empty() && heap.front().time < time) ? heap.front().time : time;
+
+    // one CPU batch to the deadline, rounded up to a whole cycle
+    if (next > now)
+    {
+      uint64_t cycles = (next - now + cpuDivider - 1) / cpuDivider;
+      cpu->runCycles(cycles);
+      for (CatchUp &entry : catchUps)
+      {
+        entry.catchUp(entry.context, cycles);
+      }
+      now += cycles * cpuDivider;
+      cpuCycles += cycles;
+    }
+
+    // a handler can post more events that are already due, they fire here too
+    for (dropStale(); !heap.empty() && heap.front().time <= now; dropStale())
+    {
+      Pending due = heap.front();
+      std::pop_heap(heap.begin(), heap.end(), std::greater<Pending>());
+      heap.pop_back();
+
+      Event &event = events[due.event];
+      event.time = Never;
+      uint64_t again = event.handler(event.context, due.time);
+      if (again != Never && events[due.event].time == Never)
+      {
+        schedule(due.event, again);
+      }
+    }
+
+    if (now >= time)
+    {
+      return;
+    }
+  }
+}
+
+uint64_t Scheduler::getTime()
+{
+  return now;
+}
+
+uint64_t Scheduler::getNextEventTime()
+{
+  dropStale();
+  return heap.empty() ? Never : heap.front().time;
+}
+
+uint64_t Scheduler::getCpuCycles()
+{
+  return cpuCycles;
+}
+
+uint32_t Scheduler::getCpuDivider()
+{
+  return cpuDivider;
+}
+
+uint64_t Scheduler::ticksToNanoseconds(uint64_t ticks)
+{
+  return ticks / MASTER_TICK_NS_DENOMINATOR * MASTER_TICK_NS_NUMERATOR
+       + ticks % MASTER_TICK_NS_DENOMINATOR * MASTER_TICK_NS_NUMERATOR / MASTER_TICK_NS_DENOMINATOR;
+}
@@ -0,0 +1,84 @@
+#ifndef SCHEDULER_HPP
+#define SCHEDULER_HPP
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+class Cpu;
+
+// Master clock event scheduler
+//
+// Time is counted in master clock ticks, the NTSC crystal at 21.477272 MHz:
+// a CPU cycle is 12 ticks, a PPU dot 4. Components post events at absolute
+// times (scanline ends, vblank, board IRQs, frame ends) into a min-heap. The
+// CPU runs in one batch up to the earliest one, catch-up hooks bring the
+// components clocked with it along, then every event that is due fires in
+// time order, ties in the order they were posted. Nothing reads the host
+// clock, a run is the same at any host speed.
+class Scheduler
+{
+  public:
+    static const uint32_t CpuDivider = 12;          // master ticks per CPU cycle
+    static const uint32_t PpuDivider = 4;           // master ticks per PPU dot
+    static const uint64_t Never = UINT64_MAX;
+
+    // returns when to fire next, Never to leave it unscheduled
+    typedef uint64_t (*EventHandler_T)(void *context, uint64_t time);
+    // the CPU just ran this many cycles
+    typedef void (*CatchUp_T)(void *context, uint64_t cycles);
+
+    Scheduler(Cpu *cpu, uint32_t cpuDivider = CpuDivider);
+
+    int addEvent(EventHandler_T handler, void *context);  // unscheduled until schedule
+    void schedule(int event, uint64_t time);              // replaces the pending time
+    void cancel(int event);
+    void addCatchUp(CatchUp_T catchUp, void *context);
+
+    void run(uint64_t time);                      // until the CPU reaches time, the last batch may run a few ticks past it
+    uint64_t getTime();                           // master clock the CPU has reached
+    uint64_t getNextEventTime();                  // earliest scheduled event, Never without one
+    uint64_t getCpuCycles();
+    uint32_t getCpuDivider();
+
+    static uint64_t ticksToNanoseconds(uint64_t ticks);
+
+  private:
+    struct Event
+    {
+      EventHandler_T handler;
+      void *context;
+      uint64_t time;                              // Never when unscheduled
+      uint32_t generation;                        // bumped by schedule / cancel, older heap entries are stale
+    };
+
+    struct Pending
+    {
+      uint64_t time;
+      uint64_t order;                             // post order, breaks ties
+      int event;
+      uint32_t generation;
+
+      bool operator>(const Pending &other) const
+      {
+        return (time != other.time) ? time > other.time : order > other.order;
+      }
+    };
+
+    struct CatchUp
+    {
+      CatchUp_T catchUp;
+      void *context;
+    };
+
+    Cpu *cpu;
+    uint32_t cpuDivider;
+    uint64_t now;
+    uint64_t cpuCycles;
+    uint64_t posted;
+    std::vector<Event> events;
+    std::vector<Pending> heap;                    // min-heap on time, then order
+    std::vector<CatchUp> catchUps;
+
+    void dropStale();
+};
+#endif
@@ -0,0 +1,204 @@
+#include "TileCache.hpp"
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define TILE_CACHE_X86
+#include <immintrin.h>
+#endif
+
+TileCache::TileCache()
+: expand(selectExpand())
+{
+  memset(sources, 0, sizeof(sources));
+  memset(slots, 0, sizeof(slots));
+}
+
+TileCache::~TileCache()
+{
+  clear();
+}
+
+void TileCache::clear()
+{
+  for (auto &page : pages)
+  {
+    delete page.second;
+  }
+
+  pages.clear();
+  memset(sources, 0, sizeof(sources));
+  memset(slots, 0, sizeof(slots));
+}
+
+// only slots whose bank changed, or whose tiles were written, cost anything
+void TileCache::mapPages(const uint8_t *const *chrPages)
+{
+  for (int slot = 0; slot < 8; slot++)
+  {
+    if (chrPages[slot] != sources[slot])
+    {
+      sources[slot] = chrPages[slot];
+      slots[slot] = findPage(chrPages[slot]);
+    }
+
+    if (slots[slot]->dirty != 0)
+    {
+      expandDirty(sources[slot], slots[slot]);
+    }
+  }
+}
+
+void TileCache::invalidate(const uint8_t *chrPage, uint16_t offset)
+{
+  auto found = pages.find(chrPage);
+
+  if (found != pages.end())
+  {
+    found->second->dirty |= (uint64_t)1 << ((offset >> 4) & 63);
+  }
+}
+
+TileCache::DecodedPage *TileCache::findPage(const uint8_t *chrPage)
+{
+  auto found = pages.find(chrPage);
+
+  if (found != pages.end())
+  {
+    return found->second;
+  }
+
+  DecodedPage *page = new DecodedPage();
+  page->dirty = ~(uint64_t)0;
+  pages[chrPage] = page;
+  return page;
+}
+
+void TileCache::expandDirty(const uint8_t *chrPage, DecodedPage *page)
+{
+  for (uint64_t dirty = page->dirty; dirty != 0; dirty &= dirty - 1)
+  {
+    int tile = __builtin_ctzll(dirty);
+    expand(chrPage + tile * 16, page->tiles[tile], page->flipped[tile]);
+  }
+
+  page->dirty = 0;
+}
+
+TileCache::Expand_T TileCache::selectExpand()
+{
+#ifdef TILE_CACHE_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+  {
+    return &TileCache::expandAvx2;
+  }
+  return &TileCache::expandSse2;
+#else
+  return &TileCache::expandScalar;
+#endif
+}
+
+// 8 bytes of the low bit plane then 8 of the high one, bit 7 is the leftmost pixel
+void TileCache::expandScalar(const uint8_t *pattern, uint8_t *tile, uint8_t *flipped)
+{
+  for (int row = 0; row < 8; row++)
+  {
+    uint8_t low = pattern[row];
+    uint8_t high = pattern[row + 8];
+
+    for (int bit = 0; bit < 8; bit++)
+    {
+      uint8_t colour = ((low >> (7 - bit)) & 1) | (((high >> (7 - bit)) & 1) << 1);
+      tile[row * 8 + bit] = colour;
+      flipped[row * 8 + 7 - bit] = colour;
+    }
+  }
+}
+
+#ifdef TILE_CACHE_X86
+// Each plane byte is repeated across its row with unpacks, ANDed with the
+// bit of each pixel and compared, which gives 0xFF for set bits. Flipped
+// rows just test the bits in the opposite order.
+void TileCache::expandSse2(const uint8_t *pattern, uint8_t *tile, uint8_t *flipped)
+{
+  const __m128i bits = _mm_set_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+  const __m128i flippedBits = _mm_set_epi8(-128, 64, 32, 16, 8, 4, 2, 1, -128, 64, 32, 16, 8, 4, 2, 1);
+  const __m128i one = _mm_set1_epi8(1);
+  const __m128i two = _mm_set1_epi8(2);
+
+  __m128i low = _mm_loadl_epi64((const __m128i *)pattern);
+  __m128i high = _mm_loadl_epi64((const __m128i *)(pattern + 8));
+  low = _mm_unpacklo_epi8(low, low);
+  high = _mm_unpacklo_epi8(high, high);
+
+  // two rows per register: 0-1, 2-3, 4-5, 6-7
+  __m128i lowQuads[2] = { _mm_unpacklo_epi16(low, low), _mm_unpackhi_epi16(low, low) };
+  __m128i highQuads[2] = { _mm_unpacklo_epi16(high, high), _mm_unpackhi_epi16(high, high) };
+
+  for (int quad = 0; quad < 2; quad++)
+  {
+    __m128i lowRows[2] = { _mm_unpacklo_epi32(lowQuads[quad], lowQuads[quad]), _mm_unpackhi_epi32(lowQuads[quad], lowQuads[quad]) };
+    __m128i highRows[2] = { _mm_unpacklo_epi32(highQuads[quad], highQuads[quad]), _mm_unpackhi_epi32(highQuads[quad], highQuads[quad]) };
+
+    for (int pair = 0; pair < 2; pair++)
+    {
+      int offset = (quad * 2 + pair) * 16;
+
+      __m128i lowPixels = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(lowRows[pair], bits), bits), one);
+      __m128i highPixels = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(highRows[pair], bits), bits), two);
+      _mm_storeu_si128((__m128i *)(tile + offset), _mm_or_si128(lowPixels, highPixels));
+
+      lowPixels = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(lowRows[pair], flippedBits), flippedBits), one);
+      highPixels = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(highRows[pair], flippedBits), flippedBits), two);
+      _mm_storeu_si128((__m128i *)(flipped + offset), _mm_or_si128(lowPixels, highPixels));
+    }
+  }
+}
+
+// four rows per register, the plane bytes are broadcast and a byte shuffle
+// repeats each one across its row
+__attribute__((target("avx2")))
+void TileCache::expandAvx2(const uint8_t *pattern, uint8_t *tile, uint8_t *flipped)
+{
+  const __m256i bits = _mm256_set1_epi64x((long long)0x0102040810204080ull);
+  const __m256i flippedBits = _mm256_set1_epi64x((long long)0x8040201008040201ull);
+  const __m256i one = _mm256_set1_epi8(1);
+  const __m256i two = _mm256_set1_epi8(2);
+  const __m256i rows[2] =
+  {
+    _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3),
+    _mm256_setr_epi8(4, 4, 4, 4, 4, 4, 4, 4, 5, 5, 5, 5, 5, 5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 6, 7, 7, 7, 7, 7, 7, 7, 7),
+  };
+
+  uint64_t lowBytes;
+  uint64_t highBytes;
+  memcpy(&lowBytes, pattern, 8);
+  memcpy(&highBytes, pattern + 8, 8);
+  __m256i low = _mm256_set1_epi64x((long long)lowBytes);
+  __m256i high = _mm256_set1_epi64x((long long)highBytes);
+
+  for (int half = 0; half < 2; half++)
+  {
+    __m256i lowRows = _mm256_shuffle_epi8(low, rows[half]);
+    __m256i highRows = _mm256_shuffle_epi8(high, rows[half]);
+
+    __m256i lowPixels = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(lowRows, bits), bits), one);
+    __m256i highPixels = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(highRows, bits), bits), two);
+    _mm256_storeu_si256((__m256i *)(tile + half * 32), _mm256_or_si256(lowPixels, highPixels));
+
+    lowPixels = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(lowRows, flippedBits), flippedBits), one);
+    highPixels = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(highRows, flippedBits), flippedBits), two);
+    _mm256_storeu_si256((__m256i *)(flipped + half * 32), _mm256_or_si256(lowPixels, highPixels));
+  }
+}
+#else
+void TileCache::expandSse2(const uint8_t *pattern, uint8_t *tile, uint8_t *flipped)
+{
+  expandScalar(pattern, tile, flipped);
+}
+
+void TileCache::expandAvx2(const uint8_t *pattern, uint8_t *tile, uint8_t *flipped)
+{
+  expandScalar(pattern, tile, flipped);
+}
+#endif
@@ -0,0 +1,60 @@
+#ifndef TILE_CACHE_HPP
+#define TILE_CACHE_HPP
+#include <stdint.h>
+#include <stddef.h>
+#include <unordered_map>
+
+// Pattern table tiles expanded to one byte per pixel
+//
+// Every 1KB CHR page the PPU has mapped is kept as 64 tiles of 8 rows of 8
+// colour bytes (0 -> 3), plus a copy with each row mirrored for horizontally
+// flipped sprites. Pages are found by the CHR bytes they came from, so a bank
+// switch back to a page seen before costs nothing. Writes to CHR RAM mark the
+// tile, it is expanded again the next time its page is mapped.
+class TileCache
+{
+  public:
+    static const int TileBytes = 64;
+
+    TileCache();
+    ~TileCache();
+
+    void clear();                                         // the CHR pages belong to a different ROM now
+    void mapPages(const uint8_t *const *chrPages);        // PPU $0000 -> $1FFF in 1KB pages, once per scanline
+    void invalidate(const uint8_t *chrPage, uint16_t offset);  // CHR RAM byte written
+
+    // pattern table address of the tile (low 4 bits ignored), valid until the next mapPages
+    inline const uint8_t *getTile(uint16_t address)
+    {
+      return slots[(address >> 10) & 7]->tiles[(address >> 4) & 63];
+    }
+
+    inline const uint8_t *getFlippedTile(uint16_t address)
+    {
+      return slots[(address >> 10) & 7]->flipped[(address >> 4) & 63];
+    }
+
+  private:
+    struct DecodedPage
+    {
+      uint8_t tiles[64][TileBytes];
+      uint8_t flipped[64][TileBytes];
+      uint64_t dirty;                                     // tiles to expand again
+    };
+
+    typedef void (*Expand_T)(const uint8_t *pattern, uint8_t *tile, uint8_t *flipped);
+
+    std::unordered_map<const uint8_t *, DecodedPage *> pages;
+    const uint8_t *sources[8];                            // CHR page of each slot
+    DecodedPage *slots[8];
+    Expand_T expand;
+
+    DecodedPage *findPage(const uint8_t *chrPage);
+    void expandDirty(const uint8_t *chrPage, DecodedPage *page);
+
+    static Expand_T selectExpand();
+    static void expandScalar(const uint8_t *pattern, uint8_t *tile, uint8_t *flipped);
+    static void expandSse2(const uint8_t *pattern, uint8_t *tile, uint8_t *flipped);
+    static void expandAvx2(const uint8_t *pattern, uint8_t *tile, uint8_t *flipped);
+};
+#endif
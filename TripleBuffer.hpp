@@ -0,0 +1,86 @@
+#ifndef TRIPLE_BUFFER_HPP
+#define TRIPLE_BUFFER_HPP
+#include <stdint.h>
+#include <atomic>
+
+// Newest-value handoff between one writer thread and one reader thread
+//
+// The writer fills one buffer while the reader holds another, the third sits
+// between them holding the last one published. Publishing and taking are a
+// single atomic exchange of the middle index, neither side ever waits. A
+// buffer published over one the reader never took drops that one, a take
+// with nothing new published leaves the reader on what it had.
+template <typename T>
+class TripleBuffer
+{
+  public:
+    TripleBuffer()
+    : middle(1),
+      writeIndex(0),
+      readIndex(2),
+      dropped(0),
+      repeated(0)
+    {
+    }
+
+    T &getWriteBuffer()
+    {
+      return buffers[writeIndex];
+    }
+
+    // writer: the write buffer becomes the newest, true when that dropped an
+    // untaken one (it is the new write buffer)
+    bool publish()
+    {
+      uint8_t previous = middle.exchange(writeIndex | Fresh, std::memory_order_acq_rel);
+      writeIndex = previous & IndexMask;
+
+      if (previous & Fresh)
+      {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return true;
+      }
+      return false;
+    }
+
+    // reader: newest published buffer becomes the read buffer, false and
+    // counted as a repeat when nothing new was published since the last take
+    bool take()
+    {
+      if (!(middle.load(std::memory_order_relaxed) & Fresh))
+      {
+        repeated.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      }
+
+      readIndex = middle.exchange(readIndex, std::memory_order_acq_rel) & IndexMask;
+      return true;
+    }
+
+    const T &getReadBuffer()
+    {
+      return buffers[readIndex];
+    }
+
+    uint64_t getDropped()
+    {
+      return dropped.load(std::memory_order_relaxed);
+    }
+
+    uint64_t getRepeated()
+    {
+      return repeated.load(std::memory_order_relaxed);
+    }
+
+  private:
+    static const uint8_t IndexMask = 0x03;
+    static const uint8_t Fresh = 0x04;            // middle was published and not taken yet
+
+    T buffers[3];
+    std::atomic<uint8_t> middle;
+    uint8_t writeIndex;                           // writer's own
+    uint8_t readIndex;                            // reader's own
+    std::atomic<uint64_t> dropped;
+    std::atomic<uint64_t> repeated;
+};
+#endif